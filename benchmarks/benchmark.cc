@@ -27,6 +27,232 @@
 
 static const int kNumReps = 10;
 
+// Chunk size used for the arena-allocation runs.
+static const size_t kArenaChunkSize = 512 * 1024;
+
+// Slab size used for the pooled runs.
+static const size_t kPoolSlabSize = 16 * 1024;
+
+// Returns the average time, in microseconds, to parse & destroy 'contents'.
+static long TimeParse(const GumboOptions& options, const std::string& contents) {
+  clock_t start_time = clock();
+  for (int i = 0; i < kNumReps; ++i) {
+    GumboOutput* output = gumbo_parse_with_options(
+        &options, contents.data(), contents.length());
+    gumbo_destroy_output(&options, output);
+  }
+  clock_t end_time = clock();
+  return 1000000 * (end_time - start_time) / (kNumReps * CLOCKS_PER_SEC);
+}
+
+// The number of times each parse tree is traversed, since a traversal takes a
+// small fraction of the time of a parse.
+static const int kNumTraversalReps = 1000;
+
+// Counts the nodes of a tree by indexing the children vector of each node.
+static long CountNodesThroughVectors(const GumboNode* node) {
+  const GumboVector* children;
+  if (node->type == GUMBO_NODE_DOCUMENT) {
+    children = &node->v.document.children;
+  } else if (node->type == GUMBO_NODE_ELEMENT ||
+             node->type == GUMBO_NODE_TEMPLATE) {
+    children = &node->v.element.children;
+  } else {
+    return 1;
+  }
+  long num_nodes = 1;
+  for (unsigned int i = 0; i < children->length; ++i) {
+    num_nodes +=
+        CountNodesThroughVectors(static_cast<GumboNode*>(children->data[i]));
+  }
+  return num_nodes;
+}
+
+// Counts the nodes of a tree by following the first_child and next_sibling
+// links of each node.
+static long CountNodesThroughLinks(const GumboNode* node) {
+  long num_nodes = 1;
+  for (const GumboNode* child = node->first_child; child;
+       child = child->next_sibling) {
+    num_nodes += CountNodesThroughLinks(child);
+  }
+  return num_nodes;
+}
+
+// Returns the average time, in nanoseconds, to count the nodes of a tree.
+static long TimeTraversal(
+    const GumboOutput* output, long (*count_nodes)(const GumboNode*)) {
+  long num_nodes = 0;
+  clock_t start_time = clock();
+  for (int i = 0; i < kNumTraversalReps; ++i) {
+    num_nodes += count_nodes(output->document);
+  }
+  clock_t end_time = clock();
+  if (num_nodes == 0) {
+    std::cout << "  empty tree!\n";
+  }
+  return 1000000000.0 * (end_time - start_time) /
+         (kNumTraversalReps * CLOCKS_PER_SEC);
+}
+
+// Like TimeParse, but parses through a reused GumboParserContext.
+static long TimeContextParse(
+    const GumboOptions& options, const std::string& contents) {
+  GumboParserContext* context = gumbo_parser_context_create(&options);
+  clock_t start_time = clock();
+  for (int i = 0; i < kNumReps; ++i) {
+    GumboOutput* output = gumbo_parser_context_parse(
+        context, contents.data(), contents.length());
+    gumbo_destroy_output(&options, output);
+  }
+  clock_t end_time = clock();
+  gumbo_parser_context_destroy(context);
+  return 1000000 * (end_time - start_time) / (kNumReps * CLOCKS_PER_SEC);
+}
+
+static void* CountingMalloc(void* userdata, size_t size) {
+  ++*static_cast<long*>(userdata);
+  return malloc(size);
+}
+
+static void CountingFree(void* userdata, void* ptr) { free(ptr); }
+
+// Returns the number of allocator calls it takes to parse 'contents'.
+static long CountAllocations(
+    const GumboOptions& options, const std::string& contents) {
+  long num_allocations = 0;
+  GumboOptions counting_options = options;
+  counting_options.allocator = CountingMalloc;
+  counting_options.deallocator = CountingFree;
+  counting_options.userdata = &num_allocations;
+  GumboOutput* output = gumbo_parse_with_options(
+      &counting_options, contents.data(), contents.length());
+  gumbo_destroy_output(&counting_options, output);
+  return num_allocations;
+}
+
+// Prints the time for one variant of the parse next to the default one.
+static void PrintComparison(const char* variant, long baseline, long time) {
+  std::cout << "  " << variant << ": " << time << " microseconds";
+  if (time > 0) {
+    std::cout << " (" << (double) baseline / time << "x)";
+  }
+  std::cout << ".\n";
+}
+
+// Returns a run of 'num_tags' unclosed <font> tags that share all but the last
+// of their attributes, which the Noah's Ark clause compares against each other
+// as they're added to the list of active formatting elements.
+static std::string MakeFontRun(int num_tags) {
+  std::string attributes;
+  for (int i = 0; i < 15; ++i) {
+    attributes += " a" + std::to_string(i) + "=v";
+  }
+  std::string run;
+  for (int i = 0; i < num_tags; ++i) {
+    run += "<font" + attributes + " id=" + std::to_string(i / 4) + ">x";
+  }
+  return run;
+}
+
+// Times runs of unclosed formatting tags of growing length.
+static void TimeFormattingRuns() {
+  std::cout << "formatting runs:\n";
+  for (int num_tags = 1000; num_tags <= 8000; num_tags *= 2) {
+    long time = TimeParse(kGumboDefaultOptions, MakeFontRun(num_tags));
+    std::cout << "  " << num_tags << " <font> tags: " << time
+              << " microseconds.\n";
+  }
+}
+
+// Misnested formatting tags that each run the adoption agency algorithm.
+static const char* const kMisnestingPatterns[] = {
+    "<b><i></b>x", "<b><i><u></b>x", "<a><b></a>x", "<b><i></b></i>"};
+
+// The number of paragraphs that reopen the formatting elements left open by
+// MakeReopenedRun, and the cap on how many are reopened for comparison.
+static const int kNumReopeningParagraphs = 100;
+static const int kMaxReconstructedFormattingElements = 64;
+
+// num_tags distinct formatting tags closed by a </div>, each of which the
+// following paragraphs reopen.
+static std::string MakeReopenedRun(int num_tags) {
+  std::string run = "<div>";
+  for (int i = 0; i < num_tags; ++i) {
+    run += "<b id=" + std::to_string(i) + ">";
+  }
+  run += "</div>";
+  for (int i = 0; i < kNumReopeningParagraphs; ++i) {
+    run += "<p>x</p>";
+  }
+  return run;
+}
+
+// Times repetitions of misnested formatting tags of growing length.  Errors are
+// only counted, since each recorded one copies the stack of open elements,
+// which most of these patterns leave growing.
+static void TimeMisnesting() {
+  std::cout << "misnesting:\n";
+  GumboOptions options = kGumboDefaultOptions;
+  options.max_errors = 0;
+  for (const char* pattern : kMisnestingPatterns) {
+    for (int num_reps = 1000; num_reps <= 8000; num_reps *= 2) {
+      std::string contents;
+      for (int i = 0; i < num_reps; ++i) {
+        contents += pattern;
+      }
+      long time = TimeParse(options, contents);
+      std::cout << "  " << num_reps << " x " << pattern << ": " << time
+                << " microseconds.\n";
+    }
+  }
+  GumboOptions capped_options = options;
+  capped_options.max_reconstructed_formatting_elements =
+      kMaxReconstructedFormattingElements;
+  for (int num_tags = 1000; num_tags <= 8000; num_tags *= 2) {
+    std::string contents = MakeReopenedRun(num_tags);
+    long baseline = TimeParse(options, contents);
+    std::cout << "  " << num_tags << " reopened <b> tags: " << baseline
+              << " microseconds.\n";
+    PrintComparison("with reconstruction capped", baseline,
+        TimeParse(capped_options, contents));
+  }
+}
+
+// Sentences of text in scripts that take two, three, and four bytes per
+// character.
+static const struct {
+  const char* script;
+  const char* sentence;
+} kMultibyteSentences[] = {
+    {"Cyrillic",
+        "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, "
+        "\xD0\xBC\xD0\xB8\xD1\x80. "},
+    {"CJK",
+        "\xE4\xBD\xA0\xE5\xA5\xBD\xEF\xBC\x8C\xE4\xB8\x96\xE7\x95\x8C"
+        "\xE3\x80\x82\xE4\xB8\xAD\xE6\x96\x87\xE7\xBD\x91\xE9\xA1\xB5"
+        "\xE3\x80\x82"},
+    {"emoji", "\xF0\x9F\x98\x80\xF0\x9F\x8E\x89\xF0\x9F\x91\x8D "},
+};
+
+// Times documents of paragraphs of non-ASCII text.
+static void TimeMultibyteText() {
+  std::cout << "multi-byte text:\n";
+  for (const auto& text : kMultibyteSentences) {
+    std::string paragraph = "<p>";
+    for (int i = 0; i < 20; ++i) {
+      paragraph += text.sentence;
+    }
+    paragraph += "</p>\n";
+    std::string contents;
+    for (int i = 0; i < 2000; ++i) {
+      contents += paragraph;
+    }
+    long time = TimeParse(kGumboDefaultOptions, contents);
+    std::cout << "  " << text.script << ": " << time << " microseconds.\n";
+  }
+}
+
 int main(int argc, char** argv) {
   if (argc != 1) {
     std::cout << "Usage: benchmarks\n";
@@ -59,16 +285,60 @@ int main(int argc, char** argv) {
       in.read(&contents[0], contents.size());
       in.close();
 
-      clock_t start_time = clock();
-      for (int i = 0; i < kNumReps; ++i) {
-        GumboOutput* output = gumbo_parse(contents.c_str());
-        gumbo_destroy_output(&kGumboDefaultOptions, output);
+      long baseline = TimeParse(kGumboDefaultOptions, contents);
+      std::cout << filename << ": " << baseline << " microseconds.\n";
+
+      GumboOptions arena_options = kGumboDefaultOptions;
+      arena_options.arena_chunk_size = kArenaChunkSize;
+      PrintComparison(
+          "with arena", baseline, TimeParse(arena_options, contents));
+
+      GumboOptions pool_options = kGumboDefaultOptions;
+      pool_options.pool_slab_size = kPoolSlabSize;
+      PrintComparison(
+          "with pools", baseline, TimeParse(pool_options, contents));
+      std::cout << "  allocations: "
+                << CountAllocations(kGumboDefaultOptions, contents)
+                << " by default, " << CountAllocations(pool_options, contents)
+                << " with pools.\n";
+
+      PrintComparison("with a reused context", baseline,
+          TimeContextParse(kGumboDefaultOptions, contents));
+
+      GumboOptions borrow_options = kGumboDefaultOptions;
+      borrow_options.borrow_text = true;
+      PrintComparison(
+          "with borrowed text", baseline, TimeParse(borrow_options, contents));
+
+      GumboOutput* output = gumbo_parse_with_options(
+          &kGumboDefaultOptions, contents.data(), contents.length());
+      long vector_time = TimeTraversal(output, &CountNodesThroughVectors);
+      long link_time = TimeTraversal(output, &CountNodesThroughLinks);
+      std::cout << "  traversal: " << vector_time
+                << " nanoseconds through children vectors, " << link_time
+                << " through sibling links";
+      if (link_time > 0) {
+        std::cout << " (" << (double) vector_time / link_time << "x)";
       }
+      std::cout << ".\n";
+
+      clock_t start_time = clock();
+      output = gumbo_output_compact(&kGumboDefaultOptions, output);
       clock_t end_time = clock();
-      std::cout << filename << ": "
-          << (1000000 * (end_time - start_time) / (kNumReps * CLOCKS_PER_SEC))
-          << " microseconds.\n";
+      long compact_time = TimeTraversal(output, &CountNodesThroughLinks);
+      std::cout << "  compacted in "
+                << 1000000 * (end_time - start_time) / CLOCKS_PER_SEC
+                << " microseconds, then traversed in " << compact_time
+                << " nanoseconds";
+      if (compact_time > 0) {
+        std::cout << " (" << (double) link_time / compact_time << "x)";
+      }
+      std::cout << ".\n";
+      gumbo_destroy_output(&kGumboDefaultOptions, output);
     }
   }
   closedir(dir);
+  TimeFormattingRuns();
+  TimeMisnesting();
+  TimeMultibyteText();
 }
@@ -0,0 +1,179 @@
+// Copyright 2013 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the throughput of the pull tokenizer against that of a full parse,
+// over the same documents as the parser benchmark.
+
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+
+#include "gumbo.h"
+
+static const int kNumReps = 10;
+
+// Returns the average time, in microseconds, to tokenize 'contents', switching
+// text states after the start tags that would make the parser do so.  The
+// number of tokens is stored in num_tokens.
+static long TimeTokenize(const std::string& contents, long* num_tokens) {
+  clock_t start_time = clock();
+  for (int i = 0; i < kNumReps; ++i) {
+    GumboTokenizer* tokenizer = gumbo_tokenizer_create(
+        &kGumboDefaultOptions, contents.data(), contents.length());
+    *num_tokens = 0;
+    const GumboToken* token;
+    while ((token = gumbo_tokenizer_next(tokenizer))) {
+      ++*num_tokens;
+      if (token->type != GUMBO_TOKEN_START_TAG) {
+        continue;
+      }
+      switch (token->v.start_tag.tag) {
+        case GUMBO_TAG_TITLE:
+        case GUMBO_TAG_TEXTAREA:
+          gumbo_tokenizer_set_mode(tokenizer, GUMBO_TOKENIZER_MODE_RCDATA);
+          break;
+        case GUMBO_TAG_STYLE:
+        case GUMBO_TAG_XMP:
+        case GUMBO_TAG_IFRAME:
+        case GUMBO_TAG_NOEMBED:
+        case GUMBO_TAG_NOFRAMES:
+          gumbo_tokenizer_set_mode(tokenizer, GUMBO_TOKENIZER_MODE_RAWTEXT);
+          break;
+        case GUMBO_TAG_SCRIPT:
+          gumbo_tokenizer_set_mode(
+              tokenizer, GUMBO_TOKENIZER_MODE_SCRIPT_DATA);
+          break;
+        case GUMBO_TAG_PLAINTEXT:
+          gumbo_tokenizer_set_mode(tokenizer, GUMBO_TOKENIZER_MODE_PLAINTEXT);
+          break;
+        default:
+          break;
+      }
+    }
+    gumbo_tokenizer_destroy(tokenizer);
+  }
+  clock_t end_time = clock();
+  return 1000000 * (end_time - start_time) / (kNumReps * CLOCKS_PER_SEC);
+}
+
+// Returns the average time, in microseconds, to parse & destroy 'contents'.
+static long TimeParse(
+    const std::string& contents, const GumboOptions& options) {
+  clock_t start_time = clock();
+  for (int i = 0; i < kNumReps; ++i) {
+    GumboOutput* output = gumbo_parse_with_options(
+        &options, contents.data(), contents.length());
+    gumbo_destroy_output(&options, output);
+  }
+  clock_t end_time = clock();
+  return 1000000 * (end_time - start_time) / (kNumReps * CLOCKS_PER_SEC);
+}
+
+// Prints a time along with the throughput it amounts to for 'length' bytes,
+// and the time per token if num_tokens isn't 0.
+static void PrintThroughput(
+    const char* variant, size_t length, long num_tokens, long time) {
+  std::cout << "  " << variant << ": " << time << " microseconds";
+  if (time > 0) {
+    std::cout << " (" << (double) length / time << " MB/s";
+    if (num_tokens > 0) {
+      std::cout << ", " << 1000.0 * time / num_tokens << " ns/token";
+    }
+    std::cout << ")";
+  }
+  std::cout << ".\n";
+}
+
+// Returns a single start tag with 'num_attributes' distinct attributes, each
+// followed by a duplicate of an earlier one.
+static std::string MakeTagWithAttributes(int num_attributes) {
+  std::string tag = "<div";
+  for (int i = 0; i < num_attributes; ++i) {
+    tag += " a" + std::to_string(i) + "=x a" + std::to_string(i / 2) + "=y";
+  }
+  return tag + ">";
+}
+
+// Times tags with growing numbers of attributes, which should take time
+// linear in their number.
+static void TimeAttributeScaling() {
+  std::cout << "attribute scaling:\n";
+  for (int num_attributes = 1000; num_attributes <= 16000;
+       num_attributes *= 2) {
+    std::string tag = MakeTagWithAttributes(num_attributes);
+    long num_tokens;
+    long time = TimeTokenize(tag, &num_tokens);
+    std::cout << "  " << num_attributes << " attributes: " << time
+              << " microseconds (" << 1000.0 * time / (2 * num_attributes)
+              << " ns/attribute).\n";
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 1) {
+    std::cout << "Usage: tokenizer_benchmark\n";
+    exit(EXIT_FAILURE);
+  }
+
+  DIR* dir;
+  struct dirent* file;
+
+  if ((dir = opendir("benchmarks")) == NULL) {
+    std::cout << "Couldn't find 'benchmarks' directory.  "
+              << "Run from root of distribution.\n";
+    exit(EXIT_FAILURE);
+  }
+
+  while ((file = readdir(dir)) != NULL) {
+    std::string filename(file->d_name);
+    if (filename.length() > 5 && filename.compare(filename.length() - 5, 5, ".html") == 0) {
+      std::string full_filename = "benchmarks/" + filename;
+      std::ifstream in(full_filename.c_str(), std::ios::in | std::ios::binary);
+      if (!in) {
+        std::cout << "File " << full_filename << " couldn't be read!\n";
+        exit(EXIT_FAILURE);
+      }
+
+      std::string contents;
+      in.seekg(0, std::ios::end);
+      contents.resize(in.tellg());
+      in.seekg(0, std::ios::beg);
+      in.read(&contents[0], contents.size());
+      in.close();
+
+      long num_tokens;
+      long tokenize_time = TimeTokenize(contents, &num_tokens);
+      std::cout << filename << ": " << contents.length() << " bytes, "
+                << num_tokens << " tokens.\n";
+      PrintThroughput(
+          "tokenize", contents.length(), num_tokens, tokenize_time);
+      PrintThroughput("parse", contents.length(), num_tokens,
+          TimeParse(contents, kGumboDefaultOptions));
+      GumboOptions offsets_only = kGumboDefaultOptions;
+      offsets_only.offsets_only = true;
+      PrintThroughput("parse_offsets_only", contents.length(), num_tokens,
+          TimeParse(contents, offsets_only));
+      GumboOptions no_errors = kGumboDefaultOptions;
+      no_errors.max_errors = 0;
+      PrintThroughput("parse_no_errors", contents.length(), num_tokens,
+          TimeParse(contents, no_errors));
+    }
+  }
+  closedir(dir);
+  TimeAttributeScaling();
+}
@@ -23,25 +23,27 @@
 
 #include "gumbo.h"
 
-static std::string cleantext(GumboNode* node) {
-  if (node->type == GUMBO_NODE_TEXT) {
-    return std::string(node->v.text.text);
-  } else if (node->type == GUMBO_NODE_ELEMENT &&
-             node->v.element.tag != GUMBO_TAG_SCRIPT &&
-             node->v.element.tag != GUMBO_TAG_STYLE) {
-    std::string contents = "";
-    GumboVector* children = &node->v.element.children;
-    for (unsigned int i = 0; i < children->length; ++i) {
-      const std::string text = cleantext((GumboNode*) children->data[i]);
-      if (i != 0 && !text.empty()) {
+static std::string cleantext(GumboNode* root) {
+  std::string contents;
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, root);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (event != GUMBO_WALK_ENTER) {
+      continue;
+    }
+    if (node->type == GUMBO_NODE_TEXT) {
+      if (!contents.empty()) {
         contents.append(" ");
       }
-      contents.append(text);
+      contents.append(node->v.text.text);
+    } else if (node->type == GUMBO_NODE_ELEMENT &&
+               (node->v.element.tag == GUMBO_TAG_SCRIPT ||
+                   node->v.element.tag == GUMBO_TAG_STYLE)) {
+      gumbo_walker_skip_children(&walker);
     }
-    return contents;
-  } else {
-    return "";
   }
+  return contents;
 }
 
 int main(int argc, char** argv) {
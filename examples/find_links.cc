@@ -24,19 +24,17 @@
 
 #include "gumbo.h"
 
-static void search_for_links(GumboNode* node) {
-  if (node->type != GUMBO_NODE_ELEMENT) {
-    return;
-  }
-  GumboAttribute* href;
-  if (node->v.element.tag == GUMBO_TAG_A &&
-      (href = gumbo_get_attribute(&node->v.element.attributes, "href"))) {
-    std::cout << href->value << std::endl;
-  }
-
-  GumboVector* children = &node->v.element.children;
-  for (unsigned int i = 0; i < children->length; ++i) {
-    search_for_links(static_cast<GumboNode*>(children->data[i]));
+static void search_for_links(GumboNode* root) {
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, root);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    GumboAttribute* href;
+    if (event == GUMBO_WALK_ENTER && node->type == GUMBO_NODE_ELEMENT &&
+        node->v.element.tag == GUMBO_TAG_A &&
+        (href = gumbo_get_attribute(&node->v.element.attributes, "href"))) {
+      std::cout << href->value << std::endl;
+    }
   }
 }
 
@@ -19,6 +19,8 @@
       'type': 'static_library',
       'cflags': ['-std=c99', '-Wall'],
       'sources': [
+        'src/arena.c',
+        'src/arena.h',
         'src/attribute.c',
         'src/attribute.h',
         'src/char_ref.c',
@@ -29,12 +31,13 @@
         'src/insertion_mode.h',
         'src/parser.c',
         'src/parser.h',
+        'src/pool.c',
+        'src/pool.h',
         'src/string_buffer.c',
         'src/string_buffer.h',
         'src/string_piece.c',
         'src/string_piece.h',
         'src/tag.c',
-        'src/token_type.h',
         'src/tokenizer.c',
         'src/tokenizer.h',
         'src/tokenizer_states.h',
@@ -62,6 +65,7 @@
       'sources': [
         'tests/attribute.cc',
         'tests/char_ref.cc',
+        'tests/error.cc',
         'tests/parser.cc',
         'tests/string_buffer.cc',
         'tests/string_piece.cc',
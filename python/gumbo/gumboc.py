@@ -288,11 +288,18 @@ class Element(ctypes.Structure):
 
 class Text(ctypes.Structure):
   _fields_ = [
-      ('text', ctypes.c_char_p),
+      # Not NUL-terminated when borrowed from the input (see borrow_text), so
+      # it's read through the text property, with its length.
+      ('_text', ctypes.c_void_p),
       ('original_text', StringPiece),
-      ('start_pos', SourcePosition)
+      ('start_pos', SourcePosition),
+      ('length', ctypes.c_size_t),
       ]
 
+  @property
+  def text(self):
+    return ctypes.string_at(self._text, self.length)
+
   def __repr__(self):
     return 'Text(%r)' % self.text
 
@@ -361,15 +368,32 @@ class Options(ctypes.Structure):
       ('max_errors', ctypes.c_int),
       ('fragment_context', Tag),
       ('fragment_namespace', Namespace),
+      ('arena_chunk_size', ctypes.c_size_t),
+      ('borrow_text', ctypes.c_bool),
+      # Left NULL, since the Python API has no way to receive events.
+      ('event_handler', ctypes.c_void_p),
+      ('trace', ctypes.c_void_p),
+      ('offsets_only', ctypes.c_bool),
+      ('error_handler', ctypes.c_void_p),
+      ('pool_slab_size', ctypes.c_size_t),
+      ('reallocator', ctypes.c_void_p),
+      ('sized_deallocator', ctypes.c_void_p),
+      ('max_reconstructed_formatting_elements', ctypes.c_int),
       ]
 
 
 class Output(ctypes.Structure):
+  # Only a prefix of the C struct, up to the fields read here.  That's safe
+  # since an Output is always allocated by the library and only read through
+  # a pointer; error_counts, pool, and anything after them are left out.
   _fields_ = [
       ('document', _Ptr(Node)),
       ('root', _Ptr(Node)),
       # TODO(jdtang): Error type.
       ('errors', Vector),
+      ('arena', ctypes.c_void_p),
+      ('input', ctypes.c_void_p),
+      ('input_length', ctypes.c_size_t),
       ]
 
 @contextlib.contextmanager
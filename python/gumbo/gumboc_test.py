@@ -118,6 +118,39 @@ class CtypesTest(unittest.TestCase):
       self.assertEquals(gumboc.Tag.DIV, div.tag)
       self.assertEquals(gumboc.Namespace.HTML, div.tag_namespace)
 
+  def testDefaultOptions(self):
+    # Every option is copied from kGumboDefaultOptions, which only works if
+    # Options matches the layout of GumboOptions.  The <b> and <i> are
+    # reconstructed around "two".
+    with gumboc.parse('<p><b><i>one</p>two') as output:
+      body = output.contents.root.contents.children[1]
+      self.assertEquals(2, len(body.children))
+      b = body.children[1]
+      self.assertEquals(gumboc.Tag.B, b.tag)
+      i = b.children[0]
+      self.assertEquals(gumboc.Tag.I, i.tag)
+      self.assertEquals('two', i.children[0].text)
+
+  def testBorrowedText(self):
+    with gumboc.parse('<p>Hello</p><div>World</div>',
+                      borrow_text=True) as output:
+      body = output.contents.root.contents.children[1]
+      self.assertEquals('Hello', body.children[0].children[0].text)
+      self.assertEquals('World', body.children[1].children[0].text)
+
+  def testOffsetsOnly(self):
+    with gumboc.parse('<p>\n<b>Text', offsets_only=True) as output:
+      p = output.contents.root.contents.children[1].children[0]
+      self.assertEquals(0, p.start_pos.offset)
+      b = p.children[1]
+      self.assertEquals(4, b.start_pos.offset)
+      self.assertEquals(0, b.start_pos.line)
+      self.assertEquals(0, b.start_pos.column)
+      text = b.children[0]
+      self.assertEquals(7, text.start_pos.offset)
+      self.assertEquals(0, text.start_pos.line)
+      self.assertEquals(0, text.start_pos.column)
+
 
 
 
@@ -0,0 +1,115 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+// Every block handed out is rounded up to this, which is enough for the
+// pointers, size_ts, and ints that make up the parse tree.
+#define ARENA_ALIGNMENT 8
+
+static size_t align_size(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+static const size_t kChunkHeaderSize =
+    (sizeof(GumboArenaChunk) + ARENA_ALIGNMENT - 1) &
+    ~(size_t) (ARENA_ALIGNMENT - 1);
+
+static GumboArenaChunk* allocate_chunk(
+    const GumboOptions* options, size_t usable_size) {
+  GumboArenaChunk* chunk =
+      options->allocator(options->userdata, kChunkHeaderSize + usable_size);
+  chunk->next = NULL;
+  return chunk;
+}
+
+static char* chunk_data(GumboArenaChunk* chunk) {
+  return (char*) chunk + kChunkHeaderSize;
+}
+
+// Creates an arena whose first chunk has first_chunk_size usable bytes,
+// including the arena itself, and whose later chunks have chunk_size.
+static GumboArena* create_arena(const GumboOptions* options,
+    size_t first_chunk_size, size_t chunk_size) {
+  size_t arena_size = align_size(sizeof(GumboArena));
+  if (first_chunk_size < arena_size) {
+    first_chunk_size = arena_size;
+  }
+  GumboArenaChunk* chunk = allocate_chunk(options, first_chunk_size);
+  GumboArena* arena = (GumboArena*) chunk_data(chunk);
+  arena->head = chunk;
+  arena->allocation_ptr = chunk_data(chunk) + arena_size;
+  arena->allocation_end = chunk_data(chunk) + first_chunk_size;
+  arena->chunk_size = chunk_size;
+  return arena;
+}
+
+GumboArena* gumbo_arena_create(const GumboOptions* options) {
+  size_t chunk_size = align_size(options->arena_chunk_size);
+  size_t arena_size = align_size(sizeof(GumboArena));
+  if (chunk_size < arena_size) {
+    chunk_size = arena_size;
+  }
+  return create_arena(options, chunk_size, chunk_size);
+}
+
+GumboArena* gumbo_arena_create_for_size(
+    const GumboOptions* options, size_t num_bytes) {
+  size_t first_chunk_size = align_size(sizeof(GumboArena)) + num_bytes;
+  return create_arena(options, first_chunk_size, first_chunk_size);
+}
+
+size_t gumbo_arena_block_size(size_t num_bytes) {
+  return align_size(num_bytes);
+}
+
+void* gumbo_arena_malloc(
+    const GumboOptions* options, GumboArena* arena, size_t num_bytes) {
+  num_bytes = align_size(num_bytes);
+  if ((size_t) (arena->allocation_end - arena->allocation_ptr) >= num_bytes) {
+    void* result = arena->allocation_ptr;
+    arena->allocation_ptr += num_bytes;
+    return result;
+  }
+
+  if (num_bytes > arena->chunk_size / 4) {
+    // Big blocks (usually a long text node or a large children vector) get a
+    // chunk of their own, linked in behind the current head so that the space
+    // remaining there isn't abandoned.
+    GumboArenaChunk* chunk = allocate_chunk(options, num_bytes);
+    chunk->next = arena->head->next;
+    arena->head->next = chunk;
+    return chunk_data(chunk);
+  }
+
+  GumboArenaChunk* chunk = allocate_chunk(options, arena->chunk_size);
+  chunk->next = arena->head;
+  arena->head = chunk;
+  arena->allocation_ptr = chunk_data(chunk) + num_bytes;
+  arena->allocation_end = chunk_data(chunk) + arena->chunk_size;
+  return chunk_data(chunk);
+}
+
+void gumbo_arena_destroy(const GumboOptions* options, GumboArena* arena) {
+  // The arena itself lives in the first chunk it allocated, which isn't
+  // necessarily last in the list, since dedicated chunks are linked in behind
+  // it.  So the loop reads each chunk's next pointer before freeing it and
+  // never touches the arena again once it starts.
+  GumboArenaChunk* chunk = arena->head;
+  while (chunk) {
+    GumboArenaChunk* next = chunk->next;
+    options->deallocator(options->userdata, chunk);
+    chunk = next;
+  }
+}
@@ -0,0 +1,73 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A simple bump-pointer arena, used for GumboOptions.arena_chunk_size.  Memory
+// is handed out sequentially from large chunks obtained from the user's
+// allocator, individual blocks are never freed, and the whole arena is released
+// at once when the output is destroyed.
+
+#ifndef GUMBO_ARENA_H_
+#define GUMBO_ARENA_H_
+
+#include <stddef.h>
+
+#include "gumbo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A chunk of arena memory.  The usable space follows this header directly.
+typedef struct GumboInternalArenaChunk {
+  struct GumboInternalArenaChunk* next;
+} GumboArenaChunk;
+
+typedef struct GumboInternalArena {
+  // Most recently allocated chunk; earlier chunks are chained through 'next'.
+  GumboArenaChunk* head;
+
+  // The bump pointer and the end of the usable space within 'head'.
+  char* allocation_ptr;
+  char* allocation_end;
+
+  // Usable bytes per chunk, as specified in the options.
+  size_t chunk_size;
+} GumboArena;
+
+// Creates a new arena, using the allocator and chunk size in the options.  The
+// arena bookkeeping itself lives in the first chunk.
+GumboArena* gumbo_arena_create(const GumboOptions* options);
+
+// Creates an arena whose first chunk holds exactly num_bytes worth of blocks,
+// as counted by gumbo_arena_block_size, for when the total is known up front.
+GumboArena* gumbo_arena_create_for_size(
+    const GumboOptions* options, size_t num_bytes);
+
+// Returns how much of the arena an allocation of num_bytes takes up.
+size_t gumbo_arena_block_size(size_t num_bytes);
+
+// Allocates num_bytes from the arena, suitably aligned for any of the parse
+// tree structures.  A request that doesn't fit in the current chunk and is
+// larger than a quarter of a chunk gets a dedicated chunk of its own.
+void* gumbo_arena_malloc(
+    const GumboOptions* options, GumboArena* arena, size_t num_bytes);
+
+// Releases every chunk of the arena, including the arena itself.
+void gumbo_arena_destroy(const GumboOptions* options, GumboArena* arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // GUMBO_ARENA_H_
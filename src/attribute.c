@@ -40,5 +40,5 @@ void gumbo_destroy_attribute(
     struct GumboInternalParser* parser, GumboAttribute* attribute) {
   gumbo_parser_deallocate(parser, (void*) attribute->name);
   gumbo_parser_deallocate(parser, (void*) attribute->value);
-  gumbo_parser_deallocate(parser, (void*) attribute);
+  gumbo_parser_deallocate_object(parser, GUMBO_POOLED_ATTRIBUTE, attribute);
 }
@@ -77,34 +77,35 @@ static int parse_digit(int c, bool allow_hex) {
 
 static void add_no_digit_error(
     struct GumboInternalParser* parser, Utf8Iterator* input) {
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error =
+      gumbo_add_error(parser, GUMBO_ERR_NUMERIC_CHAR_REF_NO_DIGITS);
   if (!error) {
     return;
   }
   utf8iterator_fill_error_at_mark(input, error);
-  error->type = GUMBO_ERR_NUMERIC_CHAR_REF_NO_DIGITS;
+  gumbo_finish_error(parser, error);
 }
 
 static void add_codepoint_error(struct GumboInternalParser* parser,
     Utf8Iterator* input, GumboErrorType type, int codepoint) {
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error = gumbo_add_error(parser, type);
   if (!error) {
     return;
   }
   utf8iterator_fill_error_at_mark(input, error);
-  error->type = type;
   error->v.codepoint = codepoint;
+  gumbo_finish_error(parser, error);
 }
 
 static void add_named_reference_error(struct GumboInternalParser* parser,
     Utf8Iterator* input, GumboErrorType type, GumboStringPiece text) {
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error = gumbo_add_error(parser, type);
   if (!error) {
     return;
   }
   utf8iterator_fill_error_at_mark(input, error);
-  error->type = type;
   error->v.text = text;
+  gumbo_finish_error(parser, error);
 }
 
 static int maybe_replace_codepoint(int codepoint) {
@@ -179,19 +180,19 @@ static bool consume_numeric_ref(
 
 static bool maybe_add_invalid_named_reference(
     struct GumboInternalParser* parser, Utf8Iterator* input) {
-  // The iterator will always be reset in this code path, so we don't need to
-  // worry about consuming characters.
+  // This only looks ahead, so it scans the bytes rather than reading characters
+  // through the iterator, which would report their errors a second time.
   const char* start = utf8iterator_get_char_pointer(input);
-  int c = utf8iterator_current(input);
-  while ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-         (c >= '0' && c <= '9')) {
-    utf8iterator_next(input);
-    c = utf8iterator_current(input);
+  const char* end = utf8iterator_get_end_pointer(input);
+  const char* c = start;
+  while (c < end && ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+                     (*c >= '0' && *c <= '9'))) {
+    ++c;
   }
-  if (c == ';') {
+  if (c < end && *c == ';') {
     GumboStringPiece bad_ref;
     bad_ref.data = start;
-    bad_ref.length = utf8iterator_get_char_pointer(input) - start;
+    bad_ref.length = c - start;
     add_named_reference_error(
         parser, input, GUMBO_ERR_NAMED_CHAR_REF_INVALID, bad_ref);
     return false;
@@ -24,6 +24,7 @@
 #include "gumbo.h"
 #include "parser.h"
 #include "string_buffer.h"
+#include "utf8.h"
 #include "util.h"
 #include "vector.h"
 
@@ -107,6 +108,7 @@ static void handle_parser_error(GumboParser* parser,
     case GUMBO_TOKEN_CDATA:
     case GUMBO_TOKEN_WHITESPACE:
     case GUMBO_TOKEN_CHARACTER:
+    case GUMBO_TOKEN_CHARACTER_RUN:
       print_message(parser, output, "Character tokens aren't legal here");
       return;
     case GUMBO_TOKEN_NULL:
@@ -126,6 +128,11 @@ static void handle_parser_error(GumboParser* parser,
       print_tag_stack(parser, error, output);
       // TODO(jdtang): Give more specific messaging.
       return;
+    case GUMBO_TOKEN_NEED_INPUT:
+      // Should never happen; the parser waits for more input instead of
+      // handling this token.
+      assert(0);
+      return;
   }
 }
 
@@ -154,20 +161,67 @@ static const char* find_next_newline(
   return c;
 }
 
-GumboError* gumbo_add_error(GumboParser* parser) {
+// Returns the number of errors built so far: the ones in the errors vector,
+// or, with an error handler, the ones reported to it.
+static unsigned int num_errors_built(const GumboParser* parser) {
+  const GumboOutput* output = parser->_output;
+  if (!parser->_options->error_handler) {
+    return output->errors.length;
+  }
+  // All but the latest error counted were reported, up to max_errors.
+  unsigned int num_errors = 0;
+  for (int i = 0; i < GUMBO_NUM_ERROR_TYPES; ++i) {
+    num_errors += output->error_counts[i];
+  }
+  return num_errors - 1;
+}
+
+GumboError* gumbo_add_error(GumboParser* parser, GumboErrorType type) {
+  GumboOutput* output = parser->_output;
+  ++output->error_counts[type];
   int max_errors = parser->_options->max_errors;
-  if (max_errors >= 0 && parser->_output->errors.length >= (unsigned int) max_errors) {
+  if (max_errors >= 0 &&
+      num_errors_built(parser) >= (unsigned int) max_errors) {
     return NULL;
   }
-  GumboError* error = gumbo_parser_allocate(parser, sizeof(GumboError));
-  gumbo_vector_add(parser, error, &parser->_output->errors);
+  if (parser->_options->error_handler) {
+    // Only lives until gumbo_finish_error, so it never comes from an arena.
+    GumboError* error =
+        parser->_pool
+            ? gumbo_parser_allocate_object(parser, GUMBO_POOLED_ERROR)
+            : gumbo_scratch_allocate(parser, sizeof(GumboError));
+    error->type = type;
+    return error;
+  }
+  GumboError* error = gumbo_parser_allocate_object(parser, GUMBO_POOLED_ERROR);
+  error->type = type;
+  gumbo_vector_add(parser, error, &output->errors);
   return error;
 }
 
+void gumbo_finish_error(GumboParser* parser, GumboError* error) {
+  const GumboOptions* options = parser->_options;
+  if (!options->error_handler) {
+    // It's already in the errors vector.
+    return;
+  }
+  options->error_handler(options->userdata, error);
+  if (parser->_pool) {
+    gumbo_parser_deallocate_object(parser, GUMBO_POOLED_ERROR, error);
+  } else {
+    gumbo_scratch_deallocate(parser, error);
+  }
+}
+
 void gumbo_error_to_string(
     GumboParser* parser, const GumboError* error, GumboStringBuffer* output) {
-  print_message(
-      parser, output, "@%d:%d: ", error->position.line, error->position.column);
+  if (error->position.line) {
+    print_message(parser, output, "@%d:%d: ", error->position.line,
+        error->position.column);
+  } else {
+    // Parsed with offsets_only.
+    print_message(parser, output, "@+%u: ", error->position.offset);
+  }
   switch (error->type) {
     case GUMBO_ERR_UTF8_INVALID:
       print_message(
@@ -239,9 +293,14 @@ void gumbo_caret_diagnostic_to_string(GumboParser* parser,
   gumbo_string_buffer_append_codepoint(parser, '\n', output);
   gumbo_string_buffer_append_string(parser, &original_line, output);
   gumbo_string_buffer_append_codepoint(parser, '\n', output);
-  gumbo_string_buffer_reserve(
-      parser, output->length + error->position.column, output);
-  int num_spaces = error->position.column - 1;
+  unsigned int column = error->position.column;
+  if (!column) {
+    // Parsed with offsets_only, so the column has to be worked out here.
+    column = utf8_column(
+        line_start, error->original_text, parser->_options->tab_stop);
+  }
+  gumbo_string_buffer_reserve(parser, output->length + column, output);
+  int num_spaces = column - 1;
   memset(output->data + output->length, ' ', num_spaces);
   output->length += num_spaces;
   gumbo_string_buffer_append_codepoint(parser, '^', output);
@@ -257,6 +316,33 @@ void gumbo_print_caret_diagnostic(
   gumbo_string_buffer_destroy(parser, &text);
 }
 
+GumboErrorType gumbo_error_type(const GumboError* error) {
+  return error->type;
+}
+
+GumboSourcePosition gumbo_error_position(const GumboError* error) {
+  return error->position;
+}
+
+const char* gumbo_error_original_text(const GumboError* error) {
+  return error->original_text;
+}
+
+const GumboVector* gumbo_error_tag_stack(const GumboError* error) {
+  if (error->type == GUMBO_ERR_PARSER ||
+      error->type == GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG) {
+    return &error->v.parser.tag_stack;
+  }
+  return NULL;
+}
+
+const char* gumbo_error_duplicate_attr_name(const GumboError* error) {
+  if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
+    return error->v.duplicate_attr.name;
+  }
+  return NULL;
+}
+
 void gumbo_error_destroy(GumboParser* parser, GumboError* error) {
   if (error->type == GUMBO_ERR_PARSER ||
       error->type == GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG) {
@@ -264,11 +350,18 @@ void gumbo_error_destroy(GumboParser* parser, GumboError* error) {
   } else if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
     gumbo_parser_deallocate(parser, (void*) error->v.duplicate_attr.name);
   }
-  gumbo_parser_deallocate(parser, error);
+  gumbo_parser_deallocate_object(parser, GUMBO_POOLED_ERROR, error);
 }
 
 void gumbo_init_errors(GumboParser* parser) {
-  gumbo_vector_init(parser, 5, &parser->_output->errors);
+  GumboOutput* output = parser->_output;
+  memset(output->error_counts, 0, sizeof(output->error_counts));
+  if (parser->_options->max_errors == 0) {
+    // There'll never be any.
+    gumbo_vector_init(parser, 0, &output->errors);
+  } else {
+    gumbo_vector_init(parser, 5, &output->errors);
+  }
 }
 
 void gumbo_destroy_errors(GumboParser* parser) {
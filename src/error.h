@@ -26,7 +26,6 @@
 #include "gumbo.h"
 #include "insertion_mode.h"
 #include "string_buffer.h"
-#include "token_type.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,51 +33,6 @@ extern "C" {
 
 struct GumboInternalParser;
 
-typedef enum {
-  GUMBO_ERR_UTF8_INVALID,
-  GUMBO_ERR_UTF8_TRUNCATED,
-  GUMBO_ERR_UTF8_NULL,
-  GUMBO_ERR_NUMERIC_CHAR_REF_NO_DIGITS,
-  GUMBO_ERR_NUMERIC_CHAR_REF_WITHOUT_SEMICOLON,
-  GUMBO_ERR_NUMERIC_CHAR_REF_INVALID,
-  GUMBO_ERR_NAMED_CHAR_REF_WITHOUT_SEMICOLON,
-  GUMBO_ERR_NAMED_CHAR_REF_INVALID,
-  GUMBO_ERR_TAG_STARTS_WITH_QUESTION,
-  GUMBO_ERR_TAG_EOF,
-  GUMBO_ERR_TAG_INVALID,
-  GUMBO_ERR_CLOSE_TAG_EMPTY,
-  GUMBO_ERR_CLOSE_TAG_EOF,
-  GUMBO_ERR_CLOSE_TAG_INVALID,
-  GUMBO_ERR_SCRIPT_EOF,
-  GUMBO_ERR_ATTR_NAME_EOF,
-  GUMBO_ERR_ATTR_NAME_INVALID,
-  GUMBO_ERR_ATTR_DOUBLE_QUOTE_EOF,
-  GUMBO_ERR_ATTR_SINGLE_QUOTE_EOF,
-  GUMBO_ERR_ATTR_UNQUOTED_EOF,
-  GUMBO_ERR_ATTR_UNQUOTED_RIGHT_BRACKET,
-  GUMBO_ERR_ATTR_UNQUOTED_EQUALS,
-  GUMBO_ERR_ATTR_AFTER_EOF,
-  GUMBO_ERR_ATTR_AFTER_INVALID,
-  GUMBO_ERR_DUPLICATE_ATTR,
-  GUMBO_ERR_SOLIDUS_EOF,
-  GUMBO_ERR_SOLIDUS_INVALID,
-  GUMBO_ERR_DASHES_OR_DOCTYPE,
-  GUMBO_ERR_COMMENT_EOF,
-  GUMBO_ERR_COMMENT_INVALID,
-  GUMBO_ERR_COMMENT_BANG_AFTER_DOUBLE_DASH,
-  GUMBO_ERR_COMMENT_DASH_AFTER_DOUBLE_DASH,
-  GUMBO_ERR_COMMENT_SPACE_AFTER_DOUBLE_DASH,
-  GUMBO_ERR_COMMENT_END_BANG_EOF,
-  GUMBO_ERR_DOCTYPE_EOF,
-  GUMBO_ERR_DOCTYPE_INVALID,
-  GUMBO_ERR_DOCTYPE_SPACE,
-  GUMBO_ERR_DOCTYPE_RIGHT_BRACKET,
-  GUMBO_ERR_DOCTYPE_SPACE_OR_RIGHT_BRACKET,
-  GUMBO_ERR_DOCTYPE_END,
-  GUMBO_ERR_PARSER,
-  GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG,
-} GumboErrorType;
-
 // Additional data for duplicated attributes.
 typedef struct GumboInternalDuplicateAttrError {
   // The name of the attribute.  Owned by this struct.
@@ -144,7 +98,7 @@ typedef struct GumboInternalParserError {
 // The overall error struct representing an error in decoding/tokenizing/parsing
 // the HTML.  This contains an enumerated type flag, a source position, and then
 // a union of fields containing data specific to the error.
-typedef struct GumboInternalError {
+struct GumboInternalError {
   // The type of error.
   GumboErrorType type;
 
@@ -180,12 +134,24 @@ typedef struct GumboInternalError {
     // GUMBO_ERR_UNACKNOWLEDGE_SELF_CLOSING_TAG.
     struct GumboInternalParserError parser;
   } v;
-} GumboError;
+};
+
+// Counts an error of the given type in GumboOutput.error_counts, then adds it
+// to the parser's error list and returns a pointer to it so that clients can
+// fill out the rest of its fields.  Returns NULL, having only counted it, if
+// we're already at the max_errors field specified in GumboOptions; error sites
+// return straight away then, without building anything.
+//
+// With GumboOptions.error_handler, the error is instead a transient one that
+// isn't added to the list, and whose fields should borrow whatever they point
+// to rather than own it.
+GumboError* gumbo_add_error(
+    struct GumboInternalParser* parser, GumboErrorType type);
 
-// Adds a new error to the parser's error list, and returns a pointer to it so
-// that clients can fill out the rest of its fields.  May return NULL if we're
-// already over the max_errors field specified in GumboOptions.
-GumboError* gumbo_add_error(struct GumboInternalParser* parser);
+// Called by every error site once it has filled out an error from
+// gumbo_add_error.  Hands a transient error to GumboOptions.error_handler and
+// frees it; does nothing to an error in the error list.
+void gumbo_finish_error(struct GumboInternalParser* parser, GumboError* error);
 
 // Initializes the errors vector in the parser.
 void gumbo_init_errors(struct GumboInternalParser* errors);
@@ -200,7 +166,7 @@ void gumbo_error_destroy(struct GumboInternalParser* parser, GumboError* error);
 // freshly-allocated buffer containing the error message text.  The caller is
 // responsible for deleting the buffer.  (Note that the buffer is allocated with
 // the allocator specified in the GumboParser config and hence should be freed
-// by gumbo_parser_deallocate().)
+// by gumbo_string_buffer_destroy().)
 void gumbo_error_to_string(struct GumboInternalParser* parser,
     const GumboError* error, GumboStringBuffer* output);
 
@@ -208,7 +174,7 @@ void gumbo_error_to_string(struct GumboInternalParser* parser,
 // with a freshly-allocated buffer containing the error message text.  The
 // caller is responsible for deleting the buffer.  (Note that the buffer is
 // allocated with the allocator specified in the GumboParser config and hence
-// should be freed by gumbo_parser_deallocate().)
+// should be freed by gumbo_string_buffer_destroy().)
 void gumbo_caret_diagnostic_to_string(struct GumboInternalParser* parser,
     const GumboError* error, const char* source_text,
     GumboStringBuffer* output);
@@ -63,6 +63,8 @@ extern "C" {
  * text (which in most languages that bind to C implies pointer arithmetic on a
  * buffer of bytes), while the column field is often used to reference a
  * particular column on a printable display, which nowadays is usually UTF-8.
+ * A parse with GumboOptions.offsets_only leaves line and column 0; see
+ * GumboLineIndex.  Offsets are unsigned ints, so inputs are limited to 4 GiB.
  */
 typedef struct {
   unsigned int line;
@@ -463,8 +465,22 @@ typedef struct {
    * original_text, before entities are decoded.
    * */
   GumboSourcePosition start_pos;
+
+  /**
+   * The length of text in bytes, not counting the terminating NUL.  Text that
+   * is borrowed from the source buffer (see GumboOptions.borrow_text) has no
+   * terminating NUL, and is recognizable by text == original_text.data.
+   */
+  size_t length;
 } GumboText;
 
+/**
+ * The number of children and of attributes that a GumboElement has room for
+ * without allocating; most elements have no more.
+ */
+#define GUMBO_INLINE_CHILDREN 2
+#define GUMBO_INLINE_ATTRIBUTES 3
+
 /**
  * The struct used to represent all HTML elements.  This contains information
  * about the tag, attributes, and child nodes.
@@ -508,6 +524,15 @@ typedef struct {
    * order that they were parsed.  Pointers are owned.
    */
   GumboVector /* GumboAttribute* */ attributes;
+
+  /**
+   * Storage for the first few children and attributes, which the data of the
+   * vectors above points into until they outgrow it, so that most elements
+   * need no separate allocations for them.  Internal to the library; read the
+   * elements through the vectors.
+   */
+  void* _inline_children[GUMBO_INLINE_CHILDREN];
+  void* _inline_attributes[GUMBO_INLINE_ATTRIBUTES];
 } GumboElement;
 
 /**
@@ -537,6 +562,21 @@ struct GumboInternalNode {
     GumboElement element;    // For GUMBO_NODE_ELEMENT.
     GumboText text;          // For everything else.
   } v;
+
+  /**
+   * The first and last of this node's children, the same nodes as at either
+   * end of its children vector, or NULL if it has none.  Not owned.
+   */
+  GumboNode* first_child;
+  GumboNode* last_child;
+
+  /**
+   * The nodes before and after this one in its parent's children, or NULL at
+   * either end.  Following these visits the children without going through
+   * the children vector.  Not owned.
+   */
+  GumboNode* prev_sibling;
+  GumboNode* next_sibling;
 };
 
 /**
@@ -554,6 +594,183 @@ typedef void* (*GumboAllocatorFunction)(void* userdata, size_t size);
  */
 typedef void (*GumboDeallocatorFunction)(void* userdata, void* ptr);
 
+/**
+ * The type for a reallocator function; see GumboOptions.reallocator.  Takes
+ * the 'userdata' member of the options as its first argument, then a block
+ * from the allocator, the size it was allocated (or last reallocated) with,
+ * and the size it's needed at.  Semantics should be the same as realloc, i.e.
+ * return a block of new_size bytes that starts with the contents of the old
+ * one, which is no longer valid unless it's the block returned.
+ */
+typedef void* (*GumboReallocatorFunction)(
+    void* userdata, void* ptr, size_t old_size, size_t new_size);
+
+/**
+ * The type for a sized deallocator function; see
+ * GumboOptions.sized_deallocator.  Takes the 'userdata' member of the options
+ * as its first argument, then a block from the allocator and the size it was
+ * allocated (or last reallocated) with.
+ */
+typedef void (*GumboSizedDeallocatorFunction)(
+    void* userdata, void* ptr, size_t size);
+
+/**
+ * The type for a trace function; see GumboOptions.trace.  Takes the 'userdata'
+ * member of the options as its first argument, and one line of the trace.
+ */
+typedef void (*GumboTraceFunction)(void* userdata, const char* message);
+
+/** The types of parse error. */
+typedef enum {
+  GUMBO_ERR_UTF8_INVALID,
+  GUMBO_ERR_UTF8_TRUNCATED,
+  GUMBO_ERR_UTF8_NULL,
+  GUMBO_ERR_NUMERIC_CHAR_REF_NO_DIGITS,
+  GUMBO_ERR_NUMERIC_CHAR_REF_WITHOUT_SEMICOLON,
+  GUMBO_ERR_NUMERIC_CHAR_REF_INVALID,
+  GUMBO_ERR_NAMED_CHAR_REF_WITHOUT_SEMICOLON,
+  GUMBO_ERR_NAMED_CHAR_REF_INVALID,
+  GUMBO_ERR_TAG_STARTS_WITH_QUESTION,
+  GUMBO_ERR_TAG_EOF,
+  GUMBO_ERR_TAG_INVALID,
+  GUMBO_ERR_CLOSE_TAG_EMPTY,
+  GUMBO_ERR_CLOSE_TAG_EOF,
+  GUMBO_ERR_CLOSE_TAG_INVALID,
+  GUMBO_ERR_SCRIPT_EOF,
+  GUMBO_ERR_ATTR_NAME_EOF,
+  GUMBO_ERR_ATTR_NAME_INVALID,
+  GUMBO_ERR_ATTR_DOUBLE_QUOTE_EOF,
+  GUMBO_ERR_ATTR_SINGLE_QUOTE_EOF,
+  GUMBO_ERR_ATTR_UNQUOTED_EOF,
+  GUMBO_ERR_ATTR_UNQUOTED_RIGHT_BRACKET,
+  GUMBO_ERR_ATTR_UNQUOTED_EQUALS,
+  GUMBO_ERR_ATTR_AFTER_EOF,
+  GUMBO_ERR_ATTR_AFTER_INVALID,
+  GUMBO_ERR_DUPLICATE_ATTR,
+  GUMBO_ERR_SOLIDUS_EOF,
+  GUMBO_ERR_SOLIDUS_INVALID,
+  GUMBO_ERR_DASHES_OR_DOCTYPE,
+  GUMBO_ERR_COMMENT_EOF,
+  GUMBO_ERR_COMMENT_INVALID,
+  GUMBO_ERR_COMMENT_BANG_AFTER_DOUBLE_DASH,
+  GUMBO_ERR_COMMENT_DASH_AFTER_DOUBLE_DASH,
+  GUMBO_ERR_COMMENT_SPACE_AFTER_DOUBLE_DASH,
+  GUMBO_ERR_COMMENT_END_BANG_EOF,
+  GUMBO_ERR_DOCTYPE_EOF,
+  GUMBO_ERR_DOCTYPE_INVALID,
+  GUMBO_ERR_DOCTYPE_SPACE,
+  GUMBO_ERR_DOCTYPE_RIGHT_BRACKET,
+  GUMBO_ERR_DOCTYPE_SPACE_OR_RIGHT_BRACKET,
+  GUMBO_ERR_DOCTYPE_END,
+  GUMBO_ERR_PARSER,
+  GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG,
+} GumboErrorType;
+
+/**
+ * The number of types of parse error there are, i.e. of GumboErrorType values.
+ */
+#define GUMBO_NUM_ERROR_TYPES (GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG + 1)
+
+/**
+ * A parse error.  Opaque; read it with the gumbo_error_* functions below.
+ */
+typedef struct GumboInternalError GumboError;
+
+/** Returns the type of a parse error. */
+GumboErrorType gumbo_error_type(const GumboError* error);
+
+/**
+ * Returns the position in the input where a parse error occurred.  Only its
+ * offset is filled in for a parse with GumboOptions.offsets_only.
+ */
+GumboSourcePosition gumbo_error_position(const GumboError* error);
+
+/** Returns a pointer to the text of the input where a parse error occurred. */
+const char* gumbo_error_original_text(const GumboError* error);
+
+/**
+ * Returns the stack of open elements at the point of a tree construction error
+ * (GUMBO_ERR_PARSER or GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG), as a vector
+ * of GumboTags stored by value: cast each void* to a GumboTag.  Returns NULL
+ * for other errors.
+ */
+const GumboVector* gumbo_error_tag_stack(const GumboError* error);
+
+/**
+ * Returns the name of the attribute of a GUMBO_ERR_DUPLICATE_ATTR error, or
+ * NULL for other errors.
+ */
+const char* gumbo_error_duplicate_attr_name(const GumboError* error);
+
+/**
+ * The type for an error handler; see GumboOptions.error_handler.  Takes the
+ * 'userdata' member of the options as its first argument, and a parse error.
+ * The error, and everything it points to (including the tag stack of a tree
+ * construction error), is only valid during the call.
+ */
+typedef void (*GumboErrorHandlerFunction)(
+    void* userdata, const GumboError* error);
+
+/**
+ * Callbacks for a parse that reports the tree to the caller as it's built
+ * instead of returning it; see GumboOptions.event_handler.  Any of them may be
+ * NULL.
+ *
+ * The nodes passed to these belong to the parser, which recycles them once it
+ * no longer needs them; their children vectors and their first_child,
+ * last_child, prev_sibling, and next_sibling links are not meaningful, and
+ * their other fields should be copied out by callbacks that need them later.
+ * The address of an element isn't reused before it has been popped, so
+ * callers that build their own tree can key their elements by address: an
+ * element passed to insert_node is being moved if an element inserted earlier
+ * at that address hasn't been popped yet, and is new otherwise.  Any element
+ * that is named as a parent, or given to remove_node or reparent_children as
+ * the old parent, has been inserted before, although it may have been popped
+ * already: <head> and elements around misnested content can still receive
+ * children after that.
+ */
+typedef struct GumboInternalEventHandler {
+  /**
+   * Called when a node is inserted into node->parent, immediately before
+   * next_sibling, or at the end if that's NULL.  For an element that is already
+   * in the tree, this is a move, the way the adoption agency algorithm moves
+   * misnested content around.
+   *
+   * Text, whitespace, CDATA, and comment nodes are reported exactly once,
+   * complete.  The fields of an element may still change until it is popped.
+   */
+  void (*insert_node)(
+      void* userdata, const GumboNode* node, const GumboNode* next_sibling);
+
+  /**
+   * Called when the <body> element is removed from the document again, which
+   * a <frameset> start tag after it can do.  node->parent is the <html> element
+   * it's removed from.
+   */
+  void (*remove_node)(void* userdata, const GumboNode* node);
+
+  /**
+   * Called when all the other children of old_parent, including those that
+   * have been recycled, are moved to new_parent, a new element that has just
+   * been appended to old_parent.  This is steps 16 and 17 of the adoption
+   * agency algorithm.
+   */
+  void (*reparent_children)(void* userdata, const GumboNode* old_parent,
+      const GumboNode* new_parent);
+
+  /**
+   * Called when an element leaves the stack of open elements, at which point
+   * its attributes, end position, and parse flags are final.  This happens
+   * once per element, except for <head>, which the parser puts back onto the
+   * stack for the <meta>, <script>, <style>, etc. start tags that may come
+   * after it, so it can be popped again.
+   */
+  void (*pop_element)(void* userdata, const GumboNode* element);
+
+  /** Passed as the first argument to the callbacks above. */
+  void* userdata;
+} GumboEventHandler;
+
 /**
  * Input struct containing configuration options for the parser.
  * These let you specify alternate memory managers, provide different error
@@ -589,7 +806,8 @@ typedef struct GumboInternalOptions {
    * The maximum number of errors before the parser stops recording them.  This
    * is provided so that if the page is totally borked, we don't completely fill
    * up the errors vector and exhaust memory with useless redundant errors.  Set
-   * to -1 to disable the limit.
+   * to -1 to disable the limit.  With 0, errors aren't built at all, only
+   * counted in GumboOutput.error_counts.
    * Default: -1
    */
   int max_errors;
@@ -616,6 +834,117 @@ typedef struct GumboInternalOptions {
    * Default: GUMBO_NAMESPACE_HTML
    */
   GumboNamespaceEnum fragment_namespace;
+
+  /**
+   * If nonzero, everything owned by the parse output (nodes, attributes,
+   * strings, errors) is bump-allocated out of chunks of this many bytes,
+   * obtained from the allocator above.  Individual frees become no-ops, and
+   * gumbo_destroy_output releases the chunks wholesale without walking the
+   * tree.  This trades some peak memory for considerably faster allocation
+   * and teardown; a few hundred kilobytes is a reasonable chunk size.
+   * gumbo_destroy_node mustn't be used on such an output's nodes, since it
+   * would pass memory from the chunks to the deallocator.
+   * Default: 0 (disabled).
+   */
+  size_t arena_chunk_size;
+
+  /**
+   * If true, text and whitespace nodes whose decoded text is byte-for-byte the
+   * same as their source (no entities, carriage returns, NULs, etc.) point
+   * directly into the input buffer rather than owning a copy.  Such text is
+   * *not* NUL-terminated; use GumboText.length.  Only text that was actually
+   * transformed is copied.
+   * Default: false.
+   */
+  bool borrow_text;
+
+  /**
+   * If set, the tree is reported to these callbacks as it is constructed, and
+   * the parser recycles each node as soon as it no longer needs it, so memory
+   * use is proportional to the nesting depth of the document rather than its
+   * size.  The output then has a document node without children (but with
+   * the doctype), a NULL root, and the errors.  arena_chunk_size and
+   * pool_slab_size are ignored.
+   * Default: NULL.
+   */
+  const GumboEventHandler* event_handler;
+
+  /**
+   * Where the library sends its trace of the tokenizer and tree construction
+   * state machines, one message at a time, if it was compiled with GUMBO_DEBUG
+   * defined; NULL prints them to stdout.  Without GUMBO_DEBUG, the tracing is
+   * compiled out entirely, and this is never called.
+   * Default: NULL.
+   */
+  GumboTraceFunction trace;
+
+  /**
+   * If true, the parser only records the byte offset of each source position,
+   * and leaves its line and column 0, which saves tracking them for every
+   * character of the input.  A GumboLineIndex over the same buffer resolves
+   * the line and column of any position that turns out to be needed.
+   * Default: false.
+   */
+  bool offsets_only;
+
+  /**
+   * If set, each parse error is passed to this as soon as it's found instead
+   * of being added to GumboOutput.errors, which stays empty, and none of them
+   * are kept: the error and its tag stack are transient, so memory use doesn't
+   * grow with the number of errors.  max_errors limits how many are reported.
+   * Default: NULL.
+   */
+  GumboErrorHandlerFunction error_handler;
+
+  /**
+   * If nonzero, and arena_chunk_size isn't, the nodes, attributes, and errors
+   * of the output are carved out of slabs of this many bytes obtained from
+   * the allocator above, and ones that the parser frees are reused, which
+   * saves most of the allocator calls of a parse.  Unlike with an arena,
+   * strings and vectors are still allocated individually, and memory freed
+   * during the parse is reused.  gumbo_destroy_output releases the slabs
+   * after freeing the rest of the output; as with an arena, gumbo_destroy_node
+   * mustn't be used on such an output's nodes.  A few kilobytes is a
+   * reasonable slab size.
+   * Default: 0 (disabled).
+   */
+  size_t pool_slab_size;
+
+  /**
+   * A function that resizes a block from the allocator, which growing vectors
+   * and string buffers use instead of allocating a new block, copying, and
+   * freeing the old one.  The default reallocator is only used with the
+   * default allocator: with a custom allocator, leaving this at its default
+   * or setting it to NULL silently falls back to allocating a new block with
+   * the allocator, copying the old one into it, and freeing the old one with
+   * the deallocator, on every resize.  Set it along with the allocator to
+   * avoid the copies.
+   * Default: realloc.
+   */
+  GumboReallocatorFunction reallocator;
+
+  /**
+   * A deallocator function that's also told the size of the block, used
+   * instead of deallocator wherever the size is known: for vectors, string
+   * buffers, and pooled and pool-sized objects.  NULL uses the deallocator
+   * everywhere.  Like the reallocator, the default is only used with the
+   * default deallocator.
+   * Default: free.
+   */
+  GumboSizedDeallocatorFunction sized_deallocator;
+
+  /**
+   * The maximum number of formatting elements that the parser reopens at once
+   * when it reconstructs the active formatting elements, as it does before
+   * inserting text or most elements after misnested formatting tags.  If more
+   * than this many would be reopened, only the innermost ones are, and the rest
+   * are dropped from the list of active formatting elements, which deviates
+   * from the spec.  Without a limit, adversarial input can make every element
+   * it inserts reopen thousands of formatting elements.  Set to -1 to disable
+   * the limit.
+   * Default: -1
+   */
+  int max_reconstructed_formatting_elements;
 } GumboOptions;
 
 /** Default options struct; use this with gumbo_parse_with_options. */
@@ -636,13 +965,43 @@ typedef struct GumboInternalOutput {
   GumboNode* root;
 
   /**
-   * A list of errors that occurred during the parse.
-   * NOTE: In version 1.0 of this library, the API for errors hasn't been fully
-   * fleshed out and may change in the future.  For this reason, the GumboError
-   * header isn't part of the public API.  Contact us if you need errors
-   * reported so we can work out something appropriate for your use-case.
+   * A list of errors that occurred during the parse, as GumboError pointers;
+   * read them with the gumbo_error_* functions.  Empty if the errors were
+   * passed to GumboOptions.error_handler instead.
    */
   GumboVector /* GumboError */ errors;
+
+  /**
+   * The arena that owns all memory of this output, if it was parsed with a
+   * nonzero GumboOptions.arena_chunk_size; NULL otherwise.  Opaque; used by
+   * gumbo_destroy_output.
+   */
+  struct GumboInternalArena* arena;
+
+  /**
+   * For documents fed in with gumbo_parser_context_feed, the text of the whole
+   * document, which is where all the original_text fields of the output point
+   * and what all its source offsets refer to.  It belongs to the output.  NULL
+   * for other parses (and for empty fed documents).
+   */
+  const char* input;
+
+  /** The length of input. */
+  size_t input_length;
+
+  /**
+   * The number of parse errors of each type, indexed by GumboErrorType.  These
+   * count every error, including those past max_errors that aren't in errors,
+   * so they're a cheap way to monitor pages' errors with max_errors set to 0.
+   */
+  unsigned int error_counts[GUMBO_NUM_ERROR_TYPES];
+
+  /**
+   * The pool that owns the nodes, attributes, and errors of this output, if
+   * it was parsed with a nonzero GumboOptions.pool_slab_size; NULL otherwise.
+   * Opaque; used by gumbo_destroy_output.
+   */
+  struct GumboInternalPool* pool;
 } GumboOutput;
 
 /**
@@ -661,9 +1020,362 @@ GumboOutput* gumbo_parse(const char* buffer);
 GumboOutput* gumbo_parse_with_options(
     const GumboOptions* options, const char* buffer, size_t buffer_length);
 
-/** Release the memory used for the parse tree & parse errors. */
+/**
+ * Release the memory used for the parse tree & parse errors.  The tree is
+ * freed without recursion, so this takes constant stack space however deeply
+ * it's nested.
+ */
 void gumbo_destroy_output(const GumboOptions* options, GumboOutput* output);
 
+/**
+ * Moves everything that an output owns into a single block of memory, laid
+ * out in document order: each node is followed by its attributes, their
+ * strings, its text, and the array of its children, and then by the copy of
+ * its first child.  Trees that are walked many times after the parse are
+ * then read sequentially, rather than from wherever the allocator put each of
+ * their pieces.  Returns the compacted output, and destroys the one passed in,
+ * which must have been parsed with the same options.
+ *
+ * The compacted output is released with gumbo_destroy_output as usual, which
+ * frees the block without walking the tree.  As with an arena, its nodes
+ * mustn't be passed to gumbo_destroy_node, nor its vectors grown.
+ */
+GumboOutput* gumbo_output_compact(
+    const GumboOptions* options, GumboOutput* output);
+
+/** The two visits that a GumboWalker makes to each node. */
+typedef enum {
+  /** Before the node's children: pre-order. */
+  GUMBO_WALK_ENTER,
+  /** After the node's children: post-order. */
+  GUMBO_WALK_LEAVE
+} GumboWalkEvent;
+
+/**
+ * A depth-first walk over a subtree that needs neither recursion nor any
+ * memory of its own, so that its cost and stack usage stay flat however
+ * deeply the tree is nested.  Each node is entered, then its children are
+ * walked in order, then it's left; nodes without children are entered and
+ * left in turn.  The walker finds its way through the tree by the parent,
+ * first_child, and next_sibling of each node, so the tree mustn't be
+ * restructured during a walk, but the nodes themselves may be changed.
+ *
+ * Example:
+ * @code
+ *    GumboWalker walker;
+ *    GumboWalkEvent event;
+ *    gumbo_walker_init(&walker, output->root);
+ *    for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+ *      if (event == GUMBO_WALK_ENTER && node->type == GUMBO_NODE_TEXT) {
+ *        puts(node->v.text.text);
+ *      }
+ *    }
+ * @endcode
+ */
+typedef struct GumboInternalWalker {
+  /** Opaque; the state of the walk. */
+  GumboNode* _root;
+  GumboNode* _node;
+  GumboWalkEvent _event;
+  bool _skip_children;
+} GumboWalker;
+
+/** Starts a walk over the subtree rooted at the given node. */
+void gumbo_walker_init(GumboWalker* walker, GumboNode* root);
+
+/**
+ * Advances the walk, returning the next node and filling in whether it's being
+ * entered or left, or returning NULL once the root has been left.
+ */
+GumboNode* gumbo_walker_next(GumboWalker* walker, GumboWalkEvent* event);
+
+/**
+ * Skips the children of the node that was just entered, so that the next call
+ * to gumbo_walker_next leaves it.
+ */
+void gumbo_walker_skip_children(GumboWalker* walker);
+
+/**
+ * An opaque, reusable parser.  Parsing a stream of documents through one
+ * GumboParserContext avoids reallocating the tokenizer and tree-construction
+ * scratch buffers for each of them: they're kept at their high-water capacity
+ * between documents, so in the steady state only the output is allocated.  A
+ * context may only be used by one thread at a time.
+ */
+typedef struct GumboInternalParserContext GumboParserContext;
+
+/** Creates a parser context.  The options are copied into the context. */
+GumboParserContext* gumbo_parser_context_create(const GumboOptions* options);
+
+/**
+ * Parses a buffer using the context, exactly as gumbo_parse_with_options would
+ * with the context's options.  The output doesn't depend on the context and
+ * may outlive it; release it with gumbo_destroy_output as usual.
+ */
+GumboOutput* gumbo_parser_context_parse(
+    GumboParserContext* context, const char* buffer, size_t buffer_length);
+
+/**
+ * Feeds the next chunk of a document to the context, for input that arrives a
+ * piece at a time, e.g. from the network.  The context parses as much of the
+ * document as it can right away, and keeps its own copy of the text, so the
+ * chunk may be discarded as soon as this returns.  Chunk boundaries may fall
+ * anywhere, even inside a UTF-8 sequence; the output is exactly what
+ * gumbo_parser_context_parse would produce for the whole document at once.
+ *
+ * The document has to stay contiguous, since the output points into it.  When
+ * it outgrows its buffer, it moves to one twice the size, and the parse
+ * carries on from where it was, with the pointers into the document moved
+ * over; that copies each byte a constant number of times on average, and
+ * gumbo_parser_context_reserve avoids it if the length is known up front.
+ * With GumboOptions.event_handler, the nodes passed to the callbacks are the
+ * same objects before and after a move, but any pointer into the document
+ * that the handler kept, such as the data of an original_text, is left
+ * pointing into the old buffer, which is freed; keep the offsets of source
+ * positions instead.
+ *
+ * Calling gumbo_parser_context_parse or gumbo_parser_context_reset, or
+ * destroying the context, abandons a document that is being fed.
+ */
+void gumbo_parser_context_feed(
+    GumboParserContext* context, const char* data, size_t length);
+
+/**
+ * Makes room for a fed document of input_length bytes in total, so that
+ * feeding it doesn't have to move it.
+ */
+void gumbo_parser_context_reserve(
+    GumboParserContext* context, size_t input_length);
+
+/**
+ * Finishes the document fed in with gumbo_parser_context_feed, and returns its
+ * output.  GumboOutput.input holds the document text, and is released along
+ * with the rest of the output by gumbo_destroy_output.  The context is then
+ * ready for another document.
+ */
+GumboOutput* gumbo_parser_context_finish(GumboParserContext* context);
+
+/**
+ * Releases the scratch memory retained by the context, for instance after an
+ * unusually large document.  The context remains usable.
+ */
+void gumbo_parser_context_reset(GumboParserContext* context);
+
+/** Destroys a parser context.  Outputs it produced are unaffected. */
+void gumbo_parser_context_destroy(GumboParserContext* context);
+
+/** The type of a token produced by the tokenizer. */
+typedef enum {
+  /** A DOCTYPE declaration. */
+  GUMBO_TOKEN_DOCTYPE,
+  /** A start tag, e.g. <a href="...">. */
+  GUMBO_TOKEN_START_TAG,
+  /** An end tag, e.g. </a>. */
+  GUMBO_TOKEN_END_TAG,
+  /** A comment, including bogus comments such as <?php ... ?>. */
+  GUMBO_TOKEN_COMMENT,
+  /** A single whitespace character. */
+  GUMBO_TOKEN_WHITESPACE,
+  /** A single non-whitespace character, possibly from a character reference. */
+  GUMBO_TOKEN_CHARACTER,
+  /**
+   * A stretch of text that contains no character references, NULs, carriage
+   * returns, or invalid UTF-8, and so is exactly its original_text.
+   */
+  GUMBO_TOKEN_CHARACTER_RUN,
+  /** A single character within a CDATA section. */
+  GUMBO_TOKEN_CDATA,
+  /** A NUL character. */
+  GUMBO_TOKEN_NULL,
+  /** The end of the input. */
+  GUMBO_TOKEN_EOF,
+  /** Used internally; never returned by gumbo_tokenizer_next. */
+  GUMBO_TOKEN_NEED_INPUT
+} GumboTokenType;
+
+/** The data of a GUMBO_TOKEN_DOCTYPE token. */
+typedef struct GumboInternalTokenDocType {
+  /** The name of the doctype, lowercased, e.g. "html". */
+  const char* name;
+  /** The public identifier, or "" if there is none. */
+  const char* public_identifier;
+  /** The system identifier, or "" if there is none. */
+  const char* system_identifier;
+  /** Whether the doctype forces the document into quirks mode. */
+  bool force_quirks;
+  /**
+   * There's no way to tell a 0-length public or system ID apart from the
+   * absence of a public or system ID, but they're handled different by the
+   * spec, so we need bool flags for them.
+   */
+  bool has_public_identifier;
+  /** Whether the doctype has a system identifier; see above. */
+  bool has_system_identifier;
+} GumboTokenDocType;
+
+/** The data of a GUMBO_TOKEN_START_TAG token. */
+typedef struct GumboInternalTokenStartTag {
+  /**
+   * The tag, or GUMBO_TAG_UNKNOWN; the name of an unknown tag can be recovered
+   * from the original_text of its token with gumbo_tag_from_original_text.
+   */
+  GumboTag tag;
+  /** The attributes of the tag, as GumboAttribute pointers. */
+  GumboVector /* GumboAttribute */ attributes;
+  /** Whether the tag ends in "/>". */
+  bool is_self_closing;
+  /**
+   * Storage for the first few attributes, which the data of the vector above
+   * points into until they outgrow it.  Internal to the library.
+   */
+  void* _inline_attributes[GUMBO_INLINE_ATTRIBUTES];
+} GumboTokenStartTag;
+
+/**
+ * A token: its type, its source position, the text it was read from, and then
+ * a union for any parsed data.
+ */
+typedef struct GumboInternalToken {
+  /** The type of the token, which determines which member of v is valid. */
+  GumboTokenType type;
+  /** The position of the start of the token in the input. */
+  GumboSourcePosition position;
+  /** The text of the token, pointing into the input. */
+  GumboStringPiece original_text;
+  /** The parsed data of the token. */
+  union {
+    /** For GUMBO_TOKEN_DOCTYPE. */
+    GumboTokenDocType doc_type;
+    /** For GUMBO_TOKEN_START_TAG. */
+    GumboTokenStartTag start_tag;
+    /** For GUMBO_TOKEN_END_TAG. */
+    GumboTag end_tag;
+    /** For GUMBO_TOKEN_COMMENT: the text of the comment. */
+    const char* text;
+    /**
+     * For GUMBO_TOKEN_CHARACTER, WHITESPACE, CDATA, and NULL: the decoded code
+     * point.  Character runs carry only their original_text.
+     */
+    int character;
+  } v;
+} GumboToken;
+
+/**
+ * The text states that a GumboTokenizer can be switched to.  The tree
+ * construction algorithm switches to these after certain start tags; callers
+ * of the tokenizer have to do the same to tokenize the contents of those
+ * elements correctly:
+ * - RCDATA after <title> and <textarea>,
+ * - RAWTEXT after <style>, <xmp>, <iframe>, <noembed>, and <noframes> (and
+ *   <noscript> if scripting is enabled),
+ * - SCRIPT_DATA after <script>,
+ * - PLAINTEXT after <plaintext>.
+ * An end tag that matches the last start tag switches back to DATA.
+ */
+typedef enum {
+  GUMBO_TOKENIZER_MODE_DATA,
+  GUMBO_TOKENIZER_MODE_RCDATA,
+  GUMBO_TOKENIZER_MODE_RAWTEXT,
+  GUMBO_TOKENIZER_MODE_SCRIPT_DATA,
+  GUMBO_TOKENIZER_MODE_PLAINTEXT
+} GumboTokenizerMode;
+
+/**
+ * An opaque pull tokenizer, for callers that want the raw token stream of a
+ * document (e.g. to extract links, or to minify or rewrite it) without the
+ * cost of tree construction.
+ *
+ * Example:
+ * @code
+ *    GumboTokenizer* tokenizer =
+ *        gumbo_tokenizer_create(&kGumboDefaultOptions, input, input_length);
+ *    const GumboToken* token;
+ *    while ((token = gumbo_tokenizer_next(tokenizer))) {
+ *      if (token->type == GUMBO_TOKEN_START_TAG &&
+ *          token->v.start_tag.tag == GUMBO_TAG_SCRIPT) {
+ *        gumbo_tokenizer_set_mode(tokenizer, GUMBO_TOKENIZER_MODE_SCRIPT_DATA);
+ *      }
+ *      ...
+ *    }
+ *    gumbo_tokenizer_destroy(tokenizer);
+ * @endcode
+ */
+typedef struct GumboInternalTokenizer GumboTokenizer;
+
+/**
+ * Creates a tokenizer over a buffer of UTF-8 text, which must outlive it.  The
+ * options are copied; only the allocator, userdata, tab_stop, offsets_only,
+ * max_errors, and error_handler are used.  Tokenization errors are only
+ * reported to an error_handler.
+ */
+GumboTokenizer* gumbo_tokenizer_create(
+    const GumboOptions* options, const char* buffer, size_t buffer_length);
+
+/**
+ * Returns the next token, or NULL after the GUMBO_TOKEN_EOF token.  The token
+ * and the strings and attributes it owns belong to the tokenizer, and are
+ * valid until the next call.  Text comes in GUMBO_TOKEN_CHARACTER_RUN tokens
+ * wherever it can, and a character at a time otherwise.
+ */
+const GumboToken* gumbo_tokenizer_next(GumboTokenizer* tokenizer);
+
+/**
+ * Switches the tokenizer to the given text state, for the tokens after the
+ * one last returned.
+ */
+void gumbo_tokenizer_set_mode(
+    GumboTokenizer* tokenizer, GumboTokenizerMode mode);
+
+/**
+ * Tells the tokenizer whether the current node is in foreign (SVG or MathML)
+ * content, the only place where <![CDATA[ starts a CDATA section rather than
+ * a bogus comment.  Default: false.
+ */
+void gumbo_tokenizer_set_foreign_content(
+    GumboTokenizer* tokenizer, bool is_foreign);
+
+/** Destroys a tokenizer, along with the last token it returned. */
+void gumbo_tokenizer_destroy(GumboTokenizer* tokenizer);
+
+/**
+ * An opaque index of where the lines of a document start, for resolving the
+ * line and column of source positions recorded with
+ * GumboOptions.offsets_only.  Building it takes one vectorized pass over the
+ * buffer; each lookup is a binary search plus a walk along one line.
+ *
+ * Example:
+ * @code
+ *    GumboLineIndex* lines =
+ *        gumbo_line_index_create(&options, input, input_length);
+ *    GumboSourcePosition position = node->v.element.start_pos;
+ *    gumbo_line_index_resolve(lines, &position);
+ *    printf("%u:%u\n", position.line, position.column);
+ *    gumbo_line_index_destroy(lines);
+ * @endcode
+ */
+typedef struct GumboInternalLineIndex GumboLineIndex;
+
+/**
+ * Indexes the lines of a buffer, which must outlive the index and, like any
+ * input, be no more than 4 GiB long (see GumboSourcePosition).  The options
+ * are copied; only the allocator and deallocator functions, userdata, and
+ * tab_stop are used.
+ */
+GumboLineIndex* gumbo_line_index_create(
+    const GumboOptions* options, const char* buffer, size_t buffer_length);
+
+/**
+ * Fills in the line and column of a position from its offset, exactly as a
+ * parse without offsets_only would have recorded them: a carriage return, a
+ * line feed, or a CRLF pair ends a line, and tabs advance the column to the
+ * next tab stop.  The offset must be within the buffer or just past its end.
+ */
+void gumbo_line_index_resolve(
+    const GumboLineIndex* index, GumboSourcePosition* position);
+
+/** Destroys a line index. */
+void gumbo_line_index_destroy(GumboLineIndex* index);
+
 #ifdef __cplusplus
 }
 #endif
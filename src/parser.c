@@ -17,15 +17,18 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
+#include "arena.h"
 #include "attribute.h"
 #include "error.h"
 #include "gumbo.h"
 #include "insertion_mode.h"
 #include "parser.h"
+#include "pool.h"
 #include "tokenizer.h"
 #include "tokenizer_states.h"
 #include "utf8.h"
@@ -54,13 +57,25 @@ static GumboInsertionMode get_current_template_insertion_mode(
     const GumboParser*);
 static bool handle_in_template(GumboParser*, GumboToken*);
 static void destroy_node(GumboParser*, GumboNode*);
+static void recycle_node(GumboParser*, GumboNode*);
+static unsigned int get_index_within_parent(GumboParser*, const GumboNode*);
 
 static void* malloc_wrapper(void* unused, size_t size) { return malloc(size); }
 
 static void free_wrapper(void* unused, void* ptr) { free(ptr); }
 
+static void* realloc_wrapper(
+    void* unused, void* ptr, size_t old_size, size_t new_size) {
+  return realloc(ptr, new_size);
+}
+
+static void sized_free_wrapper(void* unused, void* ptr, size_t size) {
+  free(ptr);
+}
+
 const GumboOptions kGumboDefaultOptions = {&malloc_wrapper, &free_wrapper, NULL,
-    8, false, -1, GUMBO_TAG_LAST, GUMBO_NAMESPACE_HTML};
+    8, false, -1, GUMBO_TAG_LAST, GUMBO_NAMESPACE_HTML, 0, false, NULL, NULL,
+    false, NULL, 0, &realloc_wrapper, &sized_free_wrapper, -1};
 
 static const GumboStringPiece kDoctypeHtml = GUMBO_STRING("html");
 static const GumboStringPiece kPublicIdHtml4_0 =
@@ -314,6 +329,86 @@ static const GumboNode kActiveFormattingScopeMarker;
 static const bool kStartTag = true;
 static const bool kEndTag = false;
 
+// The kinds of scope that the "has an element in scope" algorithms look in.
+// Each is bounded by the nearest open element with one of its tags in
+// kScopeBoundaries, or for select scope, the nearest without one.
+typedef enum {
+  SCOPE_DEFAULT,
+  SCOPE_LIST_ITEM,
+  SCOPE_BUTTON,
+  SCOPE_TABLE,
+  SCOPE_SELECT,
+  // Bounded only by <html>, for has_open_element.
+  SCOPE_ANY,
+  NUM_SCOPES
+} ScopeType;
+
+static const gumbo_tagset kScopeBoundaries[NUM_SCOPES] = {
+    [SCOPE_DEFAULT] = {TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE),
+        TAG(TD), TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE),
+        TAG_MATHML(MI), TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS),
+        TAG_MATHML(MTEXT), TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT),
+        TAG_SVG(DESC), TAG_SVG(TITLE)},
+    [SCOPE_LIST_ITEM] = {TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE),
+        TAG(TD), TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE),
+        TAG_MATHML(MI), TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS),
+        TAG_MATHML(MTEXT), TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT),
+        TAG_SVG(DESC), TAG_SVG(TITLE), TAG(OL), TAG(UL)},
+    [SCOPE_BUTTON] = {TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE),
+        TAG(TD), TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE),
+        TAG_MATHML(MI), TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS),
+        TAG_MATHML(MTEXT), TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT),
+        TAG_SVG(DESC), TAG_SVG(TITLE), TAG(BUTTON)},
+    [SCOPE_TABLE] = {TAG(HTML), TAG(TABLE), TAG(TEMPLATE)},
+    [SCOPE_SELECT] = {TAG(OPTGROUP), TAG(OPTION)},
+    [SCOPE_ANY] = {TAG(HTML)},
+};
+
+// What the parser keeps track of for each element on the stack of open
+// elements, so that scope queries don't have to walk the stack.
+typedef struct {
+  // The index of the next element down the stack with the same tag in the HTML
+  // namespace, or -1.
+  int prev_with_tag;
+
+  // For each ScopeType, the index of the topmost element at or below this one
+  // that bounds it, or -1.
+  int scope_boundaries[NUM_SCOPES];
+} OpenElementIndex;
+
+// A hash table from the nodes on one of the parser's stacks to their indices
+// in it, so that the adoption agency algorithm and its kin can find them
+// without searching the stack.  Open addressing with linear probing; the
+// capacity is a power of two, and at most half of it is used.
+typedef struct {
+  const GumboNode* node;  // NULL for an empty slot.
+  unsigned int index;
+} NodeIndexEntry;
+
+typedef struct {
+  NodeIndexEntry* entries;
+  unsigned int capacity;
+  unsigned int size;
+} NodeIndexMap;
+
+static const unsigned int kInitialNodeIndexMapCapacity = 32;
+
+// A hash table from formatting element hashes (see formatting_element_hash)
+// to how many entries in the list of active formatting elements have each,
+// laid out like NodeIndexMap.
+typedef struct {
+  unsigned int hash;
+  unsigned int count;  // 0 for an empty slot.
+} HashCountEntry;
+
+typedef struct {
+  HashCountEntry* entries;
+  unsigned int capacity;
+  unsigned int size;
+} HashCountMap;
+
+static const unsigned int kInitialHashCountMapCapacity = 16;
+
 // Because GumboStringPieces are immutable, we can't insert a character directly
 // into a text node.  Instead, we accumulate all pending characters here and
 // flush them out to a text node whenever a new element is inserted.
@@ -348,9 +443,35 @@ typedef struct GumboInternalParserState {
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#the-stack-of-open-elements
   GumboVector /*GumboNode*/ _open_elements;
 
+  // Kept in step with _open_elements by the *_open_element functions below: an
+  // OpenElementIndex for each open element, and the index of the topmost open
+  // element with each tag in the HTML namespace, or -1.  Scratch state, like
+  // the stacks.
+  OpenElementIndex* _open_element_index;
+  unsigned int _open_element_index_capacity;
+  int _topmost_with_tag[GUMBO_TAG_LAST];
+
+  // The index of each open element, kept along with _open_element_index.
+  NodeIndexMap _open_element_positions;
+
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#the-list-of-active-formatting-elements
   GumboVector /*GumboNode*/ _active_formatting_elements;
 
+  // The formatting_element_hash of each entry in _active_formatting_elements,
+  // at the same index, so that the Noah's Ark clause can rule out most entries
+  // without comparing their attributes, and the index of each entry other than
+  // scope markers.  Only changed through the *_formatting_element functions
+  // below.
+  GumboVector /*unsigned int*/ _active_formatting_hashes;
+  NodeIndexMap _active_formatting_positions;
+
+  // The number of entries other than scope markers in the list of active
+  // formatting elements with each hash, so that the Noah's Ark clause only
+  // looks for identical elements when there are at least three with the hash.
+  // This counts entries before the last scope marker too, so it's only an
+  // upper bound on what the clause counts.
+  HashCountMap _active_formatting_hash_counts;
+
   // The stack of template insertion modes.
   // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#the-insertion-mode
   GumboVector /*InsertionMode*/ _template_insertion_modes;
@@ -362,6 +483,15 @@ typedef struct GumboInternalParserState {
   // The element used as fragment context when parsing in fragment mode
   GumboNode* _fragment_ctx;
 
+  // Inserting or removing a child leaves the index_within_parent fields of its
+  // following siblings to be brought up to date lazily, by
+  // update_child_indices, so that repeated changes to the children of one
+  // node don't renumber the same siblings over and over.  The children of
+  // _stale_parent from _stale_child_index on may have stale indices; those of
+  // any other node are up to date.
+  GumboNode* _stale_parent;
+  unsigned int _stale_child_index;
+
   // The flag for when the spec says "Reprocess the current token in..."
   bool _reprocess_current_token;
 
@@ -390,6 +520,10 @@ typedef struct GumboInternalParserState {
   // The current token.
   GumboToken* _current_token;
 
+  // Storage for the token being handled by parse_tokens.  The last one is still
+  // needed by finish_parse, which may be called separately for fed input.
+  GumboToken _token;
+
   // The way that the spec is written, the </body> and </html> tags are *always*
   // implicit, because encountering one of those tokens merely switches the
   // insertion mode out of "in body".  So we have individual state flags for
@@ -398,6 +532,20 @@ typedef struct GumboInternalParserState {
   // flag appropriately.
   bool _closed_body_tag;
   bool _closed_html_tag;
+
+  // Whether the tokenizer or tree construction have reported an error so far,
+  // for GumboOptions.stop_on_first_error.
+  bool _has_error;
+
+  // For GumboOptions.event_handler: the elements that have left the stack of
+  // open elements but may still be referred to, and the recycled nodes waiting
+  // to be reused.  Both are scratch state, like the stacks.
+  GumboVector /*GumboNode*/ _closed_elements;
+  GumboVector /*GumboNode*/ _free_nodes;
+
+  // For GumboOptions.error_handler: the tag stack lent to each tree
+  // construction error as it's reported.  Scratch state, like the stacks.
+  GumboVector /*GumboTag*/ _error_tag_stack;
 } GumboParserState;
 
 static bool token_has_attribute(const GumboToken* token, const char* name) {
@@ -437,14 +585,27 @@ static bool all_attributes_match(
 }
 
 static void set_frameset_not_ok(GumboParser* parser) {
-  gumbo_debug("Setting frameset_ok to false.\n");
+  gumbo_debug(parser, "Setting frameset_ok to false.\n");
   parser->_parser_state->_frameset_ok = false;
 }
 
+// Allocates a node, reusing a recycled one if there is one.
+static GumboNode* allocate_node(GumboParser* parser) {
+  GumboVector* free_nodes = &parser->_parser_state->_free_nodes;
+  if (free_nodes->length > 0) {
+    return gumbo_vector_pop(parser, free_nodes);
+  }
+  return gumbo_parser_allocate_object(parser, GUMBO_POOLED_NODE);
+}
+
 static GumboNode* create_node(GumboParser* parser, GumboNodeType type) {
-  GumboNode* node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* node = allocate_node(parser);
   node->parent = NULL;
   node->index_within_parent = -1;
+  node->first_child = NULL;
+  node->last_child = NULL;
+  node->prev_sibling = NULL;
+  node->next_sibling = NULL;
   node->type = type;
   node->parse_flags = GUMBO_INSERTION_NORMAL;
   return node;
@@ -465,46 +626,419 @@ static GumboNode* new_document_node(GumboParser* parser) {
   return document_node;
 }
 
+// Sets up a fresh output, and the arena or pool that will own it if one was
+// requested.
 static void output_init(GumboParser* parser) {
+  const GumboOptions* options = parser->_options;
+  // Reported nodes are freed as soon as they're no longer needed, which an
+  // arena wouldn't do, and with the scratch allocator, which a pool can't.
+  parser->_arena = options->arena_chunk_size && !options->event_handler
+                       ? gumbo_arena_create(options)
+                       : NULL;
+  parser->_pool =
+      options->pool_slab_size && !parser->_arena && !options->event_handler
+          ? gumbo_pool_create(options)
+          : NULL;
   GumboOutput* output = gumbo_parser_allocate(parser, sizeof(GumboOutput));
   output->root = NULL;
+  output->arena = parser->_arena;
+  output->pool = parser->_pool;
+  output->input = NULL;
+  output->input_length = 0;
   output->document = new_document_node(parser);
   parser->_output = output;
   gumbo_init_errors(parser);
 }
 
-static void parser_state_init(GumboParser* parser) {
-  GumboParserState* parser_state =
-      gumbo_parser_allocate(parser, sizeof(GumboParserState));
+static void node_index_map_init(GumboParser* parser, NodeIndexMap* map) {
+  map->capacity = kInitialNodeIndexMapCapacity;
+  map->size = 0;
+  map->entries =
+      gumbo_scratch_allocate(parser, sizeof(NodeIndexEntry) * map->capacity);
+  memset(map->entries, 0, sizeof(NodeIndexEntry) * map->capacity);
+}
+
+static void node_index_map_destroy(GumboParser* parser, NodeIndexMap* map) {
+  gumbo_scratch_deallocate_sized(
+      parser, map->entries, sizeof(NodeIndexEntry) * map->capacity);
+}
+
+static void node_index_map_clear(NodeIndexMap* map) {
+  if (map->size > 0) {
+    memset(map->entries, 0, sizeof(NodeIndexEntry) * map->capacity);
+    map->size = 0;
+  }
+}
+
+static unsigned int node_index_map_home(
+    const NodeIndexMap* map, const GumboNode* node) {
+  // Fibonacci hashing; the low bits of a node's address carry little entropy.
+  uintptr_t bits = (uintptr_t) node;
+  return (unsigned int) ((bits ^ (bits >> 16)) * 2654435761u) &
+         (map->capacity - 1);
+}
+
+// Returns the slot holding the node, or the empty slot where it would go.
+static NodeIndexEntry* node_index_map_slot(
+    const NodeIndexMap* map, const GumboNode* node) {
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = node_index_map_home(map, node);
+  while (map->entries[i].node && map->entries[i].node != node) {
+    i = (i + 1) & mask;
+  }
+  return &map->entries[i];
+}
+
+// Returns the index recorded for the node, or -1.
+static int node_index_map_get(const NodeIndexMap* map, const GumboNode* node) {
+  const NodeIndexEntry* entry = node_index_map_slot(map, node);
+  return entry->node ? (int) entry->index : -1;
+}
+
+static void node_index_map_set(GumboParser* parser, NodeIndexMap* map,
+    const GumboNode* node, unsigned int index) {
+  NodeIndexEntry* entry = node_index_map_slot(map, node);
+  if (entry->node) {
+    entry->index = index;
+    return;
+  }
+  if (2 * (map->size + 1) > map->capacity) {
+    NodeIndexEntry* old_entries = map->entries;
+    unsigned int old_capacity = map->capacity;
+    map->capacity *= 2;
+    map->entries =
+        gumbo_scratch_allocate(parser, sizeof(NodeIndexEntry) * map->capacity);
+    memset(map->entries, 0, sizeof(NodeIndexEntry) * map->capacity);
+    for (unsigned int i = 0; i < old_capacity; ++i) {
+      if (old_entries[i].node) {
+        *node_index_map_slot(map, old_entries[i].node) = old_entries[i];
+      }
+    }
+    gumbo_scratch_deallocate_sized(
+        parser, old_entries, sizeof(NodeIndexEntry) * old_capacity);
+    entry = node_index_map_slot(map, node);
+  }
+  entry->node = node;
+  entry->index = index;
+  ++map->size;
+}
+
+static void node_index_map_remove(NodeIndexMap* map, const GumboNode* node) {
+  NodeIndexEntry* entry = node_index_map_slot(map, node);
+  if (!entry->node) {
+    return;
+  }
+  // Shift later entries of the same cluster back into the hole, unless that
+  // would move them before their home slot, so that lookups never stop early.
+  unsigned int mask = map->capacity - 1;
+  unsigned int hole = entry - map->entries;
+  for (unsigned int i = (hole + 1) & mask; map->entries[i].node;
+       i = (i + 1) & mask) {
+    unsigned int home = node_index_map_home(map, map->entries[i].node);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      map->entries[hole] = map->entries[i];
+      hole = i;
+    }
+  }
+  map->entries[hole].node = NULL;
+  --map->size;
+}
+
+static void hash_count_map_init(GumboParser* parser, HashCountMap* map) {
+  map->capacity = kInitialHashCountMapCapacity;
+  map->size = 0;
+  map->entries =
+      gumbo_scratch_allocate(parser, sizeof(HashCountEntry) * map->capacity);
+  memset(map->entries, 0, sizeof(HashCountEntry) * map->capacity);
+}
+
+static void hash_count_map_destroy(GumboParser* parser, HashCountMap* map) {
+  gumbo_scratch_deallocate_sized(
+      parser, map->entries, sizeof(HashCountEntry) * map->capacity);
+}
+
+static void hash_count_map_clear(HashCountMap* map) {
+  if (map->size > 0) {
+    memset(map->entries, 0, sizeof(HashCountEntry) * map->capacity);
+    map->size = 0;
+  }
+}
+
+static unsigned int hash_count_map_home(
+    const HashCountMap* map, unsigned int hash) {
+  return (hash * 2654435761u) & (map->capacity - 1);
+}
+
+// Returns the slot holding the hash, or the empty slot where it would go.
+static HashCountEntry* hash_count_map_slot(
+    const HashCountMap* map, unsigned int hash) {
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = hash_count_map_home(map, hash);
+  while (map->entries[i].count && map->entries[i].hash != hash) {
+    i = (i + 1) & mask;
+  }
+  return &map->entries[i];
+}
+
+static unsigned int hash_count_map_get(
+    const HashCountMap* map, unsigned int hash) {
+  return hash_count_map_slot(map, hash)->count;
+}
+
+// Counts one more entry with the hash.
+static void hash_count_map_increment(
+    GumboParser* parser, HashCountMap* map, unsigned int hash) {
+  HashCountEntry* entry = hash_count_map_slot(map, hash);
+  if (entry->count) {
+    ++entry->count;
+    return;
+  }
+  if (2 * (map->size + 1) > map->capacity) {
+    HashCountEntry* old_entries = map->entries;
+    unsigned int old_capacity = map->capacity;
+    map->capacity *= 2;
+    map->entries =
+        gumbo_scratch_allocate(parser, sizeof(HashCountEntry) * map->capacity);
+    memset(map->entries, 0, sizeof(HashCountEntry) * map->capacity);
+    for (unsigned int i = 0; i < old_capacity; ++i) {
+      if (old_entries[i].count) {
+        *hash_count_map_slot(map, old_entries[i].hash) = old_entries[i];
+      }
+    }
+    gumbo_scratch_deallocate_sized(
+        parser, old_entries, sizeof(HashCountEntry) * old_capacity);
+    entry = hash_count_map_slot(map, hash);
+  }
+  entry->hash = hash;
+  entry->count = 1;
+  ++map->size;
+}
+
+// Counts one fewer entry with the hash, which must have been counted.
+static void hash_count_map_decrement(HashCountMap* map, unsigned int hash) {
+  HashCountEntry* entry = hash_count_map_slot(map, hash);
+  assert(entry->count > 0);
+  if (--entry->count > 0) {
+    return;
+  }
+  // As in node_index_map_remove.
+  unsigned int mask = map->capacity - 1;
+  unsigned int hole = entry - map->entries;
+  for (unsigned int i = (hole + 1) & mask; map->entries[i].count;
+       i = (i + 1) & mask) {
+    unsigned int home = hash_count_map_home(map, map->entries[i].hash);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      map->entries[hole] = map->entries[i];
+      hole = i;
+    }
+  }
+  map->entries[hole].count = 0;
+  --map->size;
+}
+
+static bool is_scope_boundary(const GumboNode* node, ScopeType scope) {
+  bool is_in_set = TAGSET_INCLUDES(kScopeBoundaries[scope],
+      node->v.element.tag_namespace, node->v.element.tag);
+  return scope == SCOPE_SELECT ? !is_in_set : is_in_set;
+}
+
+// Records the open element at the given index, which must be one above the
+// topmost one recorded so far.
+static void index_open_element(GumboParser* parser, unsigned int index) {
+  GumboParserState* state = parser->_parser_state;
+  if (index >= state->_open_element_index_capacity) {
+    unsigned int capacity = state->_open_element_index_capacity;
+    state->_open_element_index = gumbo_scratch_reallocate(parser,
+        state->_open_element_index, sizeof(OpenElementIndex) * capacity,
+        sizeof(OpenElementIndex) * capacity * 2);
+    state->_open_element_index_capacity = capacity * 2;
+  }
+  const GumboNode* node = state->_open_elements.data[index];
+  OpenElementIndex* entry = &state->_open_element_index[index];
+  entry->prev_with_tag = -1;
+  if (node->v.element.tag_namespace == GUMBO_NAMESPACE_HTML) {
+    entry->prev_with_tag = state->_topmost_with_tag[node->v.element.tag];
+    state->_topmost_with_tag[node->v.element.tag] = index;
+  }
+  node_index_map_set(parser, &state->_open_element_positions, node, index);
+  for (int scope = 0; scope < NUM_SCOPES; ++scope) {
+    if (is_scope_boundary(node, scope)) {
+      entry->scope_boundaries[scope] = index;
+    } else {
+      entry->scope_boundaries[scope] =
+          index > 0 ? entry[-1].scope_boundaries[scope] : -1;
+    }
+  }
+}
+
+// Undoes index_open_element for the topmost open element recorded, which is at
+// the given index.
+static void unindex_open_element(GumboParser* parser, unsigned int index) {
+  GumboParserState* state = parser->_parser_state;
+  const GumboNode* node = state->_open_elements.data[index];
+  if (node->v.element.tag_namespace == GUMBO_NAMESPACE_HTML) {
+    assert(state->_topmost_with_tag[node->v.element.tag] == (int) index);
+    state->_topmost_with_tag[node->v.element.tag] =
+        state->_open_element_index[index].prev_with_tag;
+  }
+  node_index_map_remove(&state->_open_element_positions, node);
+}
+
+// These change the stack of open elements, keeping its index up to date.
+// Changes to the middle of the stack re-index the elements above them.
+static void push_open_element(GumboParser* parser, GumboNode* node) {
+  GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  gumbo_vector_add_scratch(parser, node, open_elements);
+  index_open_element(parser, open_elements->length - 1);
+}
+
+static GumboNode* pop_open_element(GumboParser* parser) {
+  GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  if (open_elements->length == 0) {
+    return NULL;
+  }
+  unindex_open_element(parser, open_elements->length - 1);
+  return gumbo_vector_pop(parser, open_elements);
+}
+
+static void insert_open_element_at(
+    GumboParser* parser, GumboNode* node, unsigned int index) {
+  GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  for (unsigned int i = open_elements->length; i-- > index;) {
+    unindex_open_element(parser, i);
+  }
+  gumbo_vector_insert_at_scratch(parser, node, index, open_elements);
+  for (unsigned int i = index; i < open_elements->length; ++i) {
+    index_open_element(parser, i);
+  }
+}
+
+static void remove_open_element_at(GumboParser* parser, unsigned int index) {
+  GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  for (unsigned int i = open_elements->length; i-- > index;) {
+    unindex_open_element(parser, i);
+  }
+  gumbo_vector_remove_at(parser, index, open_elements);
+  for (unsigned int i = index; i < open_elements->length; ++i) {
+    index_open_element(parser, i);
+  }
+}
+
+// Puts node in place of the open element at the given index, which has the
+// same tag, so that only its position needs updating.
+static void replace_open_element_at(
+    GumboParser* parser, GumboNode* node, unsigned int index) {
+  GumboParserState* state = parser->_parser_state;
+  const GumboNode* replaced = state->_open_elements.data[index];
+  assert(node->v.element.tag == replaced->v.element.tag &&
+         node->v.element.tag_namespace == replaced->v.element.tag_namespace);
+  node_index_map_remove(&state->_open_element_positions, replaced);
+  state->_open_elements.data[index] = node;
+  node_index_map_set(parser, &state->_open_element_positions, node, index);
+}
+
+// Returns the index of the node on the stack of open elements, or -1.
+static int find_open_element(GumboParser* parser, const GumboNode* node) {
+  return node_index_map_get(
+      &parser->_parser_state->_open_element_positions, node);
+}
+
+static bool is_open_element(GumboParser* parser, const GumboNode* node) {
+  return find_open_element(parser, node) != -1;
+}
+
+static void remove_open_element(GumboParser* parser, const GumboNode* node) {
+  int index = find_open_element(parser, node);
+  if (index != -1) {
+    remove_open_element_at(parser, index);
+  }
+}
+
+static void clear_open_elements(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  state->_open_elements.length = 0;
+  node_index_map_clear(&state->_open_element_positions);
+  for (int i = 0; i < GUMBO_TAG_LAST; ++i) {
+    state->_topmost_with_tag[i] = -1;
+  }
+}
+
+// Resets the per-document fields of the parser state, keeping the capacity of
+// its scratch buffers.
+static void parser_state_reset(GumboParser* parser) {
+  GumboParserState* parser_state = parser->_parser_state;
   parser_state->_insertion_mode = GUMBO_INSERTION_MODE_INITIAL;
   parser_state->_reprocess_current_token = false;
   parser_state->_frameset_ok = true;
   parser_state->_ignore_next_linefeed = false;
   parser_state->_foster_parent_insertions = false;
   parser_state->_text_node._type = GUMBO_NODE_WHITESPACE;
-  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
-  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
-  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
-  gumbo_vector_init(parser, 5, &parser_state->_template_insertion_modes);
+  gumbo_string_buffer_clear(parser, &parser_state->_text_node._buffer);
+  clear_open_elements(parser);
+  parser_state->_active_formatting_elements.length = 0;
+  parser_state->_active_formatting_hashes.length = 0;
+  node_index_map_clear(&parser_state->_active_formatting_positions);
+  hash_count_map_clear(&parser_state->_active_formatting_hash_counts);
+  parser_state->_template_insertion_modes.length = 0;
   parser_state->_head_element = NULL;
   parser_state->_form_element = NULL;
   parser_state->_fragment_ctx = NULL;
+  parser_state->_stale_parent = NULL;
   parser_state->_current_token = NULL;
   parser_state->_closed_body_tag = false;
   parser_state->_closed_html_tag = false;
+  parser_state->_has_error = false;
+  parser_state->_closed_elements.length = 0;
+}
+
+// Allocates the parser state.  This must happen before the parser acquires an
+// arena: the state is scratch state that a GumboParserContext keeps across
+// documents, so none of it may be carved out of the arena of any one output,
+// and its vectors only ever grow with gumbo_vector_add_scratch and
+// gumbo_vector_insert_at_scratch.
+static void parser_state_init(GumboParser* parser) {
+  assert(parser->_arena == NULL);
+  GumboParserState* parser_state =
+      gumbo_scratch_allocate(parser, sizeof(GumboParserState));
+  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
+  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
+  parser_state->_open_element_index_capacity = 10;
+  parser_state->_open_element_index = gumbo_scratch_allocate(parser,
+      sizeof(OpenElementIndex) * parser_state->_open_element_index_capacity);
+  node_index_map_init(parser, &parser_state->_open_element_positions);
+  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
+  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_hashes);
+  node_index_map_init(parser, &parser_state->_active_formatting_positions);
+  hash_count_map_init(parser, &parser_state->_active_formatting_hash_counts);
+  gumbo_vector_init(parser, 5, &parser_state->_template_insertion_modes);
+  gumbo_vector_init(parser, 0, &parser_state->_closed_elements);
+  gumbo_vector_init(parser, 0, &parser_state->_free_nodes);
+  gumbo_vector_init(parser, 0, &parser_state->_error_tag_stack);
   parser->_parser_state = parser_state;
+  parser_state_reset(parser);
 }
 
 static void parser_state_destroy(GumboParser* parser) {
+  assert(parser->_arena == NULL);
   GumboParserState* state = parser->_parser_state;
-  if (state->_fragment_ctx) {
-    destroy_node(parser, state->_fragment_ctx);
-  }
   gumbo_vector_destroy(parser, &state->_active_formatting_elements);
+  gumbo_vector_destroy(parser, &state->_active_formatting_hashes);
+  node_index_map_destroy(parser, &state->_active_formatting_positions);
+  hash_count_map_destroy(parser, &state->_active_formatting_hash_counts);
   gumbo_vector_destroy(parser, &state->_open_elements);
+  gumbo_scratch_deallocate_sized(parser, state->_open_element_index,
+      sizeof(OpenElementIndex) * state->_open_element_index_capacity);
+  node_index_map_destroy(parser, &state->_open_element_positions);
   gumbo_vector_destroy(parser, &state->_template_insertion_modes);
+  assert(state->_closed_elements.length == 0);
+  gumbo_vector_destroy(parser, &state->_closed_elements);
+  for (unsigned int i = 0; i < state->_free_nodes.length; ++i) {
+    gumbo_scratch_deallocate(parser, state->_free_nodes.data[i]);
+  }
+  gumbo_vector_destroy(parser, &state->_free_nodes);
+  gumbo_vector_destroy(parser, &state->_error_tag_stack);
   gumbo_string_buffer_destroy(parser, &state->_text_node._buffer);
-  gumbo_parser_deallocate(parser, state);
+  gumbo_scratch_deallocate(parser, state);
 }
 
 static GumboNode* get_document_node(GumboParser* parser) {
@@ -642,14 +1176,13 @@ static void reset_insertion_mode_appropriately(GumboParser* parser) {
   assert(0);
 }
 
-static GumboError* parser_add_parse_error(
-    GumboParser* parser, const GumboToken* token) {
-  gumbo_debug("Adding parse error.\n");
-  GumboError* error = gumbo_add_error(parser);
+static void add_tree_construction_error(
+    GumboParser* parser, const GumboToken* token, GumboErrorType type) {
+  gumbo_debug(parser, "Adding parse error.\n");
+  GumboError* error = gumbo_add_error(parser, type);
   if (!error) {
-    return NULL;
+    return;
   }
-  error->type = GUMBO_ERR_PARSER;
   error->position = token->position;
   error->original_text = token->original_text.data;
   GumboParserError* extra_data = &error->v.parser;
@@ -662,16 +1195,32 @@ static GumboError* parser_add_parse_error(
   }
   GumboParserState* state = parser->_parser_state;
   extra_data->parser_state = state->_insertion_mode;
-  gumbo_vector_init(
-      parser, state->_open_elements.length, &extra_data->tag_stack);
+  // An error that's only reported borrows a scratch tag stack that's reused
+  // for every error, rather than getting one of its own.
+  bool is_transient = parser->_options->error_handler != NULL;
+  GumboVector* tag_stack =
+      is_transient ? &state->_error_tag_stack : &extra_data->tag_stack;
+  if (is_transient) {
+    tag_stack->length = 0;
+  } else {
+    gumbo_vector_init(parser, state->_open_elements.length, tag_stack);
+  }
+  // The error's own tag stack is presized, so only the scratch one ever grows.
   for (unsigned int i = 0; i < state->_open_elements.length; ++i) {
     const GumboNode* node = state->_open_elements.data[i];
     assert(
         node->type == GUMBO_NODE_ELEMENT || node->type == GUMBO_NODE_TEMPLATE);
-    gumbo_vector_add(
-        parser, (void*) node->v.element.tag, &extra_data->tag_stack);
+    gumbo_vector_add_scratch(parser, (void*) node->v.element.tag, tag_stack);
   }
-  return error;
+  if (is_transient) {
+    extra_data->tag_stack = *tag_stack;
+  }
+  gumbo_finish_error(parser, error);
+}
+
+static void parser_add_parse_error(
+    GumboParser* parser, const GumboToken* token) {
+  add_tree_construction_error(parser, token, GUMBO_ERR_PARSER);
 }
 
 // Returns true if the specified token is either a start or end tag (specified
@@ -728,7 +1277,7 @@ static bool node_html_tag_is(const GumboNode* node, GumboTag tag) {
 
 static void push_template_insertion_mode(
     GumboParser* parser, GumboInsertionMode mode) {
-  gumbo_vector_add(
+  gumbo_vector_add_scratch(
       parser, (void*) mode, &parser->_parser_state->_template_insertion_modes);
 }
 
@@ -816,7 +1365,7 @@ InsertionLocation get_appropriate_insertion_location(
   GumboNode* last_table = open_elements->data[last_table_index];
   if (last_table->parent != NULL) {
     retval.target = last_table->parent;
-    retval.index = last_table->index_within_parent;
+    retval.index = get_index_within_parent(parser, last_table);
     return retval;
   }
 
@@ -824,28 +1373,196 @@ InsertionLocation get_appropriate_insertion_location(
   return retval;
 }
 
-// Appends a node to the end of its parent, setting the "parent" and
-// "index_within_parent" fields appropriately.
-static void append_node(
-    GumboParser* parser, GumboNode* parent, GumboNode* node) {
-  assert(node->parent == NULL);
-  assert(node->index_within_parent == -1);
-  GumboVector* children;
+static bool is_reporting_events(const GumboParser* parser) {
+  return parser->_options->event_handler != NULL;
+}
+
+static GumboVector* get_children(GumboNode* parent) {
   if (parent->type == GUMBO_NODE_ELEMENT ||
       parent->type == GUMBO_NODE_TEMPLATE) {
-    children = &parent->v.element.children;
+    return &parent->v.element.children;
+  }
+  assert(parent->type == GUMBO_NODE_DOCUMENT);
+  return &parent->v.document.children;
+}
+
+// Brings the index_within_parent fields of every node up to date.
+static void update_child_indices(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  if (!state->_stale_parent) {
+    return;
+  }
+  GumboVector* children = get_children(state->_stale_parent);
+  for (unsigned int i = state->_stale_child_index; i < children->length; ++i) {
+    GumboNode* child = children->data[i];
+    child->index_within_parent = i;
+  }
+  state->_stale_parent = NULL;
+}
+
+// Notes that the children of parent from index on may have moved.  Only one
+// node's children are left stale at a time, so this updates those of any other.
+static void mark_child_indices_stale(
+    GumboParser* parser, GumboNode* parent, unsigned int index) {
+  GumboParserState* state = parser->_parser_state;
+  if (state->_stale_parent != parent) {
+    update_child_indices(parser);
+    state->_stale_parent = parent;
+    state->_stale_child_index = index;
+  } else if (index < state->_stale_child_index) {
+    state->_stale_child_index = index;
+  }
+}
+
+// Returns the index of a node within its parent's children, which is only
+// worth bringing the indices up to date for if the node has moved.
+static unsigned int get_index_within_parent(
+    GumboParser* parser, const GumboNode* node) {
+  assert(node->parent);
+  const GumboVector* children = get_children(node->parent);
+  size_t index = node->index_within_parent;
+  if (index >= children->length || children->data[index] != node) {
+    assert(node->parent == parser->_parser_state->_stale_parent);
+    update_child_indices(parser);
+  }
+  assert(children->data[node->index_within_parent] == node);
+  return node->index_within_parent;
+}
+
+// Returns the event handler that should hear about changes to the tree right
+// now, or NULL if there is none.  Since the handler may look at the tree, this
+// brings its indices up to date first.
+static const GumboEventHandler* get_event_handler(GumboParser* parser) {
+  update_child_indices(parser);
+  return parser->_options->event_handler;
+}
+
+// Returns the inline storage of a node's children, or NULL for the document,
+// which has none.
+static void** get_inline_children(GumboNode* parent) {
+  if (parent->type == GUMBO_NODE_ELEMENT ||
+      parent->type == GUMBO_NODE_TEMPLATE) {
+    return parent->v.element._inline_children;
+  }
+  return NULL;
+}
+
+static void remove_from_parent(GumboParser* parser, GumboNode* node) {
+  if (!node->parent) {
+    // The node may not have a parent if, for example, it is a newly-cloned copy
+    // of an active formatting element.  DOM manipulations continue with the
+    // orphaned fragment of the DOM tree until it's appended/foster-parented to
+    // the common ancestor at the end of the adoption agency algorithm.
+    return;
+  }
+  GumboVector* children = get_children(node->parent);
+  unsigned int index = get_index_within_parent(parser, node);
+  gumbo_vector_remove_at(parser, index, children);
+  if (index < children->length) {
+    mark_child_indices_stale(parser, node->parent, index);
+  }
+  if (node->prev_sibling) {
+    node->prev_sibling->next_sibling = node->next_sibling;
+  } else {
+    node->parent->first_child = node->next_sibling;
+  }
+  if (node->next_sibling) {
+    node->next_sibling->prev_sibling = node->prev_sibling;
+  } else {
+    node->parent->last_child = node->prev_sibling;
+  }
+  node->parent = NULL;
+  node->index_within_parent = -1;
+  node->prev_sibling = NULL;
+  node->next_sibling = NULL;
+}
+
+// Moves all the children of an element to another that has none, setting their
+// "parent" fields but not reporting them.
+static void move_children(GumboParser* parser, GumboNode* from, GumboNode* to) {
+  GumboVector* from_children = &from->v.element.children;
+  GumboVector* to_children = &to->v.element.children;
+  assert(to_children->length == 0);
+  // The children keep their positions, stale or not.
+  GumboParserState* state = parser->_parser_state;
+  if (state->_stale_parent == from) {
+    state->_stale_parent = to;
+  }
+  if (from_children->data == from->v.element._inline_children) {
+    // Children in inline storage have to be copied, but they fit in any
+    // element's.
+    memcpy(to_children->data, from_children->data,
+        sizeof(void*) * from_children->length);
+    to_children->length = from_children->length;
   } else {
-    assert(parent->type == GUMBO_NODE_DOCUMENT);
-    children = &parent->v.document.children;
+    // An allocated array is simply handed over.
+    gumbo_vector_destroy_inline(
+        parser, to->v.element._inline_children, to_children);
+    *to_children = *from_children;
   }
+  gumbo_vector_init_inline(
+      from->v.element._inline_children, GUMBO_INLINE_CHILDREN, from_children);
+  to->first_child = from->first_child;
+  to->last_child = from->last_child;
+  from->first_child = NULL;
+  from->last_child = NULL;
+  for (unsigned int i = 0; i < to_children->length; ++i) {
+    GumboNode* child = to_children->data[i];
+    child->parent = to;
+  }
+}
+
+// Tells the event handler, if there is one, that node has been inserted into
+// its parent.  Other than elements, nodes are of no further use to the parser
+// at that point, so they're recycled right away.
+static void report_insertion(
+    GumboParser* parser, GumboNode* node, const GumboNode* next_sibling) {
+  if (!is_reporting_events(parser)) {
+    return;
+  }
+  const GumboEventHandler* handler = get_event_handler(parser);
+  if (handler && handler->insert_node) {
+    handler->insert_node(handler->userdata, node, next_sibling);
+  }
+  if (node->type != GUMBO_NODE_ELEMENT && node->type != GUMBO_NODE_TEMPLATE) {
+    remove_from_parent(parser, node);
+    recycle_node(parser, node);
+  }
+}
+
+// Appends a node to the end of its parent, setting the "parent" and
+// "index_within_parent" fields appropriately, without reporting it.
+static void append_unreported_node(
+    GumboParser* parser, GumboNode* parent, GumboNode* node) {
+  assert(node->parent == NULL);
+  assert(node->index_within_parent == -1);
+  GumboVector* children = get_children(parent);
   node->parent = parent;
   node->index_within_parent = children->length;
-  gumbo_vector_add(parser, (void*) node, children);
+  gumbo_vector_add_inline(
+      parser, (void*) node, get_inline_children(parent), children);
   assert(node->index_within_parent < children->length);
+  node->prev_sibling = parent->last_child;
+  node->next_sibling = NULL;
+  if (parent->last_child) {
+    parent->last_child->next_sibling = node;
+  } else {
+    parent->first_child = node;
+  }
+  parent->last_child = node;
+}
+
+// Appends a node to the end of its parent, setting the "parent" and
+// "index_within_parent" fields appropriately.
+static void append_node(
+    GumboParser* parser, GumboNode* parent, GumboNode* node) {
+  append_unreported_node(parser, parent, node);
+  report_insertion(parser, node, NULL);
 }
 
 // Inserts a node at the specified InsertionLocation, updating the
-// "parent" and "index_within_parent" fields of it and all its siblings.
+// "parent" and "index_within_parent" fields of it, and leaving those of its
+// following siblings to update_child_indices.
 // If the index of the location is -1, this calls append_node.
 static void insert_node(
     GumboParser* parser, GumboNode* node, InsertionLocation location) {
@@ -869,13 +1586,20 @@ static void insert_node(
     assert((unsigned int) index < children->length);
     node->parent = parent;
     node->index_within_parent = index;
-    gumbo_vector_insert_at(parser, (void*) node, index, children);
+    gumbo_vector_insert_at_inline(parser, (void*) node, index,
+        get_inline_children(parent), children);
     assert(node->index_within_parent < children->length);
-    for (unsigned int i = index + 1; i < children->length; ++i) {
-      GumboNode* sibling = children->data[i];
-      sibling->index_within_parent = i;
-      assert(sibling->index_within_parent < children->length);
+    mark_child_indices_stale(parser, parent, index + 1);
+    GumboNode* next_sibling = children->data[index + 1];
+    node->prev_sibling = next_sibling->prev_sibling;
+    node->next_sibling = next_sibling;
+    if (next_sibling->prev_sibling) {
+      next_sibling->prev_sibling->next_sibling = node;
+    } else {
+      parent->first_child = node;
     }
+    next_sibling->prev_sibling = node;
+    report_insertion(parser, node, next_sibling);
   } else {
     append_node(parser, parent, node);
   }
@@ -893,15 +1617,25 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
          buffer_state->_type == GUMBO_NODE_CDATA);
   GumboNode* text_node = create_node(parser, buffer_state->_type);
   GumboText* text_node_data = &text_node->v.text;
-  text_node_data->text =
-      gumbo_string_buffer_to_string(parser, &buffer_state->_buffer);
+  const GumboStringBuffer* buffer = &buffer_state->_buffer;
   text_node_data->original_text.data = buffer_state->_start_original_text;
   text_node_data->original_text.length =
       state->_current_token->original_text.data -
       buffer_state->_start_original_text;
   text_node_data->start_pos = buffer_state->_start_position;
+  text_node_data->length = buffer->length;
+  if (parser->_options->borrow_text &&
+      buffer->length == text_node_data->original_text.length &&
+      memcmp(buffer->data, text_node_data->original_text.data,
+          buffer->length) == 0) {
+    // Nothing was decoded, dropped, or normalized, so the source will do.
+    text_node_data->text = text_node_data->original_text.data;
+  } else {
+    text_node_data->text =
+        gumbo_string_buffer_to_string(parser, &buffer_state->_buffer);
+  }
 
-  gumbo_debug("Flushing text node buffer of %.*s.\n",
+  gumbo_debug(parser, "Flushing text node buffer of %.*s.\n",
       (int) buffer_state->_buffer.length, buffer_state->_buffer.data);
 
   InsertionLocation location = get_appropriate_insertion_location(parser, NULL);
@@ -926,15 +1660,90 @@ static void record_end_of_element(
                                   : kGumboEmptyString;
 }
 
+// Tells the event handler, if there is one, that node has left the stack of
+// open elements, and queues it up to be recycled once nothing refers to it
+// anymore.  The head element pointer keeps <head> around until the end of the
+// parse, so it isn't queued.
+static void close_element(GumboParser* parser, GumboNode* node) {
+  if (!is_reporting_events(parser)) {
+    return;
+  }
+  GumboParserState* state = parser->_parser_state;
+  const GumboEventHandler* handler = get_event_handler(parser);
+  if (handler && handler->pop_element) {
+    handler->pop_element(handler->userdata, node);
+  }
+  if (node != state->_head_element) {
+    gumbo_vector_add_scratch(parser, node, &state->_closed_elements);
+  }
+}
+
+// Recycles the closed elements that nothing refers to anymore: those that
+// aren't in the list of active formatting elements or the form element pointer,
+// and have no children left.  Those that are still referred to are taken out
+// of the tree, which the parser no longer needs them in, so as not to keep
+// their parents around.  This is only safe between tokens, when no part of the
+// tree construction algorithm is holding on to a node.
+static void recycle_closed_elements(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* closed_elements = &state->_closed_elements;
+  unsigned int num_kept = 0;
+  for (unsigned int i = 0; i < closed_elements->length; ++i) {
+    GumboNode* node = closed_elements->data[i];
+    if (node == state->_form_element ||
+        node_index_map_get(&state->_active_formatting_positions, node) != -1) {
+      remove_from_parent(parser, node);
+      closed_elements->data[num_kept++] = node;
+    } else if (node->v.element.children.length > 0) {
+      closed_elements->data[num_kept++] = node;
+    } else {
+      remove_from_parent(parser, node);
+      recycle_node(parser, node);
+    }
+  }
+  closed_elements->length = num_kept;
+}
+
+// Recycles everything that the parser still holds on to at the end of a
+// reported parse, or when one is abandoned, leaving just the document node.
+static void recycle_remaining_nodes(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* closed_elements = &state->_closed_elements;
+  for (unsigned int i = 0; i < state->_open_elements.length; ++i) {
+    GumboNode* node = state->_open_elements.data[i];
+    if (node != state->_head_element) {
+      gumbo_vector_add_scratch(parser, node, closed_elements);
+    }
+  }
+  clear_open_elements(parser);
+  if (state->_head_element) {
+    gumbo_vector_add_scratch(parser, state->_head_element, closed_elements);
+    state->_head_element = NULL;
+  }
+  state->_form_element = NULL;
+  state->_active_formatting_elements.length = 0;
+  state->_active_formatting_hashes.length = 0;
+  node_index_map_clear(&state->_active_formatting_positions);
+  hash_count_map_clear(&state->_active_formatting_hash_counts);
+  parser->_output->root = NULL;
+  // Each pass recycles at least the innermost of the elements left.
+  unsigned int num_left;
+  do {
+    num_left = closed_elements->length;
+    recycle_closed_elements(parser);
+  } while (closed_elements->length > 0 && closed_elements->length < num_left);
+  assert(closed_elements->length == 0);
+}
+
 static GumboNode* pop_current_node(GumboParser* parser) {
   GumboParserState* state = parser->_parser_state;
   maybe_flush_text_node_buffer(parser);
   if (state->_open_elements.length > 0) {
     assert(node_html_tag_is(state->_open_elements.data[0], GUMBO_TAG_HTML));
-    gumbo_debug("Popping %s node.\n",
+    gumbo_debug(parser, "Popping %s node.\n",
         gumbo_normalized_tagname(get_current_node(parser)->v.element.tag));
   }
-  GumboNode* current_node = gumbo_vector_pop(parser, &state->_open_elements);
+  GumboNode* current_node = pop_open_element(parser);
   if (!current_node) {
     assert(state->_open_elements.length == 0);
     return NULL;
@@ -954,6 +1763,7 @@ static GumboNode* pop_current_node(GumboParser* parser) {
   if (!is_closed_body_or_html_tag) {
     record_end_of_element(state->_current_token, &current_node->v.element);
   }
+  close_element(parser, current_node);
   return current_node;
 }
 
@@ -964,6 +1774,7 @@ static void append_comment_node(
   comment->type = GUMBO_NODE_COMMENT;
   comment->parse_flags = GUMBO_INSERTION_NORMAL;
   comment->v.text.text = token->v.text;
+  comment->v.text.length = strlen(token->v.text);
   comment->v.text.original_text = token->original_text;
   comment->v.text.start_pos = token->position;
   append_node(parser, node, comment);
@@ -998,8 +1809,10 @@ void clear_stack_to_table_body_context(GumboParser* parser) {
 static GumboNode* create_element(GumboParser* parser, GumboTag tag) {
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
-  gumbo_vector_init(parser, 0, &element->attributes);
+  gumbo_vector_init_inline(
+      element->_inline_children, GUMBO_INLINE_CHILDREN, &element->children);
+  gumbo_vector_init_inline(element->_inline_attributes,
+      GUMBO_INLINE_ATTRIBUTES, &element->attributes);
   element->tag = tag;
   element->tag_namespace = GUMBO_NAMESPACE_HTML;
   element->original_tag = kGumboEmptyString;
@@ -1024,8 +1837,11 @@ static GumboNode* create_element_from_token(
 
   GumboNode* node = create_node(parser, type);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
-  element->attributes = start_tag->attributes;
+  gumbo_vector_init_inline(
+      element->_inline_children, GUMBO_INLINE_CHILDREN, &element->children);
+  // The element takes ownership of the attributes from the token.
+  gumbo_token_move_attributes(
+      parser, token, element->_inline_attributes, &element->attributes);
   element->tag = start_tag->tag;
   element->tag_namespace = tag_namespace;
 
@@ -1036,17 +1852,12 @@ static GumboNode* create_element_from_token(
   element->start_pos = token->position;
   element->original_end_tag = kGumboEmptyString;
   element->end_pos = kGumboEmptySourcePosition;
-
-  // The element takes ownership of the attributes from the token, so any
-  // allocated-memory fields should be nulled out.
-  start_tag->attributes = kGumboEmptyVector;
   return node;
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#insert-an-html-element
 static void insert_element(GumboParser* parser, GumboNode* node,
     bool is_reconstructing_formatting_elements) {
-  GumboParserState* state = parser->_parser_state;
   // NOTE(jdtang): The text node buffer must always be flushed before inserting
   // a node, otherwise we're handling nodes in a different order than the spec
   // mandated.  However, one clause of the spec (character tokens in the body)
@@ -1061,7 +1872,7 @@ static void insert_element(GumboParser* parser, GumboNode* node,
   }
   InsertionLocation location = get_appropriate_insertion_location(parser, NULL);
   insert_node(parser, node, location);
-  gumbo_vector_add(parser, (void*) node, &state->_open_elements);
+  push_open_element(parser, node);
 }
 
 // Convenience method that combines create_element_from_token and
@@ -1072,7 +1883,7 @@ static GumboNode* insert_element_from_token(
   GumboNode* element =
       create_element_from_token(parser, token, GUMBO_NAMESPACE_HTML);
   insert_element(parser, element, false);
-  gumbo_debug("Inserting <%s> element (@%x) from token.\n",
+  gumbo_debug(parser, "Inserting <%s> element (@%x) from token.\n",
       gumbo_normalized_tagname(element->v.element.tag), element);
   return element;
 }
@@ -1085,7 +1896,7 @@ static GumboNode* insert_element_of_tag_type(
   GumboNode* element = create_element(parser, tag);
   element->parse_flags |= GUMBO_INSERTION_BY_PARSER | reason;
   insert_element(parser, element, false);
-  gumbo_debug("Inserting %s element (@%x) from tag type.\n",
+  gumbo_debug(parser, "Inserting %s element (@%x) from tag type.\n",
       gumbo_normalized_tagname(tag), element);
   return element;
 }
@@ -1129,7 +1940,38 @@ static void insert_text_token(GumboParser* parser, GumboToken* token) {
   } else if (token->type == GUMBO_TOKEN_CDATA) {
     buffer_state->_type = GUMBO_NODE_CDATA;
   }
-  gumbo_debug("Inserting text token '%c'.\n", token->v.character);
+  gumbo_debug(parser, "Inserting text token '%c'.\n", token->v.character);
+}
+
+// Like insert_text_token, for a GUMBO_TOKEN_CHARACTER_RUN.  The text of a run is
+// its original_text, verbatim.  Returns true if the run contains anything other
+// than whitespace, which is what decides between the CHARACTER and WHITESPACE
+// handling of each of its characters.
+static bool insert_text_run(GumboParser* parser, GumboToken* token) {
+  assert(token->type == GUMBO_TOKEN_CHARACTER_RUN);
+  TextNodeBufferState* buffer_state = &parser->_parser_state->_text_node;
+  if (buffer_state->_buffer.length == 0) {
+    buffer_state->_start_original_text = token->original_text.data;
+    buffer_state->_start_position = token->position;
+  }
+  gumbo_string_buffer_append_string(
+      parser, &token->original_text, &buffer_state->_buffer);
+  gumbo_debug(parser, "Inserting text run '%.*s'.\n",
+      (int) token->original_text.length, token->original_text.data);
+
+  for (size_t i = 0; i < token->original_text.length; ++i) {
+    switch (token->original_text.data[i]) {
+      case '\t':
+      case '\n':
+      case '\f':
+      case ' ':
+        continue;
+      default:
+        buffer_state->_type = GUMBO_NODE_TEXT;
+        return true;
+    }
+  }
+  return false;
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#generic-rcdata-element-parsing-algorithm
@@ -1163,14 +2005,181 @@ static bool find_last_anchor_index(GumboParser* parser, int* anchor_index) {
   return false;
 }
 
+// Returns a hash of the tag, namespace, and attributes of a formatting element,
+// which is the same for any two elements that the Noah's Ark clause counts as
+// identical.  Attributes are combined independently of their order.
+static unsigned int formatting_element_hash(const GumboNode* node) {
+  if (node == &kActiveFormattingScopeMarker) {
+    return 0;
+  }
+  const GumboElement* element = &node->v.element;
+  unsigned int hash = element->tag * 31u + element->tag_namespace;
+  for (unsigned int i = 0; i < element->attributes.length; ++i) {
+    const GumboAttribute* attr = element->attributes.data[i];
+    // FNV-1a over the name and value, with the name's terminating NUL as a
+    // separator.
+    unsigned int attr_hash = 2166136261u;
+    for (const char* c = attr->name; ; ++c) {
+      attr_hash = (attr_hash ^ (unsigned char) *c) * 16777619u;
+      if (!*c) {
+        break;
+      }
+    }
+    for (const char* c = attr->value; *c; ++c) {
+      attr_hash = (attr_hash ^ (unsigned char) *c) * 16777619u;
+    }
+    hash += attr_hash;
+  }
+  return hash;
+}
+
+static unsigned int get_formatting_element_hash(
+    const GumboParserState* state, int index) {
+  return (unsigned int) (uintptr_t) state->_active_formatting_hashes.data[index];
+}
+
+// Records the index of each entry of the list of active formatting elements
+// from the given one up, after they've moved.
+static void index_formatting_elements_from(GumboParser* parser, int index) {
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* elements = &state->_active_formatting_elements;
+  for (unsigned int i = index; i < elements->length; ++i) {
+    const GumboNode* node = elements->data[i];
+    if (node != &kActiveFormattingScopeMarker) {
+      node_index_map_set(
+          parser, &state->_active_formatting_positions, node, i);
+    }
+  }
+}
+
+static void unindex_formatting_element(
+    GumboParser* parser, const GumboNode* node) {
+  if (node != &kActiveFormattingScopeMarker) {
+    node_index_map_remove(
+        &parser->_parser_state->_active_formatting_positions, node);
+  }
+}
+
+// Adds a node to the end of the list of active formatting elements, without the
+// Noah's Ark clause; see add_formatting_element.
+static void push_formatting_element(
+    GumboParser* parser, const GumboNode* node, unsigned int hash) {
+  GumboParserState* state = parser->_parser_state;
+  gumbo_vector_add_scratch(
+      parser, (void*) node, &state->_active_formatting_elements);
+  gumbo_vector_add_scratch(
+      parser, (void*) (uintptr_t) hash, &state->_active_formatting_hashes);
+  index_formatting_elements_from(
+      parser, state->_active_formatting_elements.length - 1);
+  if (node != &kActiveFormattingScopeMarker) {
+    hash_count_map_increment(
+        parser, &state->_active_formatting_hash_counts, hash);
+  }
+}
+
+static void insert_formatting_element_at(
+    GumboParser* parser, GumboNode* node, int index) {
+  GumboParserState* state = parser->_parser_state;
+  unsigned int hash = formatting_element_hash(node);
+  gumbo_vector_insert_at_scratch(
+      parser, node, index, &state->_active_formatting_elements);
+  gumbo_vector_insert_at_scratch(parser, (void*) (uintptr_t) hash, index,
+      &state->_active_formatting_hashes);
+  index_formatting_elements_from(parser, index);
+  hash_count_map_increment(
+      parser, &state->_active_formatting_hash_counts, hash);
+}
+
+static GumboNode* remove_formatting_element_at(
+    GumboParser* parser, int index) {
+  GumboParserState* state = parser->_parser_state;
+  unsigned int hash = (unsigned int) (uintptr_t) gumbo_vector_remove_at(
+      parser, index, &state->_active_formatting_hashes);
+  GumboNode* node = gumbo_vector_remove_at(
+      parser, index, &state->_active_formatting_elements);
+  unindex_formatting_element(parser, node);
+  index_formatting_elements_from(parser, index);
+  if (node != &kActiveFormattingScopeMarker) {
+    hash_count_map_decrement(&state->_active_formatting_hash_counts, hash);
+  }
+  return node;
+}
+
+// Drops count entries, none of them scope markers, from the list of active
+// formatting elements, starting at the given index.
+static void remove_formatting_elements_at(
+    GumboParser* parser, int index, unsigned int count) {
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* elements = &state->_active_formatting_elements;
+  GumboVector* hashes = &state->_active_formatting_hashes;
+  assert(index + count <= elements->length);
+  for (unsigned int i = index; i < index + count; ++i) {
+    unindex_formatting_element(parser, elements->data[i]);
+    hash_count_map_decrement(&state->_active_formatting_hash_counts,
+        get_formatting_element_hash(state, i));
+  }
+  unsigned int num_moved = elements->length - index - count;
+  memmove(&elements->data[index], &elements->data[index + count],
+      sizeof(void*) * num_moved);
+  memmove(&hashes->data[index], &hashes->data[index + count],
+      sizeof(void*) * num_moved);
+  elements->length -= count;
+  hashes->length -= count;
+  index_formatting_elements_from(parser, index);
+}
+
+// Puts node in place of the entry at the given index, which it's a clone of, so
+// that the entry's hash still holds.
+static void replace_formatting_element_at(
+    GumboParser* parser, GumboNode* node, int index) {
+  GumboParserState* state = parser->_parser_state;
+  unindex_formatting_element(
+      parser, state->_active_formatting_elements.data[index]);
+  state->_active_formatting_elements.data[index] = node;
+  node_index_map_set(
+      parser, &state->_active_formatting_positions, node, index);
+}
+
+// Returns the index of the node in the list of active formatting elements, or
+// -1.
+static int find_formatting_element(
+    GumboParser* parser, const GumboNode* node) {
+  return node_index_map_get(
+      &parser->_parser_state->_active_formatting_positions, node);
+}
+
+static void remove_formatting_element(GumboParser* parser, GumboNode* node) {
+  int index = find_formatting_element(parser, node);
+  if (index != -1) {
+    remove_formatting_element_at(parser, index);
+  }
+}
+
+static const GumboNode* pop_formatting_element(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  unsigned int hash = (unsigned int) (uintptr_t) gumbo_vector_pop(
+      parser, &state->_active_formatting_hashes);
+  const GumboNode* node =
+      gumbo_vector_pop(parser, &state->_active_formatting_elements);
+  if (node && node != &kActiveFormattingScopeMarker) {
+    unindex_formatting_element(parser, node);
+    hash_count_map_decrement(&state->_active_formatting_hash_counts, hash);
+  }
+  return node;
+}
+
 // Counts the number of open formatting elements in the list of active
-// formatting elements (after the last active scope marker) that have a specific
-// tag.  If this is > 0, then earliest_matching_index will be filled in with the
-// index of the first such element.
+// formatting elements (after the last active scope marker) that are identical
+// to desired_node, whose formatting_element_hash is desired_hash.  If this is
+// > 0, then earliest_matching_index will be filled in with the index of the
+// first such element.
 static int count_formatting_elements_of_tag(GumboParser* parser,
-    const GumboNode* desired_node, int* earliest_matching_index) {
+    const GumboNode* desired_node, unsigned int desired_hash,
+    int* earliest_matching_index) {
   const GumboElement* desired_element = &desired_node->v.element;
-  GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* elements = &state->_active_formatting_elements;
+  assert(state->_active_formatting_hashes.length == elements->length);
   int num_identical_elements = 0;
   for (int i = elements->length; --i >= 0;) {
     GumboNode* node = elements->data[i];
@@ -1178,7 +2187,8 @@ static int count_formatting_elements_of_tag(GumboParser* parser,
       break;
     }
     assert(node->type == GUMBO_NODE_ELEMENT);
-    if (node_qualified_tag_is(
+    if (get_formatting_element_hash(state, i) == desired_hash &&
+        node_qualified_tag_is(
             node, desired_element->tag_namespace, desired_element->tag) &&
         all_attributes_match(
             &node->v.element.attributes, &desired_element->attributes)) {
@@ -1195,34 +2205,30 @@ static void add_formatting_element(GumboParser* parser, const GumboNode* node) {
          node->type == GUMBO_NODE_ELEMENT);
   GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
   if (node == &kActiveFormattingScopeMarker) {
-    gumbo_debug("Adding a scope marker.\n");
-  } else {
-    gumbo_debug("Adding a formatting element.\n");
+    gumbo_debug(parser, "Adding a scope marker.\n");
+    push_formatting_element(parser, node, 0);
+    return;
   }
+  gumbo_debug(parser, "Adding a formatting element.\n");
 
-  // Hunt for identical elements.
+  // Hunt for identical elements, if there can be enough of them to matter.
+  unsigned int hash = formatting_element_hash(node);
   int earliest_identical_element = elements->length;
-  int num_identical_elements = count_formatting_elements_of_tag(
-      parser, node, &earliest_identical_element);
+  int num_identical_elements = 0;
+  if (hash_count_map_get(
+          &parser->_parser_state->_active_formatting_hash_counts, hash) >= 3) {
+    num_identical_elements = count_formatting_elements_of_tag(
+        parser, node, hash, &earliest_identical_element);
+  }
 
   // Noah's Ark clause: if there're at least 3, remove the earliest.
   if (num_identical_elements >= 3) {
-    gumbo_debug("Noah's ark clause: removing element at %d.\n",
+    gumbo_debug(parser, "Noah's ark clause: removing element at %d.\n",
         earliest_identical_element);
-    gumbo_vector_remove_at(parser, earliest_identical_element, elements);
+    remove_formatting_element_at(parser, earliest_identical_element);
   }
 
-  gumbo_vector_add(parser, (void*) node, elements);
-}
-
-static bool is_open_element(GumboParser* parser, const GumboNode* node) {
-  GumboVector* open_elements = &parser->_parser_state->_open_elements;
-  for (unsigned int i = 0; i < open_elements->length; ++i) {
-    if (open_elements->data[i] == node) {
-      return true;
-    }
-  }
-  return false;
+  push_formatting_element(parser, node, hash);
 }
 
 // Clones attributes, tags, etc. of a node, but does not copy the content.  The
@@ -1231,27 +2237,38 @@ static bool is_open_element(GumboParser* parser, const GumboNode* node) {
 GumboNode* clone_node(
     GumboParser* parser, GumboNode* node, GumboParseFlags reason) {
   assert(node->type == GUMBO_NODE_ELEMENT || node->type == GUMBO_NODE_TEMPLATE);
-  GumboNode* new_node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* new_node = allocate_node(parser);
   *new_node = *node;
   new_node->parent = NULL;
   new_node->index_within_parent = -1;
+  new_node->first_child = NULL;
+  new_node->last_child = NULL;
+  new_node->prev_sibling = NULL;
+  new_node->next_sibling = NULL;
   // Clear the GUMBO_INSERTION_IMPLICIT_END_TAG flag, as the cloned node may
   // have a separate end tag.
   new_node->parse_flags &= ~GUMBO_INSERTION_IMPLICIT_END_TAG;
   new_node->parse_flags |= reason | GUMBO_INSERTION_BY_PARSER;
   GumboElement* element = &new_node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  gumbo_vector_init_inline(
+      element->_inline_children, GUMBO_INLINE_CHILDREN, &element->children);
 
   const GumboVector* old_attributes = &node->v.element.attributes;
-  gumbo_vector_init(parser, old_attributes->length, &element->attributes);
+  if (old_attributes->length <= GUMBO_INLINE_ATTRIBUTES) {
+    gumbo_vector_init_inline(element->_inline_attributes,
+        GUMBO_INLINE_ATTRIBUTES, &element->attributes);
+  } else {
+    gumbo_vector_init(parser, old_attributes->length, &element->attributes);
+  }
   for (unsigned int i = 0; i < old_attributes->length; ++i) {
     const GumboAttribute* old_attr = old_attributes->data[i];
     GumboAttribute* attr =
-        gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+        gumbo_parser_allocate_object(parser, GUMBO_POOLED_ATTRIBUTE);
     *attr = *old_attr;
     attr->name = gumbo_copy_stringz(parser, old_attr->name);
     attr->value = gumbo_copy_stringz(parser, old_attr->value);
-    gumbo_vector_add(parser, attr, &element->attributes);
+    gumbo_vector_add_inline(
+        parser, attr, element->_inline_attributes, &element->attributes);
   }
   return new_node;
 }
@@ -1288,7 +2305,18 @@ static void reconstruct_active_formatting_elements(GumboParser* parser) {
            !is_open_element(parser, element));
 
   ++i;
-  gumbo_debug("Reconstructing elements from %d on %s parent.\n", i,
+  int max_reconstructed =
+      parser->_options->max_reconstructed_formatting_elements;
+  if (max_reconstructed >= 0 &&
+      elements->length - i > (unsigned int) max_reconstructed) {
+    unsigned int num_dropped = elements->length - i - max_reconstructed;
+    gumbo_debug(parser, "Dropping %u formatting elements.\n", num_dropped);
+    remove_formatting_elements_at(parser, i, num_dropped);
+    if (i == elements->length) {
+      return;
+    }
+  }
+  gumbo_debug(parser, "Reconstructing elements from %d on %s parent.\n", i,
       gumbo_normalized_tagname(get_current_node(parser)->v.element.tag));
   for (; i < elements->length; ++i) {
     // Step 7 & 8.
@@ -1302,25 +2330,23 @@ static void reconstruct_active_formatting_elements(GumboParser* parser) {
     InsertionLocation location =
         get_appropriate_insertion_location(parser, NULL);
     insert_node(parser, clone, location);
-    gumbo_vector_add(
-        parser, (void*) clone, &parser->_parser_state->_open_elements);
+    push_open_element(parser, clone);
 
     // Step 10.
-    elements->data[i] = clone;
-    gumbo_debug("Reconstructed %s element at %d.\n",
+    replace_formatting_element_at(parser, clone, i);
+    gumbo_debug(parser, "Reconstructed %s element at %d.\n",
         gumbo_normalized_tagname(clone->v.element.tag), i);
   }
 }
 
 static void clear_active_formatting_elements(GumboParser* parser) {
-  GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
   int num_elements_cleared = 0;
   const GumboNode* node;
   do {
-    node = gumbo_vector_pop(parser, elements);
+    node = pop_formatting_element(parser);
     ++num_elements_cleared;
   } while (node && node != &kActiveFormattingScopeMarker);
-  gumbo_debug("Cleared %d elements from active formatting list.\n",
+  gumbo_debug(parser, "Cleared %d elements from active formatting list.\n",
       num_elements_cleared);
 }
 
@@ -1359,116 +2385,77 @@ static GumboQuirksModeEnum compute_quirks_mode(
 // from the rest of the document. Note that because of the way the spec is
 // written,
 // all elements are expected to be in the HTML namespace
-static bool has_an_element_in_specific_scope(GumboParser* parser,
-    int expected_size, const GumboTag* expected, bool negate,
-    const gumbo_tagset tags) {
-  GumboVector* open_elements = &parser->_parser_state->_open_elements;
-  for (int i = open_elements->length; --i >= 0;) {
-    const GumboNode* node = open_elements->data[i];
-    if (node->type != GUMBO_NODE_ELEMENT && node->type != GUMBO_NODE_TEMPLATE)
-      continue;
+//
+// Rather than walk the stack of open elements, these compare the index of the
+// topmost open element with an expected tag against that of the topmost one
+// bounding the scope, both of which the stack's index keeps track of.
+
+// Returns the index of the topmost open element that bounds the given scope, or
+// -1 if there's none.
+static int get_scope_boundary(const GumboParserState* state, ScopeType scope) {
+  unsigned int length = state->_open_elements.length;
+  return length > 0
+             ? state->_open_element_index[length - 1].scope_boundaries[scope]
+             : -1;
+}
 
-    GumboTag node_tag = node->v.element.tag;
-    GumboNamespaceEnum node_ns = node->v.element.tag_namespace;
-    for (int j = 0; j < expected_size; ++j) {
-      if (node_tag == expected[j] && node_ns == GUMBO_NAMESPACE_HTML)
-        return true;
+static bool has_an_element_in_specific_scope(GumboParser* parser,
+    int expected_size, const GumboTag* expected, ScopeType scope) {
+  const GumboParserState* state = parser->_parser_state;
+  int boundary = get_scope_boundary(state, scope);
+  for (int j = 0; j < expected_size; ++j) {
+    int index = state->_topmost_with_tag[expected[j]];
+    if (index != -1 && index >= boundary) {
+      return true;
     }
-
-    bool found = TAGSET_INCLUDES(tags, node_ns, node_tag);
-    if (negate != found) return false;
   }
   return false;
 }
 
 // Checks for the presence of an open element of the specified tag type.
 static bool has_open_element(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(
-      parser, 1, &tag, false, (gumbo_tagset){TAG(HTML)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_ANY);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#has-an-element-in-scope
 static bool has_an_element_in_scope(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(parser, 1, &tag, false,
-      (gumbo_tagset){TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE), TAG(TD),
-          TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE), TAG_MATHML(MI),
-          TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS), TAG_MATHML(MTEXT),
-          TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT), TAG_SVG(DESC),
-          TAG_SVG(TITLE)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_DEFAULT);
 }
 
 // Like "has an element in scope", but for the specific case of looking for a
-// unique target node, not for any node with a given tag name.  This duplicates
-// much of the algorithm from has_an_element_in_specific_scope because the
-// predicate is different when checking for an exact node, and it's easier &
-// faster just to duplicate the code for this one case than to try and
-// parameterize it.
+// unique target node, not for any node with a given tag name.
 static bool has_node_in_scope(GumboParser* parser, const GumboNode* node) {
-  GumboVector* open_elements = &parser->_parser_state->_open_elements;
-  for (int i = open_elements->length; --i >= 0;) {
-    const GumboNode* current = open_elements->data[i];
-    if (current == node) {
-      return true;
-    }
-    if (current->type != GUMBO_NODE_ELEMENT &&
-        current->type != GUMBO_NODE_TEMPLATE) {
-      continue;
-    }
-    if (node_tag_in_set(current,
-            (gumbo_tagset){TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE),
-                TAG(TD), TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE),
-                TAG_MATHML(MI), TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS),
-                TAG_MATHML(MTEXT), TAG_MATHML(ANNOTATION_XML),
-                TAG_SVG(FOREIGNOBJECT), TAG_SVG(DESC), TAG_SVG(TITLE)})) {
-      return false;
-    }
-  }
-  assert(false);
-  return false;
+  int index = find_open_element(parser, node);
+  return index != -1 &&
+         index >= get_scope_boundary(parser->_parser_state, SCOPE_DEFAULT);
 }
 
 // Like has_an_element_in_scope, but restricts the expected qualified name to a
 // range of possible qualified names instead of just a single one.
 static bool has_an_element_in_scope_with_tagname(
     GumboParser* parser, int expected_len, const GumboTag expected[]) {
-  return has_an_element_in_specific_scope(parser, expected_len, expected, false,
-      (gumbo_tagset){TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE), TAG(TD),
-          TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE), TAG_MATHML(MI),
-          TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS), TAG_MATHML(MTEXT),
-          TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT), TAG_SVG(DESC),
-          TAG_SVG(TITLE)});
+  return has_an_element_in_specific_scope(
+      parser, expected_len, expected, SCOPE_DEFAULT);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#has-an-element-in-list-item-scope
 static bool has_an_element_in_list_scope(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(parser, 1, &tag, false,
-      (gumbo_tagset){TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE), TAG(TD),
-          TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE), TAG_MATHML(MI),
-          TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS), TAG_MATHML(MTEXT),
-          TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT), TAG_SVG(DESC),
-          TAG_SVG(TITLE), TAG(OL), TAG(UL)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_LIST_ITEM);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#has-an-element-in-button-scope
 static bool has_an_element_in_button_scope(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(parser, 1, &tag, false,
-      (gumbo_tagset){TAG(APPLET), TAG(CAPTION), TAG(HTML), TAG(TABLE), TAG(TD),
-          TAG(TH), TAG(MARQUEE), TAG(OBJECT), TAG(TEMPLATE), TAG_MATHML(MI),
-          TAG_MATHML(MO), TAG_MATHML(MN), TAG_MATHML(MS), TAG_MATHML(MTEXT),
-          TAG_MATHML(ANNOTATION_XML), TAG_SVG(FOREIGNOBJECT), TAG_SVG(DESC),
-          TAG_SVG(TITLE), TAG(BUTTON)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_BUTTON);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#has-an-element-in-table-scope
 static bool has_an_element_in_table_scope(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(parser, 1, &tag, false,
-      (gumbo_tagset){TAG(HTML), TAG(TABLE), TAG(TEMPLATE)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_TABLE);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#has-an-element-in-select-scope
 static bool has_an_element_in_select_scope(GumboParser* parser, GumboTag tag) {
-  return has_an_element_in_specific_scope(
-      parser, 1, &tag, true, (gumbo_tagset){TAG(OPTGROUP), TAG(OPTION)});
+  return has_an_element_in_specific_scope(parser, 1, &tag, SCOPE_SELECT);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#generate-implied-end-tags
@@ -1655,7 +2642,8 @@ static void merge_attributes(
       // Ownership of the attribute is transferred by this gumbo_vector_add,
       // so it has to be nulled out of the original token so it doesn't get
       // double-deleted.
-      gumbo_vector_add(parser, attr, node_attr);
+      gumbo_vector_add_inline(
+          parser, attr, node->v.element._inline_attributes, node_attr);
       token_attr->data[i] = NULL;
     }
   }
@@ -1747,44 +2735,22 @@ static bool maybe_add_doctype_error(
     GumboParser* parser, const GumboToken* token) {
   const GumboTokenDocType* doctype = &token->v.doc_type;
   bool html_doctype = !strcmp(doctype->name, kDoctypeHtml.data);
-  if ((!html_doctype || doctype->has_public_identifier ||
-          (doctype->has_system_identifier &&
-              !strcmp(
-                  doctype->system_identifier, kSystemIdLegacyCompat.data))) &&
-      !(html_doctype && (doctype_matches(doctype, &kPublicIdHtml4_0,
-                             &kSystemIdRecHtml4_0, true) ||
-                            doctype_matches(doctype, &kPublicIdHtml4_01,
-                                &kSystemIdHtml4, true) ||
-                            doctype_matches(doctype, &kPublicIdXhtml1_0,
-                                &kSystemIdXhtmlStrict1_1, false) ||
-                            doctype_matches(doctype, &kPublicIdXhtml1_1,
-                                &kSystemIdXhtml1_1, false)))) {
-    parser_add_parse_error(parser, token);
-    return false;
-  }
-  return true;
-}
-
-static void remove_from_parent(GumboParser* parser, GumboNode* node) {
-  if (!node->parent) {
-    // The node may not have a parent if, for example, it is a newly-cloned copy
-    // of an active formatting element.  DOM manipulations continue with the
-    // orphaned fragment of the DOM tree until it's appended/foster-parented to
-    // the common ancestor at the end of the adoption agency algorithm.
-    return;
-  }
-  assert(node->parent->type == GUMBO_NODE_ELEMENT);
-  GumboVector* children = &node->parent->v.element.children;
-  int index = gumbo_vector_index_of(children, node);
-  assert(index != -1);
-
-  gumbo_vector_remove_at(parser, index, children);
-  node->parent = NULL;
-  node->index_within_parent = -1;
-  for (unsigned int i = index; i < children->length; ++i) {
-    GumboNode* child = children->data[i];
-    child->index_within_parent = i;
+  if ((!html_doctype || doctype->has_public_identifier ||
+          (doctype->has_system_identifier &&
+              !strcmp(
+                  doctype->system_identifier, kSystemIdLegacyCompat.data))) &&
+      !(html_doctype && (doctype_matches(doctype, &kPublicIdHtml4_0,
+                             &kSystemIdRecHtml4_0, true) ||
+                            doctype_matches(doctype, &kPublicIdHtml4_01,
+                                &kSystemIdHtml4, true) ||
+                            doctype_matches(doctype, &kPublicIdXhtml1_0,
+                                &kSystemIdXhtmlStrict1_1, false) ||
+                            doctype_matches(doctype, &kPublicIdXhtml1_1,
+                                &kSystemIdXhtml1_1, false)))) {
+    parser_add_parse_error(parser, token);
+    return false;
   }
+  return true;
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#an-introduction-to-error-handling-and-strange-cases-in-the-parser
@@ -1792,13 +2758,12 @@ static void remove_from_parent(GumboParser* parser, GumboNode* node) {
 static bool adoption_agency_algorithm(
     GumboParser* parser, GumboToken* token, GumboTag subject) {
   GumboParserState* state = parser->_parser_state;
-  gumbo_debug("Entering adoption agency algorithm.\n");
+  gumbo_debug(parser, "Entering adoption agency algorithm.\n");
   // Step 1.
   GumboNode* current_node = get_current_node(parser);
   if (current_node->v.element.tag_namespace == GUMBO_NAMESPACE_HTML &&
       current_node->v.element.tag == subject &&
-      gumbo_vector_index_of(
-          &state->_active_formatting_elements, current_node) == -1) {
+      find_formatting_element(parser, current_node) == -1) {
     pop_current_node(parser);
     return false;
   }
@@ -1810,7 +2775,7 @@ static bool adoption_agency_algorithm(
     for (int j = state->_active_formatting_elements.length; --j >= 0;) {
       GumboNode* current_node = state->_active_formatting_elements.data[j];
       if (current_node == &kActiveFormattingScopeMarker) {
-        gumbo_debug("Broke on scope marker; aborting.\n");
+        gumbo_debug(parser, "Broke on scope marker; aborting.\n");
         // Last scope marker; abort the algorithm.
         return false;
       }
@@ -1818,8 +2783,8 @@ static bool adoption_agency_algorithm(
         // Found it.
         formatting_node = current_node;
         formatting_node_in_open_elements =
-            gumbo_vector_index_of(&state->_open_elements, formatting_node);
-        gumbo_debug("Formatting element of tag %s at %d.\n",
+            find_open_element(parser, formatting_node);
+        gumbo_debug(parser, "Formatting element of tag %s at %d.\n",
             gumbo_normalized_tagname(subject),
             formatting_node_in_open_elements);
         break;
@@ -1829,23 +2794,22 @@ static bool adoption_agency_algorithm(
       // No matching tag; not a parse error outright, but fall through to the
       // "any other end tag" clause (which may potentially add a parse error,
       // but not always).
-      gumbo_debug("No active formatting elements; aborting.\n");
+      gumbo_debug(parser, "No active formatting elements; aborting.\n");
       return false;
     }
 
     // Step 6
     if (formatting_node_in_open_elements == -1) {
-      gumbo_debug("Formatting node not on stack of open elements.\n");
+      gumbo_debug(parser, "Formatting node not on stack of open elements.\n");
       parser_add_parse_error(parser, token);
-      gumbo_vector_remove(
-          parser, formatting_node, &state->_active_formatting_elements);
+      remove_formatting_element(parser, formatting_node);
       return false;
     }
 
     // Step 7
     if (!has_an_element_in_scope(parser, formatting_node->v.element.tag)) {
       parser_add_parse_error(parser, token);
-      gumbo_debug("Element not in scope.\n");
+      gumbo_debug(parser, "Element not in scope.\n");
       return false;
     }
 
@@ -1876,8 +2840,7 @@ static bool adoption_agency_algorithm(
       }
       // And the formatting element itself.
       pop_current_node(parser);
-      gumbo_vector_remove(
-          parser, formatting_node, &state->_active_formatting_elements);
+      remove_formatting_element(parser, formatting_node);
       return false;
     }
     assert(!node_html_tag_is(furthest_block, GUMBO_TAG_HTML));
@@ -1887,32 +2850,28 @@ static bool adoption_agency_algorithm(
     // Elements may be moved and reparented by this algorithm, so
     // common_ancestor is not necessarily the same as formatting_node->parent.
     GumboNode* common_ancestor =
-        state->_open_elements.data[gumbo_vector_index_of(&state->_open_elements,
-                                       formatting_node) -
-                                   1];
-    gumbo_debug("Common ancestor tag = %s, furthest block tag = %s.\n",
+        state->_open_elements.data[formatting_node_in_open_elements - 1];
+    gumbo_debug(parser, "Common ancestor tag = %s, furthest block tag = %s.\n",
         gumbo_normalized_tagname(common_ancestor->v.element.tag),
         gumbo_normalized_tagname(furthest_block->v.element.tag));
 
     // Step 12.
-    int bookmark = gumbo_vector_index_of(
-                       &state->_active_formatting_elements, formatting_node) +
-                   1;
-    gumbo_debug("Bookmark at %d.\n", bookmark);
+    int bookmark = find_formatting_element(parser, formatting_node) + 1;
+    gumbo_debug(parser, "Bookmark at %d.\n", bookmark);
     // Step 13.
     GumboNode* node = furthest_block;
     GumboNode* last_node = furthest_block;
     // Must be stored explicitly, in case node is removed from the stack of open
     // elements, to handle step 9.4.
-    int saved_node_index = gumbo_vector_index_of(&state->_open_elements, node);
+    int saved_node_index = find_open_element(parser, node);
     assert(saved_node_index > 0);
     // Step 13.1.
     for (int j = 0;;) {
       // Step 13.2.
       ++j;
       // Step 13.3.
-      int node_index = gumbo_vector_index_of(&state->_open_elements, node);
-      gumbo_debug(
+      int node_index = find_open_element(parser, node);
+      gumbo_debug(parser,
           "Current index: %d, last index: %d.\n", node_index, saved_node_index);
       if (node_index == -1) {
         node_index = saved_node_index;
@@ -1926,110 +2885,114 @@ static bool adoption_agency_algorithm(
         // Step 13.4.
         break;
       }
-      int formatting_index =
-          gumbo_vector_index_of(&state->_active_formatting_elements, node);
+      int formatting_index = find_formatting_element(parser, node);
       if (j > 3 && formatting_index != -1) {
         // Step 13.5.
-        gumbo_debug("Removing formatting element at %d.\n", formatting_index);
-        gumbo_vector_remove_at(
-            parser, formatting_index, &state->_active_formatting_elements);
+        gumbo_debug(parser, "Removing formatting element at %d.\n",
+            formatting_index);
+        remove_formatting_element_at(parser, formatting_index);
         // Removing the element shifts all indices over by one, so we may need
         // to move the bookmark.
         if (formatting_index < bookmark) {
           --bookmark;
-          gumbo_debug("Moving bookmark to %d.\n", bookmark);
+          gumbo_debug(parser, "Moving bookmark to %d.\n", bookmark);
         }
         continue;
       }
       if (formatting_index == -1) {
         // Step 13.6.
-        gumbo_vector_remove_at(parser, node_index, &state->_open_elements);
+        remove_open_element_at(parser, node_index);
+        close_element(parser, node);
         continue;
       }
       // Step 13.7.
       // "common ancestor as the intended parent" doesn't actually mean insert
       // it into the common ancestor; that happens below.
+      GumboNode* replaced_node = node;
       node = clone_node(parser, node, GUMBO_INSERTION_ADOPTION_AGENCY_CLONED);
       assert(formatting_index >= 0);
-      state->_active_formatting_elements.data[formatting_index] = node;
+      replace_formatting_element_at(parser, node, formatting_index);
       assert(node_index >= 0);
-      state->_open_elements.data[node_index] = node;
+      replace_open_element_at(parser, node, node_index);
+      close_element(parser, replaced_node);
       // Step 13.8.
       if (last_node == furthest_block) {
         bookmark = formatting_index + 1;
-        gumbo_debug("Bookmark moved to %d.\n", bookmark);
+        gumbo_debug(parser, "Bookmark moved to %d.\n", bookmark);
         assert((unsigned int) bookmark <= state->_active_formatting_elements.length);
       }
-      // Step 13.9.
+      // Step 13.9.  The clone isn't in the tree yet, so this is only reported
+      // once it is, after step 14.
       last_node->parse_flags |= GUMBO_INSERTION_ADOPTION_AGENCY_MOVED;
       remove_from_parent(parser, last_node);
-      append_node(parser, node, last_node);
+      append_unreported_node(parser, node, last_node);
       // Step 13.10.
       last_node = node;
     }  // Step 13.11.
 
     // Step 14.
-    gumbo_debug("Removing %s node from parent ",
+    gumbo_debug(parser, "Removing %s node from parent ",
         gumbo_normalized_tagname(last_node->v.element.tag));
     remove_from_parent(parser, last_node);
     last_node->parse_flags |= GUMBO_INSERTION_ADOPTION_AGENCY_MOVED;
     InsertionLocation location =
         get_appropriate_insertion_location(parser, common_ancestor);
-    gumbo_debug("and inserting it into %s.\n",
+    gumbo_debug(parser, "and inserting it into %s.\n",
         gumbo_normalized_tagname(location.target->v.element.tag));
     insert_node(parser, last_node, location);
+    // Each clone made in step 13 has a single child, the previous last_node.
+    for (GumboNode* clone = last_node; clone != furthest_block;) {
+      assert(clone->v.element.children.length == 1);
+      GumboNode* child = clone->v.element.children.data[0];
+      report_insertion(parser, child, NULL);
+      clone = child;
+    }
 
     // Step 15.
     GumboNode* new_formatting_node = clone_node(
         parser, formatting_node, GUMBO_INSERTION_ADOPTION_AGENCY_CLONED);
     formatting_node->parse_flags |= GUMBO_INSERTION_IMPLICIT_END_TAG;
 
-    // Step 16.  Instead of appending nodes one-by-one, we swap the children
-    // vector of furthest_block with the empty children of new_formatting_node,
-    // reducing memory traffic and allocations.  We still have to reset their
-    // parent pointers, though.
-    GumboVector temp = new_formatting_node->v.element.children;
-    new_formatting_node->v.element.children =
-        furthest_block->v.element.children;
-    furthest_block->v.element.children = temp;
-
-    temp = new_formatting_node->v.element.children;
-    for (unsigned int i = 0; i < temp.length; ++i) {
-      GumboNode* child = temp.data[i];
-      child->parent = new_formatting_node;
-    }
+    // Step 16.  Instead of appending nodes one-by-one, we move the children
+    // vector of furthest_block to new_formatting_node, whose children are
+    // empty, reducing memory traffic and allocations.  We still have to reset
+    // their parent pointers, though.
+    move_children(parser, furthest_block, new_formatting_node);
 
     // Step 17.
     append_node(parser, furthest_block, new_formatting_node);
+    // Step 16 is reported now that new_formatting_node has been.
+    const GumboEventHandler* handler = get_event_handler(parser);
+    if (handler && handler->reparent_children) {
+      handler->reparent_children(
+          handler->userdata, furthest_block, new_formatting_node);
+    }
 
     // Step 18.
     // If the formatting node was before the bookmark, it may shift over all
     // indices after it, so we need to explicitly find the index and possibly
     // adjust the bookmark.
-    int formatting_node_index = gumbo_vector_index_of(
-        &state->_active_formatting_elements, formatting_node);
+    int formatting_node_index =
+        find_formatting_element(parser, formatting_node);
     assert(formatting_node_index != -1);
     if (formatting_node_index < bookmark) {
-      gumbo_debug(
+      gumbo_debug(parser,
           "Formatting node at %d is before bookmark at %d; decrementing.\n",
           formatting_node_index, bookmark);
       --bookmark;
     }
-    gumbo_vector_remove_at(
-        parser, formatting_node_index, &state->_active_formatting_elements);
+    remove_formatting_element_at(parser, formatting_node_index);
     assert(bookmark >= 0);
     assert((unsigned int) bookmark <= state->_active_formatting_elements.length);
-    gumbo_vector_insert_at(parser, new_formatting_node, bookmark,
-        &state->_active_formatting_elements);
+    insert_formatting_element_at(parser, new_formatting_node, bookmark);
 
     // Step 19.
-    gumbo_vector_remove(parser, formatting_node, &state->_open_elements);
-    int insert_at =
-        gumbo_vector_index_of(&state->_open_elements, furthest_block) + 1;
+    remove_open_element(parser, formatting_node);
+    close_element(parser, formatting_node);
+    int insert_at = find_open_element(parser, furthest_block) + 1;
     assert(insert_at >= 0);
     assert((unsigned int) insert_at <= state->_open_elements.length);
-    gumbo_vector_insert_at(
-        parser, new_formatting_node, insert_at, &state->_open_elements);
+    insert_open_element_at(parser, new_formatting_node, insert_at);
   }  // Step 20.
   return true;
 }
@@ -2053,7 +3016,7 @@ static void ignore_token(GumboParser* parser) {
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/the-end.html
 static void finish_parsing(GumboParser* parser) {
-  gumbo_debug("Finishing parsing");
+  gumbo_debug(parser, "Finishing parsing");
   maybe_flush_text_node_buffer(parser);
   GumboParserState* state = parser->_parser_state;
   for (GumboNode* node = pop_current_node(parser); node;
@@ -2328,9 +3291,10 @@ static bool handle_after_head(GumboParser* parser, GumboToken* token) {
     // This must be flushed before we push the head element on, as there may be
     // pending character tokens that should be attached to the root.
     maybe_flush_text_node_buffer(parser);
-    gumbo_vector_add(parser, state->_head_element, &state->_open_elements);
+    push_open_element(parser, state->_head_element);
     bool result = handle_in_head(parser, token);
-    gumbo_vector_remove(parser, state->_head_element, &state->_open_elements);
+    remove_open_element(parser, state->_head_element);
+    close_element(parser, state->_head_element);
     return result;
   } else if (tag_is(token, kEndTag, GUMBO_TAG_TEMPLATE)) {
     return handle_in_head(parser, token);
@@ -2349,13 +3313,26 @@ static bool handle_after_head(GumboParser* parser, GumboToken* token) {
   }
 }
 
-static void destroy_node(GumboParser* parser, GumboNode* node) {
+// Returns the children of a document, element, or template node, or NULL for
+// the other types of nodes, which have none.
+static GumboVector* get_node_children(GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+// Frees everything that a node owns, but not the node itself.  Its children
+// must have been destroyed, or taken elsewhere, already.
+static void destroy_node_contents(GumboParser* parser, GumboNode* node) {
   switch (node->type) {
     case GUMBO_NODE_DOCUMENT: {
       GumboDocument* doc = &node->v.document;
-      for (unsigned int i = 0; i < doc->children.length; ++i) {
-        destroy_node(parser, doc->children.data[i]);
-      }
       gumbo_parser_deallocate(parser, (void*) doc->children.data);
       gumbo_parser_deallocate(parser, (void*) doc->name);
       gumbo_parser_deallocate(parser, (void*) doc->public_identifier);
@@ -2366,20 +3343,61 @@ static void destroy_node(GumboParser* parser, GumboNode* node) {
       for (unsigned int i = 0; i < node->v.element.attributes.length; ++i) {
         gumbo_destroy_attribute(parser, node->v.element.attributes.data[i]);
       }
-      gumbo_parser_deallocate(parser, node->v.element.attributes.data);
-      for (unsigned int i = 0; i < node->v.element.children.length; ++i) {
-        destroy_node(parser, node->v.element.children.data[i]);
-      }
-      gumbo_parser_deallocate(parser, node->v.element.children.data);
+      gumbo_vector_destroy_inline(parser, node->v.element._inline_attributes,
+          &node->v.element.attributes);
+      gumbo_vector_destroy_inline(parser, node->v.element._inline_children,
+          &node->v.element.children);
       break;
     case GUMBO_NODE_TEXT:
     case GUMBO_NODE_CDATA:
     case GUMBO_NODE_COMMENT:
     case GUMBO_NODE_WHITESPACE:
-      gumbo_parser_deallocate(parser, (void*) node->v.text.text);
+      // Borrowed text belongs to the caller's input buffer.
+      if (node->v.text.text != node->v.text.original_text.data) {
+        gumbo_parser_deallocate(parser, (void*) node->v.text.text);
+      }
       break;
   }
-  gumbo_parser_deallocate(parser, node);
+}
+
+// Destroys a node and its descendants without recursing, so that deeply nested
+// trees can't overflow the stack.  Each node's last child is detached and
+// descended into until a node without children is reached, which is freed
+// before climbing back to its parent, whose parent pointer the descent set.
+static void destroy_node(GumboParser* parser, GumboNode* node) {
+  GumboNode* root = node;
+  for (;;) {
+    GumboVector* children = get_node_children(node);
+    if (children && children->length > 0) {
+      GumboNode* child = children->data[--children->length];
+      child->parent = node;
+      node = child;
+      continue;
+    }
+    GumboNode* parent = node == root ? NULL : node->parent;
+    destroy_node_contents(parser, node);
+    gumbo_parser_deallocate_object(parser, GUMBO_POOLED_NODE, node);
+    if (!parent) {
+      return;
+    }
+    node = parent;
+  }
+}
+
+// Frees what a reported node owns, and keeps the node itself for reuse by
+// allocate_node.  Its children must have been recycled already.
+static void recycle_node(GumboParser* parser, GumboNode* node) {
+  assert(is_reporting_events(parser));
+  assert(!node->parent);
+  assert((node->type != GUMBO_NODE_ELEMENT &&
+             node->type != GUMBO_NODE_TEMPLATE) ||
+         node->v.element.children.length == 0);
+  GumboParserState* state = parser->_parser_state;
+  if (state->_stale_parent == node) {
+    state->_stale_parent = NULL;
+  }
+  destroy_node_contents(parser, node);
+  gumbo_vector_add_scratch(parser, node, &state->_free_nodes);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#parsing-main-inbody
@@ -2400,6 +3418,12 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     insert_text_token(parser, token);
     set_frameset_not_ok(parser);
     return true;
+  } else if (token->type == GUMBO_TOKEN_CHARACTER_RUN) {
+    reconstruct_active_formatting_elements(parser);
+    if (insert_text_run(parser, token)) {
+      set_frameset_not_ok(parser);
+    }
+    return true;
   } else if (token->type == GUMBO_TOKEN_COMMENT) {
     append_comment_node(parser, get_current_node(parser), token);
     return true;
@@ -2458,16 +3482,18 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     // follows the </frameset>.
     clear_active_formatting_elements(parser);
 
-    // Remove the body node.  We may want to factor this out into a generic
-    // helper, but right now this is the only code that needs to do this.
-    GumboVector* children = &parser->_output->root->v.element.children;
-    for (unsigned int i = 0; i < children->length; ++i) {
-      if (children->data[i] == body_node) {
-        gumbo_vector_remove_at(parser, i, children);
-        break;
-      }
+    // Remove the body node.  When reporting events, it has been queued up for
+    // recycling along with the rest of the closed elements.
+    const GumboEventHandler* handler = get_event_handler(parser);
+    if (handler && handler->remove_node) {
+      handler->remove_node(handler->userdata, body_node);
+    }
+    remove_from_parent(parser, body_node);
+    if (!is_reporting_events(parser)) {
+      // Its descendants may have stale indices.
+      update_child_indices(parser);
+      destroy_node(parser, body_node);
     }
-    destroy_node(parser, body_node);
 
     // Insert the <frameset>, and switch the insertion mode.
     insert_element_from_token(parser, token);
@@ -2545,7 +3571,7 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
   } else if (tag_is(token, kStartTag, GUMBO_TAG_FORM)) {
     if (state->_form_element != NULL &&
         !has_open_element(parser, GUMBO_TAG_TEMPLATE)) {
-      gumbo_debug("Ignoring nested form.\n");
+      gumbo_debug(parser, "Ignoring nested form.\n");
       parser_add_parse_error(parser, token);
       ignore_token(parser);
       return false;
@@ -2617,11 +3643,11 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
       return success;
     } else {
       bool result = true;
-      const GumboNode* node = state->_form_element;
+      GumboNode* node = state->_form_element;
       assert(!node || node->type == GUMBO_NODE_ELEMENT);
       state->_form_element = NULL;
       if (!node || !has_node_in_scope(parser, node)) {
-        gumbo_debug("Closing an unopened form.\n");
+        gumbo_debug(parser, "Closing an unopened form.\n");
         parser_add_parse_error(parser, token);
         ignore_token(parser);
         return false;
@@ -2634,10 +3660,10 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
         result = false;
       }
 
-      GumboVector* open_elements = &state->_open_elements;
-      int index = gumbo_vector_index_of(open_elements, node);
+      int index = find_open_element(parser, node);
       assert(index >= 0);
-      gumbo_vector_remove_at(parser, index, open_elements);
+      remove_open_element_at(parser, index);
+      close_element(parser, node);
       return result;
     }
   } else if (tag_is(token, kEndTag, GUMBO_TAG_P)) {
@@ -2709,9 +3735,12 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
       // we're supposed to do this.  (The conditions where it might not are
       // listed in the spec.)
       if (find_last_anchor_index(parser, &last_a)) {
-        void* last_element = gumbo_vector_remove_at(
-            parser, last_a, &state->_active_formatting_elements);
-        gumbo_vector_remove(parser, last_element, &state->_open_elements);
+        GumboNode* last_element = remove_formatting_element_at(parser, last_a);
+        int index = find_open_element(parser, last_element);
+        if (index != -1) {
+          remove_open_element_at(parser, index);
+          close_element(parser, last_element);
+        }
       }
       success = false;
     }
@@ -2836,7 +3865,8 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
       parser->_parser_state->_form_element = form;
     }
     if (action_attr) {
-      gumbo_vector_add(parser, action_attr, &form->v.element.attributes);
+      gumbo_vector_add_inline(parser, action_attr,
+          form->v.element._inline_attributes, &form->v.element.attributes);
     }
     insert_element_of_tag_type(
         parser, GUMBO_TAG_HR, GUMBO_INSERTION_FROM_ISINDEX);
@@ -2849,11 +3879,12 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     text_state->_start_position = token->position;
     text_state->_type = GUMBO_NODE_TEXT;
     if (prompt_attr) {
-      int prompt_attr_length = strlen(prompt_attr->value);
-      gumbo_string_buffer_destroy(parser, &text_state->_buffer);
-      text_state->_buffer.data = gumbo_copy_stringz(parser, prompt_attr->value);
-      text_state->_buffer.length = prompt_attr_length;
-      text_state->_buffer.capacity = prompt_attr_length + 1;
+      GumboStringPiece prompt_text;
+      prompt_text.data = prompt_attr->value;
+      prompt_text.length = strlen(prompt_attr->value);
+      gumbo_string_buffer_clear(parser, &text_state->_buffer);
+      gumbo_string_buffer_append_string(
+          parser, &prompt_text, &text_state->_buffer);
       gumbo_destroy_attribute(parser, prompt_attr);
     } else {
       GumboStringPiece prompt_text =
@@ -2867,7 +3898,9 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     for (unsigned int i = 0; i < token_attrs->length; ++i) {
       GumboAttribute* attr = token_attrs->data[i];
       if (attr != prompt_attr && attr != action_attr && attr != name_attr) {
-        gumbo_vector_add(parser, attr, &input->v.element.attributes);
+        gumbo_vector_add_inline(parser, attr,
+            input->v.element._inline_attributes,
+            &input->v.element.attributes);
       }
       token_attrs->data[i] = NULL;
     }
@@ -2885,7 +3918,7 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     }
 
     GumboAttribute* name =
-        gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+        gumbo_parser_allocate_object(parser, GUMBO_POOLED_ATTRIBUTE);
     GumboStringPiece name_str = GUMBO_STRING("name");
     GumboStringPiece isindex_str = GUMBO_STRING("isindex");
     name->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
@@ -2897,7 +3930,8 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     name->name_end = kGumboEmptySourcePosition;
     name->value_start = kGumboEmptySourcePosition;
     name->value_end = kGumboEmptySourcePosition;
-    gumbo_vector_add(parser, name, &input->v.element.attributes);
+    gumbo_vector_add_inline(parser, name, input->v.element._inline_attributes,
+        &input->v.element.attributes);
 
     pop_current_node(parser);  // <input>
     pop_current_node(parser);  // <label>
@@ -3044,6 +4078,8 @@ static bool handle_text(GumboParser* parser, GumboToken* token) {
   if (token->type == GUMBO_TOKEN_CHARACTER ||
       token->type == GUMBO_TOKEN_WHITESPACE) {
     insert_text_token(parser, token);
+  } else if (token->type == GUMBO_TOKEN_CHARACTER_RUN) {
+    insert_text_run(parser, token);
   } else {
     // We provide only bare-bones script handling that doesn't involve any of
     // the parser-pause/already-started/script-nesting flags or re-entrant
@@ -3423,10 +4459,11 @@ static bool handle_in_cell(GumboParser* parser, GumboToken* token) {
                  (gumbo_tagset){TAG(CAPTION), TAG(COL), TAG(COLGROUP),
                      TAG(TBODY), TAG(TD), TAG(TFOOT), TAG(TH), TAG(THEAD),
                      TAG(TR)})) {
-    gumbo_debug("Handling <td> in cell.\n");
+    gumbo_debug(parser, "Handling <td> in cell.\n");
     if (!has_an_element_in_table_scope(parser, GUMBO_TAG_TH) &&
         !has_an_element_in_table_scope(parser, GUMBO_TAG_TD)) {
-      gumbo_debug("Bailing out because there's no <td> or <th> in scope.\n");
+      gumbo_debug(
+          parser, "Bailing out because there's no <td> or <th> in scope.\n");
       parser_add_parse_error(parser, token);
       ignore_token(parser);
       return false;
@@ -3823,7 +4860,7 @@ static bool handle_html_content(GumboParser* parser, GumboToken* token) {
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#parsing-main-inforeign
 static bool handle_in_foreign_content(GumboParser* parser, GumboToken* token) {
-  gumbo_debug("Handling foreign content");
+  gumbo_debug(parser, "Handling foreign content");
   switch (token->type) {
     case GUMBO_TOKEN_NULL:
       parser_add_parse_error(parser, token);
@@ -3925,10 +4962,10 @@ static bool handle_in_foreign_content(GumboParser* parser, GumboToken* token) {
       // case we do nothing) or we find the element that we're about to
       // close (in which case we pop everything we've seen until that
       // point.)
-      gumbo_debug("Foreign %.*s node at %d.\n", node_tagname.length,
+      gumbo_debug(parser, "Foreign %.*s node at %d.\n", node_tagname.length,
           node_tagname.data, i);
       if (gumbo_string_equals_ignore_case(&node_tagname, &token_tagname)) {
-        gumbo_debug("Matches.\n");
+        gumbo_debug(parser, "Matches.\n");
         while (pop_current_node(parser) != node) {
           // Pop all the nodes below the current one.  Node is guaranteed to
           // be an element on the stack of open elements (set below), so
@@ -3955,6 +4992,24 @@ static bool handle_in_foreign_content(GumboParser* parser, GumboToken* token) {
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/tree-construction.html#tree-construction
+// Returns true if the next token may be a GUMBO_TOKEN_CHARACTER_RUN.  Only "in
+// body" and "text" treat every character of a run the same way; everything
+// else, like the table modes or the modes that split off leading whitespace,
+// keeps getting one token per character.  So does the linefeed that may be
+// ignored after <pre>, <listing> and <textarea>.
+static bool accepts_character_runs(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  if (state->_ignore_next_linefeed ||
+      (state->_insertion_mode != GUMBO_INSERTION_MODE_IN_BODY &&
+          state->_insertion_mode != GUMBO_INSERTION_MODE_TEXT)) {
+    return false;
+  }
+  // Runs must be dispatched on the insertion mode rather than go to foreign
+  // content; see handle_token.
+  const GumboNode* node = get_adjusted_current_node(parser);
+  return node && node->v.element.tag_namespace == GUMBO_NAMESPACE_HTML;
+}
+
 static bool handle_token(GumboParser* parser, GumboToken* token) {
   if (parser->_parser_state->_ignore_next_linefeed &&
       token->type == GUMBO_TOKEN_WHITESPACE && token->v.character == '\n') {
@@ -3979,7 +5034,7 @@ static bool handle_token(GumboParser* parser, GumboToken* token) {
   assert(!current_node || current_node->type == GUMBO_NODE_ELEMENT ||
          current_node->type == GUMBO_NODE_TEMPLATE);
   if (current_node) {
-    gumbo_debug("Current node: <%s>.\n",
+    gumbo_debug(parser, "Current node: <%s>.\n",
         gumbo_normalized_tagname(current_node->v.element.tag));
   }
   if (!current_node ||
@@ -4072,49 +5127,57 @@ GumboOutput* gumbo_parse(const char* buffer) {
       &kGumboDefaultOptions, buffer, strlen(buffer));
 }
 
-GumboOutput* gumbo_parse_with_options(
-    const GumboOptions* options, const char* buffer, size_t length) {
-  GumboParser parser;
-  parser._options = options;
-  output_init(&parser);
-  gumbo_tokenizer_state_init(&parser, buffer, length);
-  parser_state_init(&parser);
-
+// Sets up tree construction over a freshly initialized output, tokenizer state,
+// and parser state.
+static void start_parse(GumboParser* parser) {
+  const GumboOptions* options = parser->_options;
   if (options->fragment_context != GUMBO_TAG_LAST) {
     fragment_parser_init(
-        &parser, options->fragment_context, options->fragment_namespace);
+        parser, options->fragment_context, options->fragment_namespace);
   }
+}
 
-  GumboParserState* state = parser._parser_state;
-  gumbo_debug("Parsing %.*s.\n", length, buffer);
+// Runs tree construction over the tokens of the input.  Returns true once the
+// parse is done, or false if the input is being fed in incrementally and the
+// tokenizer has used up what there is of it so far; calling this again after
+// extending the input picks up exactly where it left off.  (A token is never
+// left to be reprocessed at that point.)
+static bool parse_tokens(GumboParser* parser) {
+  const GumboOptions* options = parser->_options;
+  GumboParserState* state = parser->_parser_state;
 
   // Sanity check so that infinite loops die with an assertion failure instead
   // of hanging the process before we ever get an error.
   int loop_count = 0;
 
-  GumboToken token;
-  bool has_error = false;
+  GumboToken* token = &state->_token;
 
   do {
     if (state->_reprocess_current_token) {
       state->_reprocess_current_token = false;
     } else {
-      GumboNode* current_node = get_current_node(&parser);
-      gumbo_tokenizer_set_is_current_node_foreign(&parser,
+      GumboNode* current_node = get_current_node(parser);
+      gumbo_tokenizer_set_is_current_node_foreign(parser,
           current_node &&
               current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML);
-      has_error = !gumbo_lex(&parser, &token) || has_error;
+      gumbo_tokenizer_set_allow_character_runs(
+          parser, accepts_character_runs(parser));
+      state->_has_error = !gumbo_lex(parser, token) || state->_has_error;
+      if (token->type == GUMBO_TOKEN_NEED_INPUT) {
+        return false;
+      }
     }
+#ifdef GUMBO_DEBUG
     const char* token_type = "text";
-    switch (token.type) {
+    switch (token->type) {
       case GUMBO_TOKEN_DOCTYPE:
         token_type = "doctype";
         break;
       case GUMBO_TOKEN_START_TAG:
-        token_type = gumbo_normalized_tagname(token.v.start_tag.tag);
+        token_type = gumbo_normalized_tagname(token->v.start_tag.tag);
         break;
       case GUMBO_TOKEN_END_TAG:
-        token_type = gumbo_normalized_tagname(token.v.end_tag);
+        token_type = gumbo_normalized_tagname(token->v.end_tag);
         break;
       case GUMBO_TOKEN_COMMENT:
         token_type = "comment";
@@ -4122,71 +5185,678 @@ GumboOutput* gumbo_parse_with_options(
       default:
         break;
     }
-    gumbo_debug("Handling %s token @%d:%d in state %d.\n", (char*) token_type,
-        token.position.line, token.position.column, state->_insertion_mode);
+    gumbo_debug(parser, "Handling %s token @%d:%d in state %d.\n",
+        (char*) token_type, token->position.line, token->position.column,
+        state->_insertion_mode);
+#endif
 
-    state->_current_token = &token;
+    state->_current_token = token;
     state->_self_closing_flag_acknowledged =
-        !(token.type == GUMBO_TOKEN_START_TAG &&
-            token.v.start_tag.is_self_closing);
+        !(token->type == GUMBO_TOKEN_START_TAG &&
+            token->v.start_tag.is_self_closing);
 
-    has_error = !handle_token(&parser, &token) || has_error;
+    state->_has_error = !handle_token(parser, token) || state->_has_error;
 
     // Check for memory leaks when ownership is transferred from start tag
     // tokens to nodes.
     assert(state->_reprocess_current_token ||
-           token.type != GUMBO_TOKEN_START_TAG ||
-           token.v.start_tag.attributes.data == NULL);
+           token->type != GUMBO_TOKEN_START_TAG ||
+           token->v.start_tag.attributes.data == NULL);
 
     if (!state->_self_closing_flag_acknowledged) {
-      GumboError* error = parser_add_parse_error(&parser, &token);
-      if (error) {
-        error->type = GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG;
-      }
+      add_tree_construction_error(
+          parser, token, GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG);
+    }
+
+    if (state->_closed_elements.length > 0) {
+      recycle_closed_elements(parser);
     }
 
     ++loop_count;
     assert(loop_count < 1000000000);
 
-  } while ((token.type != GUMBO_TOKEN_EOF || state->_reprocess_current_token) &&
-           !(options->stop_on_first_error && has_error));
+  } while (
+      (token->type != GUMBO_TOKEN_EOF || state->_reprocess_current_token) &&
+      !(options->stop_on_first_error && state->_has_error));
+  return true;
+}
 
-  finish_parsing(&parser);
+// Completes the parse once parse_tokens is done.  On return the output has been
+// detached from the parser, which may then be reset for another document.
+static GumboOutput* finish_parse(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  finish_parsing(parser);
+  if (is_reporting_events(parser)) {
+    recycle_remaining_nodes(parser);
+  }
   // For API uniformity reasons, if the doctype still has nulls, convert them to
   // empty strings.
-  GumboDocument* doc_type = &parser._output->document->v.document;
+  GumboDocument* doc_type = &parser->_output->document->v.document;
   if (doc_type->name == NULL) {
-    doc_type->name = gumbo_copy_stringz(&parser, "");
+    doc_type->name = gumbo_copy_stringz(parser, "");
   }
   if (doc_type->public_identifier == NULL) {
-    doc_type->public_identifier = gumbo_copy_stringz(&parser, "");
+    doc_type->public_identifier = gumbo_copy_stringz(parser, "");
   }
   if (doc_type->system_identifier == NULL) {
-    doc_type->system_identifier = gumbo_copy_stringz(&parser, "");
+    doc_type->system_identifier = gumbo_copy_stringz(parser, "");
   }
 
+  if (state->_fragment_ctx) {
+    destroy_node(parser, state->_fragment_ctx);
+    state->_fragment_ctx = NULL;
+  }
+  update_child_indices(parser);
+  parser->_arena = NULL;
+  parser->_pool = NULL;
+  return parser->_output;
+}
+
+// Runs tree construction to completion over a freshly initialized output,
+// tokenizer state, and parser state, and detaches the output.
+static GumboOutput* run_parser(GumboParser* parser) {
+  start_parse(parser);
+  parse_tokens(parser);
+  return finish_parse(parser);
+}
+
+GumboOutput* gumbo_parse_with_options(
+    const GumboOptions* options, const char* buffer, size_t length) {
+  GumboParser parser;
+  parser._options = options;
+  parser._arena = NULL;
+  parser._pool = NULL;
+  parser_state_init(&parser);
+  output_init(&parser);
+  gumbo_tokenizer_state_init(&parser, buffer, length);
+  gumbo_debug(&parser, "Parsing %.*s.\n", (int) length, buffer);
+  GumboOutput* output = run_parser(&parser);
   parser_state_destroy(&parser);
   gumbo_tokenizer_state_destroy(&parser);
-  return parser._output;
+  return output;
+}
+
+struct GumboInternalParserContext {
+  GumboOptions _options;
+
+  // The tokenizer state is created lazily on the first parse, since its
+  // initialization needs an input buffer and an output to report errors into.
+  // While a document is being fed in, _parser._output is its partial output.
+  GumboParser _parser;
+
+  // The document being fed in with gumbo_parser_context_feed, which becomes
+  // the output's once it's finished.  The tree points into it, so it can only
+  // grow by moving to a new buffer and moving those pointers over.
+  char* _input;
+  size_t _input_length;
+  size_t _input_capacity;
+
+  // Whether tree construction is done with the fed input, which it can be
+  // before the end with GumboOptions.stop_on_first_error.
+  bool _is_input_parsed;
+};
+
+// The smallest buffer allocated for fed input.
+static const size_t kMinFedInputCapacity = 4096;
+
+GumboParserContext* gumbo_parser_context_create(const GumboOptions* options) {
+  GumboParserContext* context =
+      options->allocator(options->userdata, sizeof(GumboParserContext));
+  context->_options = *options;
+  GumboParser* parser = &context->_parser;
+  parser->_options = &context->_options;
+  parser->_output = NULL;
+  parser->_arena = NULL;
+  parser->_pool = NULL;
+  parser->_tokenizer_state = NULL;
+  parser_state_init(parser);
+  context->_input = NULL;
+  context->_input_length = 0;
+  context->_input_capacity = 0;
+  context->_is_input_parsed = false;
+  return context;
+}
+
+// Throws away the partial output of a document being fed in, leaving its input
+// to the caller.
+static void abandon_fed_output(GumboParserContext* context) {
+  GumboParser* parser = &context->_parser;
+  if (!parser->_output) {
+    return;
+  }
+  gumbo_tokenizer_discard_partial_token(parser);
+  GumboParserState* state = parser->_parser_state;
+  if (is_reporting_events(parser)) {
+    recycle_remaining_nodes(parser);
+  }
+  if (state->_fragment_ctx) {
+    destroy_node(parser, state->_fragment_ctx);
+    state->_fragment_ctx = NULL;
+  }
+  parser->_arena = NULL;
+  parser->_pool = NULL;
+  gumbo_destroy_output(parser->_options, parser->_output);
+  parser->_output = NULL;
+}
+
+static void abandon_fed_input(GumboParserContext* context) {
+  abandon_fed_output(context);
+  gumbo_scratch_deallocate(&context->_parser, context->_input);
+  context->_input = NULL;
+  context->_input_length = 0;
+  context->_input_capacity = 0;
+}
+
+// Starts the parse of the fed input, and runs it as far as the input allows.
+static void start_fed_parse(GumboParserContext* context) {
+  GumboParser* parser = &context->_parser;
+  assert(!parser->_output);
+  parser_state_reset(parser);
+  output_init(parser);
+  if (parser->_tokenizer_state) {
+    gumbo_tokenizer_state_reset(parser, context->_input, 0);
+  } else {
+    gumbo_tokenizer_state_init(parser, context->_input, 0);
+  }
+  gumbo_tokenizer_extend_input(
+      parser, context->_input + context->_input_length, false);
+  start_parse(parser);
+  context->_is_input_parsed = parse_tokens(parser);
+}
+
+// Moves the pointers into the fed input that a node holds over to the copy.
+static void move_node_input(const GumboInputMove* move, GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      GumboElement* element = &node->v.element;
+      gumbo_move_input_pointer(move, &element->original_tag.data);
+      gumbo_move_input_pointer(move, &element->original_end_tag.data);
+      for (unsigned int i = 0; i < element->attributes.length; ++i) {
+        GumboAttribute* attr = element->attributes.data[i];
+        gumbo_move_input_pointer(move, &attr->original_name.data);
+        gumbo_move_input_pointer(move, &attr->original_value.data);
+      }
+      break;
+    }
+    case GUMBO_NODE_TEXT:
+    case GUMBO_NODE_CDATA:
+    case GUMBO_NODE_COMMENT:
+    case GUMBO_NODE_WHITESPACE: {
+      GumboText* text = &node->v.text;
+      if (text->text == text->original_text.data) {
+        // The text was borrowed from the input (see GumboOptions.borrow_text).
+        gumbo_move_input_pointer(move, &text->text);
+      }
+      gumbo_move_input_pointer(move, &text->original_text.data);
+      break;
+    }
+    case GUMBO_NODE_DOCUMENT:
+      break;
+  }
+}
+
+// Moves the input pointers of a node that the parser holds on to, and of
+// everything under it if it isn't in the tree, where they're moved anyway.
+static void move_held_node_input(const GumboInputMove* move, GumboNode* node) {
+  if (!node || node == &kActiveFormattingScopeMarker) {
+    return;
+  }
+  if (node->parent) {
+    move_node_input(move, node);
+    return;
+  }
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, node);
+  while ((node = gumbo_walker_next(&walker, &event))) {
+    if (event == GUMBO_WALK_ENTER) {
+      move_node_input(move, node);
+    }
+  }
+}
+
+static void move_held_nodes_input(
+    const GumboInputMove* move, const GumboVector* nodes) {
+  for (unsigned int i = 0; i < nodes->length; ++i) {
+    move_held_node_input(move, nodes->data[i]);
+  }
+}
+
+// Carries on the parse of fed input that has been copied to a bigger buffer
+// from the copy, by moving everything that points into the old one over.  A
+// node may be reached more than once, but a pointer that has been moved points
+// into the new buffer, and so is left alone after that.
+static void move_fed_parse(GumboParser* parser, const GumboInputMove* move) {
+  GumboParserState* state = parser->_parser_state;
+  gumbo_tokenizer_move_input(parser, move);
+  gumbo_move_input_pointer(move, &state->_text_node._start_original_text);
+  gumbo_move_input_pointer(move, &state->_token.original_text.data);
+  move_held_node_input(move, parser->_output->document);
+  move_held_nodes_input(move, &state->_open_elements);
+  move_held_nodes_input(move, &state->_active_formatting_elements);
+  move_held_nodes_input(move, &state->_closed_elements);
+  move_held_node_input(move, state->_head_element);
+  move_held_node_input(move, state->_form_element);
+  move_held_node_input(move, state->_fragment_ctx);
+  const GumboVector* errors = &parser->_output->errors;
+  for (unsigned int i = 0; i < errors->length; ++i) {
+    GumboError* error = errors->data[i];
+    gumbo_move_input_pointer(move, &error->original_text);
+    if (error->type == GUMBO_ERR_NAMED_CHAR_REF_WITHOUT_SEMICOLON ||
+        error->type == GUMBO_ERR_NAMED_CHAR_REF_INVALID) {
+      gumbo_move_input_pointer(move, &error->v.text.data);
+    }
+  }
+}
+
+// Makes room for a fed document of at least 'length' bytes.  Moving to a new
+// buffer means moving everything that points into the old one, so this grows
+// the buffer geometrically, and keeps it bigger than the document, as
+// GumboInputMove needs.
+static void reserve_fed_input(GumboParserContext* context, size_t length) {
+  if (length < context->_input_capacity) {
+    return;
+  }
+  size_t capacity = context->_input_capacity * 2;
+  if (capacity < kMinFedInputCapacity) {
+    capacity = kMinFedInputCapacity;
+  }
+  if (capacity <= length) {
+    capacity = length + 1;
+  }
+  GumboParser* parser = &context->_parser;
+  char* input = gumbo_scratch_allocate(parser, capacity);
+  if (context->_input_length) {
+    memcpy(input, context->_input, context->_input_length);
+  }
+  if (parser->_output) {
+    GumboInputMove move = {context->_input, context->_input_length, input};
+    move_fed_parse(parser, &move);
+  }
+  gumbo_scratch_deallocate(parser, context->_input);
+  context->_input = input;
+  context->_input_capacity = capacity;
+}
+
+void gumbo_parser_context_reserve(
+    GumboParserContext* context, size_t input_length) {
+  reserve_fed_input(context, input_length);
+}
+
+void gumbo_parser_context_feed(
+    GumboParserContext* context, const char* data, size_t length) {
+  GumboParser* parser = &context->_parser;
+  size_t old_length = context->_input_length;
+  reserve_fed_input(context, old_length + length);
+  if (length) {
+    memcpy(context->_input + old_length, data, length);
+  }
+  context->_input_length = old_length + length;
+  if (!parser->_output) {
+    start_fed_parse(context);
+  } else if (!context->_is_input_parsed) {
+    gumbo_tokenizer_extend_input(
+        parser, context->_input + context->_input_length, false);
+    context->_is_input_parsed = parse_tokens(parser);
+  }
+}
+
+GumboOutput* gumbo_parser_context_finish(GumboParserContext* context) {
+  GumboParser* parser = &context->_parser;
+  if (!parser->_output) {
+    start_fed_parse(context);
+  }
+  if (!context->_is_input_parsed) {
+    gumbo_tokenizer_extend_input(
+        parser, context->_input + context->_input_length, true);
+    parse_tokens(parser);
+  }
+  GumboOutput* output = finish_parse(parser);
+  parser->_output = NULL;
+  output->input = context->_input;
+  output->input_length = context->_input_length;
+  context->_input = NULL;
+  context->_input_length = 0;
+  context->_input_capacity = 0;
+  context->_is_input_parsed = false;
+  return output;
+}
+
+GumboOutput* gumbo_parser_context_parse(
+    GumboParserContext* context, const char* buffer, size_t length) {
+  GumboParser* parser = &context->_parser;
+  abandon_fed_input(context);
+  parser_state_reset(parser);
+  output_init(parser);
+  if (parser->_tokenizer_state) {
+    gumbo_tokenizer_state_reset(parser, buffer, length);
+  } else {
+    gumbo_tokenizer_state_init(parser, buffer, length);
+  }
+  gumbo_debug(parser, "Parsing %.*s.\n", (int) length, buffer);
+  GumboOutput* output = run_parser(parser);
+  parser->_output = NULL;
+  return output;
+}
+
+void gumbo_parser_context_reset(GumboParserContext* context) {
+  GumboParser* parser = &context->_parser;
+  abandon_fed_input(context);
+  if (parser->_tokenizer_state) {
+    gumbo_tokenizer_state_destroy(parser);
+    parser->_tokenizer_state = NULL;
+  }
+  parser_state_destroy(parser);
+  parser_state_init(parser);
 }
 
+void gumbo_parser_context_destroy(GumboParserContext* context) {
+  GumboParser* parser = &context->_parser;
+  abandon_fed_input(context);
+  if (parser->_tokenizer_state) {
+    gumbo_tokenizer_state_destroy(parser);
+  }
+  parser_state_destroy(parser);
+  context->_options.deallocator(context->_options.userdata, context);
+}
+
+// Frees a node and everything under it with the options' deallocator.  It
+// mustn't be used on the nodes of an output parsed with
+// GumboOptions.arena_chunk_size or pool_slab_size, since it would pass memory
+// from the arena's chunks or the pool's slabs to the deallocator.
 void gumbo_destroy_node(GumboOptions* options, GumboNode* node) {
   // Need a dummy GumboParser because the allocator comes along with the
   // options object.
   GumboParser parser;
   parser._options = options;
+  parser._arena = NULL;
+  parser._pool = NULL;
   destroy_node(&parser, node);
 }
 
+void gumbo_walker_init(GumboWalker* walker, GumboNode* root) {
+  walker->_root = root;
+  walker->_node = NULL;
+  walker->_event = GUMBO_WALK_LEAVE;
+  walker->_skip_children = false;
+}
+
+GumboNode* gumbo_walker_next(GumboWalker* walker, GumboWalkEvent* event) {
+  GumboNode* node = walker->_node;
+  if (!node) {
+    // Either the walk hasn't started, or it's over and _root is NULL.
+    node = walker->_root;
+    walker->_event = GUMBO_WALK_ENTER;
+  } else if (walker->_event == GUMBO_WALK_ENTER) {
+    if (node->first_child && !walker->_skip_children) {
+      node = node->first_child;
+    } else {
+      walker->_event = GUMBO_WALK_LEAVE;
+    }
+  } else if (node == walker->_root) {
+    walker->_root = NULL;
+    node = NULL;
+  } else if (node->next_sibling) {
+    node = node->next_sibling;
+    walker->_event = GUMBO_WALK_ENTER;
+  } else {
+    node = node->parent;
+  }
+  walker->_node = node;
+  walker->_skip_children = false;
+  *event = walker->_event;
+  return node;
+}
+
+void gumbo_walker_skip_children(GumboWalker* walker) {
+  assert(walker->_event == GUMBO_WALK_ENTER);
+  walker->_skip_children = true;
+}
+
+// gumbo_output_compact first adds up the size of everything that the output
+// owns, as the compacted_*_size functions below, and then copies it into an
+// arena of exactly that size, in the same order, with the compact_* functions.
+
+static size_t compacted_string_size(const char* str) {
+  return str ? gumbo_arena_block_size(strlen(str) + 1) : 0;
+}
+
+static size_t compacted_vector_size(
+    const GumboVector* vector, unsigned int inline_capacity) {
+  return vector->length > inline_capacity
+             ? gumbo_arena_block_size(sizeof(void*) * vector->length)
+             : 0;
+}
+
+static bool owns_text(const GumboNode* node) {
+  // Borrowed text belongs to the caller's input buffer.
+  return node->v.text.text != node->v.text.original_text.data;
+}
+
+static size_t compacted_node_size(const GumboNode* node) {
+  size_t size = gumbo_arena_block_size(sizeof(GumboNode));
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT: {
+      const GumboDocument* doc = &node->v.document;
+      size += compacted_string_size(doc->name) +
+              compacted_string_size(doc->public_identifier) +
+              compacted_string_size(doc->system_identifier) +
+              compacted_vector_size(&doc->children, 0);
+    } break;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      const GumboElement* element = &node->v.element;
+      size += compacted_vector_size(
+          &element->attributes, GUMBO_INLINE_ATTRIBUTES);
+      for (unsigned int i = 0; i < element->attributes.length; ++i) {
+        const GumboAttribute* attr = element->attributes.data[i];
+        size += gumbo_arena_block_size(sizeof(GumboAttribute)) +
+                compacted_string_size(attr->name) +
+                compacted_string_size(attr->value);
+      }
+      size += compacted_vector_size(&element->children, GUMBO_INLINE_CHILDREN);
+    } break;
+    default:
+      if (owns_text(node)) {
+        size += gumbo_arena_block_size(node->v.text.length + 1);
+      }
+      break;
+  }
+  return size;
+}
+
+static size_t compacted_error_size(const GumboError* error) {
+  size_t size = gumbo_arena_block_size(sizeof(GumboError));
+  if (error->type == GUMBO_ERR_PARSER ||
+      error->type == GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG) {
+    size += compacted_vector_size(&error->v.parser.tag_stack, 0);
+  } else if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
+    size += compacted_string_size(error->v.duplicate_attr.name);
+  }
+  return size;
+}
+
+static const char* compact_string(GumboParser* parser, const char* str) {
+  return str ? gumbo_copy_stringz(parser, str) : NULL;
+}
+
+// Copies the elements of a vector, into inline_data if they fit there.  Empty
+// vectors without inline storage are left without any.
+static void compact_vector(GumboParser* parser, const GumboVector* from,
+    void** inline_data, unsigned int inline_capacity, GumboVector* to) {
+  if (from->length <= inline_capacity) {
+    gumbo_vector_init_inline(inline_data, inline_capacity, to);
+  } else {
+    to->data = gumbo_parser_allocate(parser, sizeof(void*) * from->length);
+    to->capacity = from->length;
+  }
+  if (from->length > 0) {
+    memcpy(to->data, from->data, sizeof(void*) * from->length);
+  }
+  to->length = from->length;
+}
+
+// Copies a node without its children, leaving its children vector with the
+// original children in it, for the caller to replace.
+static GumboNode* compact_node(GumboParser* parser, const GumboNode* node) {
+  GumboNode* copy = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  *copy = *node;
+  copy->parent = NULL;
+  copy->first_child = NULL;
+  copy->last_child = NULL;
+  copy->prev_sibling = NULL;
+  copy->next_sibling = NULL;
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT: {
+      GumboDocument* doc = &copy->v.document;
+      doc->name = compact_string(parser, doc->name);
+      doc->public_identifier = compact_string(parser, doc->public_identifier);
+      doc->system_identifier = compact_string(parser, doc->system_identifier);
+      compact_vector(
+          parser, &node->v.document.children, NULL, 0, &doc->children);
+    } break;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      GumboElement* element = &copy->v.element;
+      compact_vector(parser, &node->v.element.attributes,
+          element->_inline_attributes, GUMBO_INLINE_ATTRIBUTES,
+          &element->attributes);
+      for (unsigned int i = 0; i < element->attributes.length; ++i) {
+        const GumboAttribute* old_attr = element->attributes.data[i];
+        GumboAttribute* attr =
+            gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+        *attr = *old_attr;
+        attr->name = compact_string(parser, old_attr->name);
+        attr->value = compact_string(parser, old_attr->value);
+        element->attributes.data[i] = attr;
+      }
+      compact_vector(parser, &node->v.element.children,
+          element->_inline_children, GUMBO_INLINE_CHILDREN,
+          &element->children);
+    } break;
+    default:
+      if (owns_text(node)) {
+        size_t length = node->v.text.length;
+        char* text = gumbo_parser_allocate(parser, length + 1);
+        memcpy(text, node->v.text.text, length);
+        text[length] = '\0';
+        copy->v.text.text = text;
+      }
+      break;
+  }
+  return copy;
+}
+
+static GumboError* compact_error(GumboParser* parser, const GumboError* error) {
+  GumboError* copy = gumbo_parser_allocate(parser, sizeof(GumboError));
+  *copy = *error;
+  if (error->type == GUMBO_ERR_PARSER ||
+      error->type == GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG) {
+    compact_vector(
+        parser, &error->v.parser.tag_stack, NULL, 0, &copy->v.parser.tag_stack);
+  } else if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
+    copy->v.duplicate_attr.name =
+        compact_string(parser, error->v.duplicate_attr.name);
+  }
+  return copy;
+}
+
+GumboOutput* gumbo_output_compact(
+    const GumboOptions* options, GumboOutput* output) {
+  GumboWalker walker;
+  GumboWalkEvent event;
+  size_t size = gumbo_arena_block_size(sizeof(GumboOutput));
+  gumbo_walker_init(&walker, output->document);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (event == GUMBO_WALK_ENTER) {
+      size += compacted_node_size(node);
+    }
+  }
+  size += compacted_vector_size(&output->errors, 0);
+  for (unsigned int i = 0; i < output->errors.length; ++i) {
+    size += compacted_error_size(output->errors.data[i]);
+  }
+
+  GumboParser parser;
+  parser._options = options;
+  parser._arena = gumbo_arena_create_for_size(options, size);
+  parser._pool = NULL;
+  GumboOutput* compacted = gumbo_parser_allocate(&parser, sizeof(GumboOutput));
+  *compacted = *output;
+  compacted->arena = parser._arena;
+  compacted->pool = NULL;
+
+  // Each copy is put in place of the original in its parent's copy, which is
+  // the node that was last entered and not yet left.
+  GumboNode* parent = NULL;
+  gumbo_walker_init(&walker, output->document);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (event == GUMBO_WALK_LEAVE) {
+      if (node->first_child) {
+        parent = parent->parent;
+      }
+      continue;
+    }
+    GumboNode* copy = compact_node(&parser, node);
+    if (parent) {
+      copy->parent = parent;
+      get_children(parent)->data[node->index_within_parent] = copy;
+      copy->prev_sibling = parent->last_child;
+      if (parent->last_child) {
+        parent->last_child->next_sibling = copy;
+      } else {
+        parent->first_child = copy;
+      }
+      parent->last_child = copy;
+    } else {
+      compacted->document = copy;
+    }
+    if (node == output->root) {
+      compacted->root = copy;
+    }
+    if (node->first_child) {
+      parent = copy;
+    }
+  }
+
+  compact_vector(&parser, &output->errors, NULL, 0, &compacted->errors);
+  for (unsigned int i = 0; i < output->errors.length; ++i) {
+    compacted->errors.data[i] =
+        compact_error(&parser, output->errors.data[i]);
+  }
+  assert(parser._arena->allocation_ptr == parser._arena->allocation_end);
+
+  // The input buffer, if the output owns one, is handed over as is.
+  output->input = NULL;
+  gumbo_destroy_output(options, output);
+  return compacted;
+}
+
 void gumbo_destroy_output(const GumboOptions* options, GumboOutput* output) {
+  if (output->input) {
+    // Never part of the arena; see gumbo_parser_context_feed.
+    options->deallocator(options->userdata, (void*) output->input);
+  }
+  if (output->arena) {
+    // Everything, including the output itself, lives in the arena.
+    gumbo_arena_destroy(options, output->arena);
+    return;
+  }
   // Need a dummy GumboParser because the allocator comes along with the
   // options object.
   GumboParser parser;
   parser._options = options;
+  parser._arena = NULL;
+  parser._pool = output->pool;
   destroy_node(&parser, output->document);
   for (unsigned int i = 0; i < output->errors.length; ++i) {
     gumbo_error_destroy(&parser, output->errors.data[i]);
   }
   gumbo_vector_destroy(&parser, &output->errors);
+  GumboPool* pool = output->pool;
   gumbo_parser_deallocate(&parser, output);
+  if (pool) {
+    gumbo_pool_destroy(options, pool);
+  }
 }
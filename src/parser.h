@@ -24,6 +24,7 @@
 extern "C" {
 #endif
 
+struct GumboInternalArena;
 struct GumboInternalParserState;
 struct GumboInternalOutput;
 struct GumboInternalOptions;
@@ -48,6 +49,16 @@ typedef struct GumboInternalParser {
   // The internal parser state.  Initialized on parse start and destroyed on
   // parse end; end-users will never see a non-garbage value in this pointer.
   struct GumboInternalParserState* _parser_state;
+
+  // The arena that output allocations are carved from, or NULL to use the
+  // allocator in _options directly.  Anything that constructs a GumboParser
+  // must initialize this.
+  struct GumboInternalArena* _arena;
+
+  // The pool that nodes, attributes, and errors are allocated from, or NULL
+  // to allocate them like anything else.  Anything that constructs a
+  // GumboParser must initialize this too.
+  struct GumboInternalPool* _pool;
 } GumboParser;
 
 #ifdef __cplusplus
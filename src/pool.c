@@ -0,0 +1,95 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pool.h"
+
+#include <assert.h>
+
+#include "error.h"
+#include "util.h"
+
+// Every object is rounded up to this, which is enough for the pointers,
+// size_ts, and ints that make up the pooled structs.
+#define POOL_ALIGNMENT 8
+
+static size_t align_size(size_t size) {
+  return (size + POOL_ALIGNMENT - 1) & ~(size_t) (POOL_ALIGNMENT - 1);
+}
+
+static const size_t kSlabHeaderSize =
+    (sizeof(GumboPoolSlab) + POOL_ALIGNMENT - 1) &
+    ~(size_t) (POOL_ALIGNMENT - 1);
+
+static const size_t kObjectSizes[GUMBO_NUM_POOLED_TYPES] = {
+    sizeof(GumboNode), sizeof(GumboAttribute), sizeof(GumboError)};
+
+size_t gumbo_pool_object_size(GumboPooledType type) {
+  return kObjectSizes[type];
+}
+
+GumboPool* gumbo_pool_create(const GumboOptions* options) {
+  GumboPool* pool = options->allocator(options->userdata, sizeof(GumboPool));
+  pool->slabs = NULL;
+  pool->slab_size = align_size(options->pool_slab_size);
+  for (int i = 0; i < GUMBO_NUM_POOLED_TYPES; ++i) {
+    pool->bins[i].free_list = NULL;
+    pool->bins[i].allocation_ptr = NULL;
+    pool->bins[i].allocation_end = NULL;
+  }
+  return pool;
+}
+
+void* gumbo_pool_malloc(
+    const GumboOptions* options, GumboPool* pool, GumboPooledType type) {
+  GumboPoolBin* bin = &pool->bins[type];
+  if (bin->free_list) {
+    GumboPoolObject* object = bin->free_list;
+    bin->free_list = object->next;
+    return object;
+  }
+
+  size_t object_size = align_size(kObjectSizes[type]);
+  if ((size_t) (bin->allocation_end - bin->allocation_ptr) < object_size) {
+    // Slabs smaller than an object hold just the one.
+    size_t slab_size =
+        pool->slab_size > object_size ? pool->slab_size : object_size;
+    GumboPoolSlab* slab =
+        options->allocator(options->userdata, kSlabHeaderSize + slab_size);
+    slab->next = pool->slabs;
+    slab->size = kSlabHeaderSize + slab_size;
+    pool->slabs = slab;
+    bin->allocation_ptr = (char*) slab + kSlabHeaderSize;
+    bin->allocation_end = bin->allocation_ptr + slab_size;
+  }
+  void* result = bin->allocation_ptr;
+  bin->allocation_ptr += object_size;
+  return result;
+}
+
+void gumbo_pool_free(GumboPool* pool, GumboPooledType type, void* ptr) {
+  assert(ptr);
+  GumboPoolObject* object = ptr;
+  object->next = pool->bins[type].free_list;
+  pool->bins[type].free_list = object;
+}
+
+void gumbo_pool_destroy(const GumboOptions* options, GumboPool* pool) {
+  GumboPoolSlab* slab = pool->slabs;
+  while (slab) {
+    GumboPoolSlab* next = slab->next;
+    gumbo_options_deallocate_sized(options, slab, slab->size);
+    slab = next;
+  }
+  gumbo_options_deallocate_sized(options, pool, sizeof(GumboPool));
+}
@@ -0,0 +1,95 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A pool of the small fixed-size structs that a parse tree has the most of,
+// used for GumboOptions.pool_slab_size.  Each type of struct is carved out of
+// slabs obtained from the user's allocator, and freed ones go on a free list
+// for the next allocation of the same type to reuse.  The slabs are released
+// all at once when the output is destroyed.
+
+#ifndef GUMBO_POOL_H_
+#define GUMBO_POOL_H_
+
+#include <stddef.h>
+
+#include "gumbo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The types of struct that are pooled.
+typedef enum {
+  GUMBO_POOLED_NODE,
+  GUMBO_POOLED_ATTRIBUTE,
+  GUMBO_POOLED_ERROR,
+  GUMBO_NUM_POOLED_TYPES
+} GumboPooledType;
+
+// A slab of pool memory.  The objects follow this header directly.
+typedef struct GumboInternalPoolSlab {
+  struct GumboInternalPoolSlab* next;
+
+  // The number of bytes allocated for the slab, header included.
+  size_t size;
+} GumboPoolSlab;
+
+// A freed object, linked into the free list through its first bytes.
+typedef struct GumboInternalPoolObject {
+  struct GumboInternalPoolObject* next;
+} GumboPoolObject;
+
+// The objects of one type.
+typedef struct {
+  // Freed objects, most recently freed first.
+  GumboPoolObject* free_list;
+
+  // The never-used space at the end of the latest slab for this type.
+  char* allocation_ptr;
+  char* allocation_end;
+} GumboPoolBin;
+
+typedef struct GumboInternalPool {
+  // Every slab, most recently allocated first.
+  GumboPoolSlab* slabs;
+
+  // Usable bytes per slab, as specified in the options.
+  size_t slab_size;
+
+  GumboPoolBin bins[GUMBO_NUM_POOLED_TYPES];
+} GumboPool;
+
+// Returns the size of the struct of the given type.
+size_t gumbo_pool_object_size(GumboPooledType type);
+
+// Creates a new pool, using the allocator and slab size in the options.
+GumboPool* gumbo_pool_create(const GumboOptions* options);
+
+// Allocates an object of the given type from the pool, reusing a freed one if
+// there is one.
+void* gumbo_pool_malloc(
+    const GumboOptions* options, GumboPool* pool, GumboPooledType type);
+
+// Returns an object to the pool, for reuse by the next allocation of its type.
+void gumbo_pool_free(GumboPool* pool, GumboPooledType type, void* ptr);
+
+// Releases every slab of the pool, and the pool itself.  Anything still
+// allocated from it goes with them.
+void gumbo_pool_destroy(const GumboOptions* options, GumboPool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // GUMBO_POOL_H_
@@ -38,17 +38,15 @@ static void maybe_resize_string_buffer(struct GumboInternalParser* parser,
     new_capacity *= 2;
   }
   if (new_capacity != buffer->capacity) {
-    char* new_data = gumbo_parser_allocate(parser, new_capacity);
-    memcpy(new_data, buffer->data, buffer->length);
-    gumbo_parser_deallocate(parser, buffer->data);
-    buffer->data = new_data;
+    buffer->data = gumbo_scratch_reallocate(
+        parser, buffer->data, buffer->capacity, new_capacity);
     buffer->capacity = new_capacity;
   }
 }
 
 void gumbo_string_buffer_init(
     struct GumboInternalParser* parser, GumboStringBuffer* output) {
-  output->data = gumbo_parser_allocate(parser, kDefaultStringBufferSize);
+  output->data = gumbo_scratch_allocate(parser, kDefaultStringBufferSize);
   output->length = 0;
   output->capacity = kDefaultStringBufferSize;
 }
@@ -106,5 +104,5 @@ void gumbo_string_buffer_clear(
 
 void gumbo_string_buffer_destroy(
     struct GumboInternalParser* parser, GumboStringBuffer* buffer) {
-  gumbo_parser_deallocate(parser, buffer->data);
+  gumbo_scratch_deallocate_sized(parser, buffer->data, buffer->capacity);
 }
@@ -29,10 +29,11 @@ extern "C" {
 struct GumboInternalParser;
 
 // A struct representing a mutable, growable string.  This consists of a
-// heap-allocated buffer that may grow (by doubling) as necessary.  When
-// converting to a string, this allocates a new buffer that is only as long as
-// it needs to be.  Note that the internal buffer here is *not* nul-terminated,
-// so be sure not to use ordinary string manipulation functions on it.
+// heap-allocated buffer that may grow (by doubling) as necessary.  The buffer
+// is scratch memory and never comes from the parser's arena.  When converting
+// to a string, this allocates a new buffer that is only as long as it needs to
+// be.  Note that the internal buffer here is *not* nul-terminated, so be sure
+// not to use ordinary string manipulation functions on it.
 typedef struct {
   // A pointer to the beginning of the string.  NULL iff length == 0.
   char* data;
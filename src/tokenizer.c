@@ -55,7 +55,6 @@
 #include "parser.h"
 #include "string_buffer.h"
 #include "string_piece.h"
-#include "token_type.h"
 #include "tokenizer_states.h"
 #include "utf8.h"
 #include "util.h"
@@ -72,6 +71,61 @@ typedef enum {
   NEXT_CHAR        // Proceed to the next character and continue lexing.
 } StateResult;
 
+// Byte classes for the states that build up a name, value, or comment one
+// character at a time.  Each class is the set of bytes that its state only ever
+// appends to its buffer (lowercased, for names), with no errors or state
+// changes, so that a run of them can be taken in one go; see append_run.  They
+// are all ASCII bytes that the input iterator passes through unchanged, so
+// there is nothing to decode either.
+enum {
+  BYTE_CLASS_TAG_NAME = 1 << 0,
+  BYTE_CLASS_ATTR_NAME = 1 << 1,
+  BYTE_CLASS_ATTR_VALUE_DOUBLE_QUOTED = 1 << 2,
+  BYTE_CLASS_ATTR_VALUE_SINGLE_QUOTED = 1 << 3,
+  BYTE_CLASS_ATTR_VALUE_UNQUOTED = 1 << 4,
+  BYTE_CLASS_COMMENT = 1 << 5
+};
+
+#define IS_TEXT_BYTE(c) \
+  (((c) >= 0x20 && (c) < 0x7F) || (c) == '\t' || (c) == '\n' || (c) == '\f')
+#define IS_NAME_BYTE(c) ((c) > 0x20 && (c) < 0x7F && (c) != '/' && (c) != '>')
+#define BYTE_CLASSES(c)                                                   \
+  ((IS_NAME_BYTE(c) ? BYTE_CLASS_TAG_NAME : 0) |                          \
+      (IS_NAME_BYTE(c) && (c) != '=' && (c) != '"' && (c) != '\'' &&      \
+                  (c) != '<'                                              \
+              ? BYTE_CLASS_ATTR_NAME                                      \
+              : 0) |                                                      \
+      (IS_TEXT_BYTE(c) && (c) != '"' && (c) != '&'                        \
+              ? BYTE_CLASS_ATTR_VALUE_DOUBLE_QUOTED                       \
+              : 0) |                                                      \
+      (IS_TEXT_BYTE(c) && (c) != '\'' && (c) != '&'                       \
+              ? BYTE_CLASS_ATTR_VALUE_SINGLE_QUOTED                       \
+              : 0) |                                                      \
+      (IS_NAME_BYTE(c) && (c) != '&' && (c) != '<' && (c) != '=' &&       \
+                  (c) != '"' && (c) != '\'' && (c) != '`'                 \
+              ? BYTE_CLASS_ATTR_VALUE_UNQUOTED                            \
+              : 0) |                                                      \
+      (IS_TEXT_BYTE(c) && (c) != '-' ? BYTE_CLASS_COMMENT : 0))
+#define BYTE_CLASSES_4(c)                                          \
+  BYTE_CLASSES(c), BYTE_CLASSES((c) + 1), BYTE_CLASSES((c) + 2), \
+      BYTE_CLASSES((c) + 3)
+#define BYTE_CLASSES_16(c)                                    \
+  BYTE_CLASSES_4(c), BYTE_CLASSES_4((c) + 4),                 \
+      BYTE_CLASSES_4((c) + 8), BYTE_CLASSES_4((c) + 12)
+
+static const unsigned char kByteClasses[256] = {BYTE_CLASSES_16(0x00),
+    BYTE_CLASSES_16(0x10), BYTE_CLASSES_16(0x20), BYTE_CLASSES_16(0x30),
+    BYTE_CLASSES_16(0x40), BYTE_CLASSES_16(0x50), BYTE_CLASSES_16(0x60),
+    BYTE_CLASSES_16(0x70), BYTE_CLASSES_16(0x80), BYTE_CLASSES_16(0x90),
+    BYTE_CLASSES_16(0xA0), BYTE_CLASSES_16(0xB0), BYTE_CLASSES_16(0xC0),
+    BYTE_CLASSES_16(0xD0), BYTE_CLASSES_16(0xE0), BYTE_CLASSES_16(0xF0)};
+
+#undef BYTE_CLASSES_16
+#undef BYTE_CLASSES_4
+#undef BYTE_CLASSES
+#undef IS_NAME_BYTE
+#undef IS_TEXT_BYTE
+
 // This is a struct containing state necessary to build up a tag token,
 // character by character.
 typedef struct GumboInternalTagState {
@@ -95,6 +149,21 @@ typedef struct GumboInternalTagState {
   // values are filled in by operating on _attributes.data[attributes.length-1].
   GumboVector /* GumboAttribute */ _attributes;
 
+  // Inline storage for _attributes, so that tags with few attributes need no
+  // array for them.  Emitting a start tag copies them into the token's own
+  // inline storage, so the token doesn't depend on the tokenizer state.
+  void* _inline_attributes[GUMBO_INLINE_ATTRIBUTES];
+
+  // Once a tag has more than kMaxUnhashedAttributes attributes, an
+  // open-addressed hash table of their names for finding duplicates, holding
+  // each one's index in _attributes plus one (0 marks an empty slot).  Its
+  // capacity is a power of two, kept at least twice the number of attributes.
+  // The table is scratch memory that's kept across tags;
+  // _num_hashed_attributes is 0 until the current tag builds it.
+  unsigned int* _attribute_table;
+  unsigned int _attribute_table_capacity;
+  unsigned int _num_hashed_attributes;
+
   // If true, the next attribute value to be finished should be dropped.  This
   // happens if a duplicate attribute name is encountered - we want to consume
   // the attribute value, but shouldn't overwrite the existing value.
@@ -135,6 +204,11 @@ typedef struct GumboInternalTokenizerState {
   // markup declaration state.
   bool _is_current_node_foreign;
 
+  // Whether the parser is able to take a stretch of plain text as a single
+  // GUMBO_TOKEN_CHARACTER_RUN token.  Set by
+  // gumbo_tokenizer_set_allow_character_runs before each token.
+  bool _allow_character_runs;
+
   // A flag indicating whether the tokenizer is in a CDATA section.  If so, then
   // text tokens emitted will be GUMBO_TOKEN_CDATA.
   bool _is_in_cdata;
@@ -201,14 +275,13 @@ typedef struct GumboInternalTokenizerState {
 // Adds an ERR_UNEXPECTED_CODE_POINT parse error to the parser's error struct.
 static void tokenizer_add_parse_error(
     GumboParser* parser, GumboErrorType type) {
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error = gumbo_add_error(parser, type);
   if (!error) {
     return;
   }
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   utf8iterator_get_position(&tokenizer->_input, &error->position);
   error->original_text = utf8iterator_get_char_pointer(&tokenizer->_input);
-  error->type = type;
   error->v.tokenizer.codepoint = utf8iterator_current(&tokenizer->_input);
   switch (tokenizer->_state) {
     case GUMBO_LEX_DATA:
@@ -306,6 +379,7 @@ static void tokenizer_add_parse_error(
       error->v.tokenizer.state = GUMBO_ERR_TOKENIZER_CDATA;
       break;
   }
+  gumbo_finish_error(parser, error);
 }
 
 static bool is_alpha(int c) {
@@ -319,6 +393,11 @@ static int ensure_lowercase(int c) {
   return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
 }
 
+static bool is_hex_digit(int c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+         (c >= 'A' && c <= 'F');
+}
+
 static GumboTokenType get_char_token_type(bool is_in_cdata, int c) {
   if (is_in_cdata && c > 0) {
     return GUMBO_TOKEN_CDATA;
@@ -332,7 +411,6 @@ static GumboTokenType get_char_token_type(bool is_in_cdata, int c) {
     case ' ':
       return GUMBO_TOKEN_WHITESPACE;
     case 0:
-      gumbo_debug("Emitted null byte.\n");
       return GUMBO_TOKEN_NULL;
     case -1:
       return GUMBO_TOKEN_EOF;
@@ -509,6 +587,47 @@ static bool emit_current_char(GumboParser* parser, GumboToken* output) {
   return RETURN_SUCCESS;
 }
 
+// Returns true if the current character may be part of a character run: it
+// must not be special in any of the text states, and it must decode to exactly
+// the bytes in the source, so that the run's original_text can double as its
+// text.  The iterator turns carriage returns into newlines; a lone CR leaves
+// the char pointer on the '\r' itself.
+static bool is_run_character(const Utf8Iterator* input, int c) {
+  return c > 0 && c != '&' && c != '<' && c != kUtf8ReplacementChar &&
+         *utf8iterator_get_char_pointer(input) != '\r';
+}
+
+// Writes out the current character, along with as many plain characters as
+// follow it, as one GUMBO_TOKEN_CHARACTER_RUN token, if the parser accepts
+// them.  Otherwise this is emit_current_char.  Always returns RETURN_SUCCESS.
+static StateResult emit_current_char_or_run(
+    GumboParser* parser, GumboToken* output) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  Utf8Iterator* input = &tokenizer->_input;
+  int c = utf8iterator_current(input);
+  if (!tokenizer->_allow_character_runs || !is_run_character(input, c)) {
+    return emit_current_char(parser, output);
+  }
+  while (true) {
+    // Plain ASCII goes by in bulk, everything else one code point at a time.
+    if (!utf8iterator_skip_text(input)) {
+      utf8iterator_next(input);
+    }
+    c = utf8iterator_current(input);
+    // A CRLF pair leaves the char pointer on the '\n', with the '\r' that
+    // was dropped just before it; that can't be inside the run either.
+    if (!is_run_character(input, c) ||
+        (c == '\n' && utf8iterator_get_char_pointer(input)[-1] == '\r')) {
+      break;
+    }
+  }
+  // The input has already been advanced past the run.
+  tokenizer->_reconsume_current_input = true;
+  output->type = GUMBO_TOKEN_CHARACTER_RUN;
+  finish_token(parser, output);
+  return RETURN_SUCCESS;
+}
+
 // Writes out a doctype token, copying it from the tokenizer state.
 static void emit_doctype(GumboParser* parser, GumboToken* output) {
   output->type = GUMBO_TOKEN_DOCTYPE;
@@ -517,12 +636,29 @@ static void emit_doctype(GumboParser* parser, GumboToken* output) {
   doc_type_state_init(parser);
 }
 
-// Debug-only function that explicitly sets the attribute vector data to NULL so
-// it can be asserted on tag creation, verifying that there are no memory leaks.
+// Explicitly sets the attribute vector data to NULL once the tag state no
+// longer owns it.  This is asserted on tag creation, verifying that there are
+// no memory leaks, and lets gumbo_tokenizer_discard_partial_token tell whether
+// there's a tag in progress.
 static void mark_tag_state_as_empty(GumboTagState* tag_state) {
-#ifndef NDEBUG
   tag_state->_attributes = kGumboEmptyVector;
-#endif
+}
+
+// Moves the attributes in 'from', which may be in the from_inline slots, to
+// 'to', copying them into the to_inline slots if so, and leaves 'from' empty.
+static void move_attribute_vector(void** from_inline, GumboVector* from,
+    void** to_inline, GumboVector* to) {
+  if (from->data && from->data != from_inline) {
+    *to = *from;
+  } else {
+    assert(from->length <= GUMBO_INLINE_ATTRIBUTES);
+    gumbo_vector_init_inline(to_inline, GUMBO_INLINE_ATTRIBUTES, to);
+    if (from->length > 0) {
+      memcpy(to_inline, from->data, sizeof(void*) * from->length);
+    }
+    to->length = from->length;
+  }
+  *from = kGumboEmptyVector;
 }
 
 // Writes out the current tag as a start or end tag token.
@@ -532,11 +668,13 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
   if (tag_state->_is_start_tag) {
     output->type = GUMBO_TOKEN_START_TAG;
     output->v.start_tag.tag = tag_state->_tag;
-    output->v.start_tag.attributes = tag_state->_attributes;
+    move_attribute_vector(tag_state->_inline_attributes,
+        &tag_state->_attributes, output->v.start_tag._inline_attributes,
+        &output->v.start_tag.attributes);
     output->v.start_tag.is_self_closing = tag_state->_is_self_closing;
     tag_state->_last_start_tag = tag_state->_tag;
     mark_tag_state_as_empty(tag_state);
-    gumbo_debug(
+    gumbo_debug(parser,
         "Emitted start tag %s.\n", gumbo_normalized_tagname(tag_state->_tag));
   } else {
     output->type = GUMBO_TOKEN_END_TAG;
@@ -548,14 +686,14 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
     for (unsigned int i = 0; i < tag_state->_attributes.length; ++i) {
       gumbo_destroy_attribute(parser, tag_state->_attributes.data[i]);
     }
-    gumbo_parser_deallocate(parser, tag_state->_attributes.data);
+    gumbo_vector_destroy_inline(
+        parser, tag_state->_inline_attributes, &tag_state->_attributes);
     mark_tag_state_as_empty(tag_state);
-    gumbo_debug(
+    gumbo_debug(parser,
         "Emitted end tag %s.\n", gumbo_normalized_tagname(tag_state->_tag));
   }
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   finish_token(parser, output);
-  gumbo_debug("Original text = %.*s.\n", output->original_text.length,
+  gumbo_debug(parser, "Original text = %.*s.\n", output->original_text.length,
       output->original_text.data);
   assert(output->original_text.length >= 2);
   assert(output->original_text.data[0] == '<');
@@ -572,10 +710,10 @@ static void abandon_current_tag(GumboParser* parser) {
   for (unsigned int i = 0; i < tag_state->_attributes.length; ++i) {
     gumbo_destroy_attribute(parser, tag_state->_attributes.data[i]);
   }
-  gumbo_parser_deallocate(parser, tag_state->_attributes.data);
+  gumbo_vector_destroy_inline(
+      parser, tag_state->_inline_attributes, &tag_state->_attributes);
   mark_tag_state_as_empty(tag_state);
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
-  gumbo_debug("Abandoning current tag.\n");
+  gumbo_debug(parser, "Abandoning current tag.\n");
 }
 
 // Wraps the consume_char_ref function to handle its output and make the
@@ -668,13 +806,53 @@ static void append_char_to_tag_buffer(
   gumbo_string_buffer_append_codepoint(parser, codepoint, buffer);
 }
 
+// Appends the run of characters in byte_class that starts at the current
+// character to buffer, lowercasing ASCII letters if asked to, and leaves the
+// input on the character after it to be reconsumed.  This is the same as
+// appending them one at a time in the current state, which is what the caller
+// does instead if this returns false: the current character isn't in the class.
+static bool append_run(GumboParser* parser, unsigned char byte_class,
+    bool lowercase, GumboStringBuffer* buffer) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  const char* run = utf8iterator_get_char_pointer(&tokenizer->_input);
+  size_t length =
+      utf8iterator_skip_class(&tokenizer->_input, kByteClasses, byte_class);
+  if (length == 0) {
+    return false;
+  }
+  gumbo_string_buffer_reserve(parser, buffer->length + length, buffer);
+  char* dest = buffer->data + buffer->length;
+  if (lowercase) {
+    for (size_t i = 0; i < length; ++i) {
+      dest[i] = ensure_lowercase(run[i]);
+    }
+  } else {
+    memcpy(dest, run, length);
+  }
+  buffer->length += length;
+  tokenizer->_reconsume_current_input = true;
+  return true;
+}
+
+// Like append_char_to_tag_buffer, but for a whole run; see append_run.
+static bool append_run_to_tag_buffer(GumboParser* parser,
+    unsigned char byte_class, bool lowercase,
+    bool reinitilize_position_on_first) {
+  GumboStringBuffer* buffer = &parser->_tokenizer_state->_tag_state._buffer;
+  if (buffer->length == 0 && reinitilize_position_on_first) {
+    reset_tag_buffer_start_point(parser);
+  }
+  return append_run(parser, byte_class, lowercase, buffer);
+}
+
 // (Re-)initialize the tag buffer.  This also resets the original_text pointer
-// and _start_pos field to point to the current position.
+// and _start_pos field to point to the current position.  The buffer itself
+// lives as long as the tokenizer, so this just clears it.
 static void initialize_tag_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
-  gumbo_string_buffer_init(parser, &tag_state->_buffer);
+  gumbo_string_buffer_clear(parser, &tag_state->_buffer);
   reset_tag_buffer_start_point(parser);
 }
 
@@ -693,15 +871,18 @@ static void start_new_tag(GumboParser* parser, bool is_start_tag) {
   gumbo_string_buffer_append_codepoint(parser, c, &tag_state->_buffer);
 
   assert(tag_state->_attributes.data == NULL);
-  // Initial size chosen by statistical analysis of a corpus of 60k webpages.
-  // 99.5% of elements have 0 attributes, 93% of the remainder have 1.  These
-  // numbers are a bit higher for more modern websites (eg. ~45% = 0, ~40% = 1
-  // for the HTML5 Spec), but still have basically 99% of nodes with <= 2 attrs.
-  gumbo_vector_init(parser, 1, &tag_state->_attributes);
+  // Statistical analysis of a corpus of 60k webpages found that 99.5% of
+  // elements have 0 attributes, and 93% of the remainder have 1.  These numbers
+  // are a bit higher for more modern websites (eg. ~45% = 0, ~40% = 1 for the
+  // HTML5 Spec), but still have basically 99% of nodes with <= 2 attrs, which
+  // fit in the inline storage.
+  gumbo_vector_init_inline(tag_state->_inline_attributes,
+      GUMBO_INLINE_ATTRIBUTES, &tag_state->_attributes);
+  tag_state->_num_hashed_attributes = 0;
   tag_state->_drop_next_attr_value = false;
   tag_state->_is_start_tag = is_start_tag;
   tag_state->_is_self_closing = false;
-  gumbo_debug("Starting new tag.\n");
+  gumbo_debug(parser, "Starting new tag.\n");
 }
 
 // Fills in the specified char* with the contents of the tag buffer.
@@ -737,13 +918,6 @@ static void copy_over_original_tag_text(GumboParser* parser,
   utf8iterator_get_position(&tokenizer->_input, end_pos);
 }
 
-// Releases and then re-initializes the tag buffer.
-static void reinitialize_tag_buffer(GumboParser* parser) {
-  gumbo_parser_deallocate(
-      parser, parser->_tokenizer_state->_tag_state._buffer.data);
-  initialize_tag_buffer(parser);
-}
-
 // Moves some data from the temporary buffer over the the tag-based fields in
 // TagState.
 static void finish_tag_name(GumboParser* parser) {
@@ -752,24 +926,114 @@ static void finish_tag_name(GumboParser* parser) {
 
   tag_state->_tag =
       gumbo_tagn_enum(tag_state->_buffer.data, tag_state->_buffer.length);
-  reinitialize_tag_buffer(parser);
+  initialize_tag_buffer(parser);
 }
 
 // Adds an ERR_DUPLICATE_ATTR parse error to the parser's error struct.
 static void add_duplicate_attr_error(GumboParser* parser, const char* attr_name,
     int original_index, int new_index) {
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error = gumbo_add_error(parser, GUMBO_ERR_DUPLICATE_ATTR);
   if (!error) {
     return;
   }
   GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
-  error->type = GUMBO_ERR_DUPLICATE_ATTR;
   error->position = tag_state->_start_pos;
   error->original_text = tag_state->_original_text;
   error->v.duplicate_attr.original_index = original_index;
   error->v.duplicate_attr.new_index = new_index;
-  copy_over_tag_buffer(parser, &error->v.duplicate_attr.name);
-  reinitialize_tag_buffer(parser);
+  if (parser->_options->error_handler) {
+    // The name is the same as the original attribute's, which outlives the
+    // error.
+    error->v.duplicate_attr.name = attr_name;
+  } else {
+    copy_over_tag_buffer(parser, &error->v.duplicate_attr.name);
+  }
+  initialize_tag_buffer(parser);
+  gumbo_finish_error(parser, error);
+}
+
+// Tags with more attributes than this look for duplicates in a hash table of
+// their names rather than comparing against each one, so that tags with
+// thousands of attributes still tokenize in linear time.
+static const unsigned int kMaxUnhashedAttributes = 8;
+
+// The smallest hash table of attribute names.
+static const unsigned int kMinAttributeTableCapacity = 32;
+
+// FNV-1a.
+static unsigned int hash_attribute_name(const char* name, size_t length) {
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Adds the current tag's attribute at the given index to its hash table, which
+// must have room for it.
+static void hash_attribute(GumboTagState* tag_state, unsigned int index) {
+  const GumboAttribute* attr = tag_state->_attributes.data[index];
+  unsigned int mask = tag_state->_attribute_table_capacity - 1;
+  unsigned int slot = hash_attribute_name(attr->name, strlen(attr->name)) & mask;
+  while (tag_state->_attribute_table[slot]) {
+    slot = (slot + 1) & mask;
+  }
+  tag_state->_attribute_table[slot] = index + 1;
+  ++tag_state->_num_hashed_attributes;
+}
+
+// Builds the hash table of the current tag's attribute names from scratch,
+// growing it to leave room for as many again.
+static void rehash_attributes(GumboParser* parser) {
+  GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
+  unsigned int num_attributes = tag_state->_attributes.length;
+  unsigned int capacity = tag_state->_attribute_table_capacity;
+  if (capacity < 4 * num_attributes) {
+    gumbo_scratch_deallocate_sized(parser, tag_state->_attribute_table,
+        sizeof(unsigned int) * capacity);
+    if (capacity < kMinAttributeTableCapacity) {
+      capacity = kMinAttributeTableCapacity;
+    }
+    while (capacity < 4 * num_attributes) {
+      capacity *= 2;
+    }
+    tag_state->_attribute_table =
+        gumbo_scratch_allocate(parser, sizeof(unsigned int) * capacity);
+    tag_state->_attribute_table_capacity = capacity;
+  }
+  memset(tag_state->_attribute_table, 0, sizeof(unsigned int) * capacity);
+  tag_state->_num_hashed_attributes = 0;
+  for (unsigned int i = 0; i < num_attributes; ++i) {
+    hash_attribute(tag_state, i);
+  }
+}
+
+// Returns the index of the current tag's attribute with the given name, or -1
+// if it has none.
+static int find_attribute(
+    const GumboTagState* tag_state, const char* name, size_t length) {
+  const GumboVector* attributes = &tag_state->_attributes;
+  if (tag_state->_num_hashed_attributes == 0) {
+    for (unsigned int i = 0; i < attributes->length; ++i) {
+      const GumboAttribute* attr = attributes->data[i];
+      if (strlen(attr->name) == length &&
+          memcmp(attr->name, name, length) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  unsigned int mask = tag_state->_attribute_table_capacity - 1;
+  for (unsigned int slot = hash_attribute_name(name, length) & mask;
+       tag_state->_attribute_table[slot]; slot = (slot + 1) & mask) {
+    unsigned int index = tag_state->_attribute_table[slot] - 1;
+    const GumboAttribute* attr = attributes->data[index];
+    if (strlen(attr->name) == length &&
+        memcmp(attr->name, name, length) == 0) {
+      return index;
+    }
+  }
+  return -1;
 }
 
 // Creates a new attribute in the current tag, copying the current tag buffer to
@@ -787,19 +1051,22 @@ static bool finish_attribute_name(GumboParser* parser) {
   assert(tag_state->_attributes.capacity);
 
   GumboVector* /* GumboAttribute* */ attributes = &tag_state->_attributes;
-  for (unsigned int i = 0; i < attributes->length; ++i) {
-    GumboAttribute* attr = attributes->data[i];
-    if (strlen(attr->name) == tag_state->_buffer.length &&
-        memcmp(attr->name, tag_state->_buffer.data,
-            tag_state->_buffer.length) == 0) {
-      // Identical attribute; bail.
-      add_duplicate_attr_error(parser, attr->name, i, attributes->length);
-      tag_state->_drop_next_attr_value = true;
-      return false;
-    }
+  if (tag_state->_num_hashed_attributes == 0 &&
+      attributes->length > kMaxUnhashedAttributes) {
+    rehash_attributes(parser);
+  }
+  int index = find_attribute(
+      tag_state, tag_state->_buffer.data, tag_state->_buffer.length);
+  if (index != -1) {
+    // Identical attribute; bail.
+    GumboAttribute* attr = attributes->data[index];
+    add_duplicate_attr_error(parser, attr->name, index, attributes->length);
+    tag_state->_drop_next_attr_value = true;
+    return false;
   }
 
-  GumboAttribute* attr = gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+  GumboAttribute* attr =
+      gumbo_parser_allocate_object(parser, GUMBO_POOLED_ATTRIBUTE);
   attr->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
   copy_over_tag_buffer(parser, &attr->name);
   copy_over_original_tag_text(
@@ -807,8 +1074,16 @@ static bool finish_attribute_name(GumboParser* parser) {
   attr->value = gumbo_copy_stringz(parser, "");
   copy_over_original_tag_text(
       parser, &attr->original_value, &attr->name_start, &attr->name_end);
-  gumbo_vector_add(parser, attr, attributes);
-  reinitialize_tag_buffer(parser);
+  gumbo_vector_add_inline(
+      parser, attr, tag_state->_inline_attributes, attributes);
+  if (tag_state->_num_hashed_attributes > 0) {
+    if (2 * attributes->length > tag_state->_attribute_table_capacity) {
+      rehash_attributes(parser);
+    } else {
+      hash_attribute(tag_state, attributes->length - 1);
+    }
+  }
+  initialize_tag_buffer(parser);
   return true;
 }
 
@@ -820,7 +1095,7 @@ static void finish_attribute_value(GumboParser* parser) {
     // Duplicate attribute name detected in an earlier state, so we have to
     // ignore the value.
     tag_state->_drop_next_attr_value = false;
-    reinitialize_tag_buffer(parser);
+    initialize_tag_buffer(parser);
     return;
   }
 
@@ -830,7 +1105,7 @@ static void finish_attribute_value(GumboParser* parser) {
   copy_over_tag_buffer(parser, &attr->value);
   copy_over_original_tag_text(
       parser, &attr->original_value, &attr->value_start, &attr->value_end);
-  reinitialize_tag_buffer(parser);
+  initialize_tag_buffer(parser);
 }
 
 // Returns true if the current end tag matches the last start tag emitted.
@@ -845,27 +1120,81 @@ static bool is_appropriate_end_tag(GumboParser* parser) {
 void gumbo_tokenizer_state_init(
     GumboParser* parser, const char* text, size_t text_length) {
   GumboTokenizerState* tokenizer =
-      gumbo_parser_allocate(parser, sizeof(GumboTokenizerState));
+      gumbo_scratch_allocate(parser, sizeof(GumboTokenizerState));
   parser->_tokenizer_state = tokenizer;
+  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_tag_state._buffer);
+  tokenizer->_tag_state._attribute_table = NULL;
+  tokenizer->_tag_state._attribute_table_capacity = 0;
+  tokenizer->_tag_state._num_hashed_attributes = 0;
+  gumbo_tokenizer_state_reset(parser, text, text_length);
+}
+
+void gumbo_tokenizer_state_reset(
+    GumboParser* parser, const char* text, size_t text_length) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
   tokenizer->_reconsume_current_input = false;
   tokenizer->_is_current_node_foreign = false;
+  tokenizer->_allow_character_runs = false;
   tokenizer->_is_in_cdata = false;
   tokenizer->_tag_state._last_start_tag = GUMBO_TAG_LAST;
 
   tokenizer->_buffered_emit_char = kGumboNoChar;
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   tokenizer->_temporary_buffer_emit = NULL;
 
   mark_tag_state_as_empty(&tokenizer->_tag_state);
+  gumbo_string_buffer_clear(parser, &tokenizer->_tag_state._buffer);
 
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
   tokenizer->_token_start = text;
   utf8iterator_init(parser, text, text_length, &tokenizer->_input);
   utf8iterator_get_position(&tokenizer->_input, &tokenizer->_token_start_pos);
   doc_type_state_init(parser);
 }
 
+void gumbo_tokenizer_extend_input(
+    GumboParser* parser, const char* text_end, bool is_complete) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  // If the next token starts on a character that was held back, it starts
+  // wherever that character turns out to be, e.g. past the \r of a CRLF pair.
+  bool is_at_token_start =
+      tokenizer->_token_start ==
+      utf8iterator_get_char_pointer(&tokenizer->_input);
+  utf8iterator_extend(&tokenizer->_input, text_end, is_complete);
+  if (is_at_token_start) {
+    reset_token_start_point(tokenizer);
+  }
+}
+
+void gumbo_tokenizer_move_input(
+    GumboParser* parser, const GumboInputMove* move) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  utf8iterator_move(&tokenizer->_input, move->from, move->to);
+  gumbo_move_input_pointer(move, &tokenizer->_token_start);
+  GumboTagState* tag_state = &tokenizer->_tag_state;
+  gumbo_move_input_pointer(move, &tag_state->_original_text);
+  for (unsigned int i = 0; i < tag_state->_attributes.length; ++i) {
+    GumboAttribute* attr = tag_state->_attributes.data[i];
+    gumbo_move_input_pointer(move, &attr->original_name.data);
+    gumbo_move_input_pointer(move, &attr->original_value.data);
+  }
+}
+
+void gumbo_tokenizer_discard_partial_token(GumboParser* parser) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  if (tokenizer->_tag_state._attributes.data) {
+    abandon_current_tag(parser);
+  }
+  GumboTokenDocType* doc_type_state = &tokenizer->_doc_type_state;
+  gumbo_parser_deallocate(parser, (void*) doc_type_state->name);
+  gumbo_parser_deallocate(parser, (void*) doc_type_state->public_identifier);
+  gumbo_parser_deallocate(parser, (void*) doc_type_state->system_identifier);
+  doc_type_state_init(parser);
+}
+
 void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   assert(tokenizer->_doc_type_state.name == NULL);
@@ -873,7 +1202,12 @@ void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   assert(tokenizer->_doc_type_state.system_identifier == NULL);
   gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
   gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-  gumbo_parser_deallocate(parser, tokenizer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_tag_state._buffer);
+  if (tokenizer->_tag_state._attribute_table) {
+    gumbo_scratch_deallocate_sized(parser, tokenizer->_tag_state._attribute_table,
+        sizeof(unsigned int) * tokenizer->_tag_state._attribute_table_capacity);
+  }
+  gumbo_scratch_deallocate(parser, tokenizer);
 }
 
 void gumbo_tokenizer_set_state(GumboParser* parser, GumboTokenizerEnum state) {
@@ -883,12 +1217,16 @@ void gumbo_tokenizer_set_state(GumboParser* parser, GumboTokenizerEnum state) {
 void gumbo_tokenizer_set_is_current_node_foreign(
     GumboParser* parser, bool is_foreign) {
   if (is_foreign != parser->_tokenizer_state->_is_current_node_foreign) {
-    gumbo_debug("Toggling is_current_node_foreign to %s.\n",
+    gumbo_debug(parser, "Toggling is_current_node_foreign to %s.\n",
         is_foreign ? "true" : "false");
   }
   parser->_tokenizer_state->_is_current_node_foreign = is_foreign;
 }
 
+void gumbo_tokenizer_set_allow_character_runs(GumboParser* parser, bool allow) {
+  parser->_tokenizer_state->_allow_character_runs = allow;
+}
+
 // http://www.whatwg.org/specs/web-apps/current-work/complete5/tokenization.html#data-state
 static StateResult handle_data_state(GumboParser* parser,
     GumboTokenizerState* tokenizer, int c, GumboToken* output) {
@@ -910,7 +1248,7 @@ static StateResult handle_data_state(GumboParser* parser,
       emit_char(parser, c, output);
       return RETURN_ERROR;
     default:
-      return emit_current_char(parser, output);
+      return emit_current_char_or_run(parser, output);
   }
 }
 
@@ -939,7 +1277,7 @@ static StateResult handle_rcdata_state(GumboParser* parser,
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_char_or_run(parser, output);
   }
 }
 
@@ -964,7 +1302,7 @@ static StateResult handle_rawtext_state(GumboParser* parser,
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_char_or_run(parser, output);
   }
 }
 
@@ -982,7 +1320,7 @@ static StateResult handle_script_state(GumboParser* parser,
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_char_or_run(parser, output);
   }
 }
 
@@ -995,7 +1333,7 @@ static StateResult handle_plaintext_state(GumboParser* parser,
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_char_or_run(parser, output);
   }
 }
 
@@ -1088,7 +1426,10 @@ static StateResult handle_tag_name_state(GumboParser* parser,
       gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
       return NEXT_CHAR;
     default:
-      append_char_to_tag_buffer(parser, ensure_lowercase(c), true);
+      if (!append_run_to_tag_buffer(
+              parser, BYTE_CLASS_TAG_NAME, true, true)) {
+        append_char_to_tag_buffer(parser, ensure_lowercase(c), true);
+      }
       return NEXT_CHAR;
   }
 }
@@ -1190,14 +1531,15 @@ static StateResult handle_rawtext_end_tag_open_state(GumboParser* parser,
 static StateResult handle_rawtext_end_tag_name_state(GumboParser* parser,
     GumboTokenizerState* tokenizer, int c, GumboToken* output) {
   assert(tokenizer->_temporary_buffer.length >= 2);
-  gumbo_debug("Last end tag: %*s\n", (int) tokenizer->_tag_state._buffer.length,
+  gumbo_debug(parser, "Last end tag: %*s\n",
+      (int) tokenizer->_tag_state._buffer.length,
       tokenizer->_tag_state._buffer.data);
   if (is_alpha(c)) {
     append_char_to_tag_buffer(parser, ensure_lowercase(c), true);
     append_char_to_temporary_buffer(parser, c);
     return NEXT_CHAR;
   } else if (is_appropriate_end_tag(parser)) {
-    gumbo_debug("Is an appropriate end tag.\n");
+    gumbo_debug(parser, "Is an appropriate end tag.\n");
     switch (c) {
       case '\t':
       case '\n':
@@ -1674,7 +2016,10 @@ static StateResult handle_attr_name_state(GumboParser* parser,
       tokenizer_add_parse_error(parser, GUMBO_ERR_ATTR_NAME_INVALID);
     // Fall through.
     default:
-      append_char_to_tag_buffer(parser, ensure_lowercase(c), true);
+      if (!append_run_to_tag_buffer(
+              parser, BYTE_CLASS_ATTR_NAME, true, true)) {
+        append_char_to_tag_buffer(parser, ensure_lowercase(c), true);
+      }
       return NEXT_CHAR;
   }
 }
@@ -1791,7 +2136,10 @@ static StateResult handle_attr_value_double_quoted_state(GumboParser* parser,
       tokenizer->_reconsume_current_input = true;
       return NEXT_CHAR;
     default:
-      append_char_to_tag_buffer(parser, c, false);
+      if (!append_run_to_tag_buffer(
+              parser, BYTE_CLASS_ATTR_VALUE_DOUBLE_QUOTED, false, false)) {
+        append_char_to_tag_buffer(parser, c, false);
+      }
       return NEXT_CHAR;
   }
 }
@@ -1819,7 +2167,10 @@ static StateResult handle_attr_value_single_quoted_state(GumboParser* parser,
       tokenizer->_reconsume_current_input = true;
       return NEXT_CHAR;
     default:
-      append_char_to_tag_buffer(parser, c, false);
+      if (!append_run_to_tag_buffer(
+              parser, BYTE_CLASS_ATTR_VALUE_SINGLE_QUOTED, false, false)) {
+        append_char_to_tag_buffer(parser, c, false);
+      }
       return NEXT_CHAR;
   }
 }
@@ -1862,7 +2213,10 @@ static StateResult handle_attr_value_unquoted_state(GumboParser* parser,
       tokenizer_add_parse_error(parser, GUMBO_ERR_ATTR_UNQUOTED_EQUALS);
     // Fall through.
     default:
-      append_char_to_tag_buffer(parser, c, true);
+      if (!append_run_to_tag_buffer(
+              parser, BYTE_CLASS_ATTR_VALUE_UNQUOTED, false, true)) {
+        append_char_to_tag_buffer(parser, c, true);
+      }
       return NEXT_CHAR;
   }
 }
@@ -1964,16 +2318,18 @@ static StateResult handle_self_closing_start_tag_state(GumboParser* parser,
 // http://www.whatwg.org/specs/web-apps/current-work/complete.html#bogus-comment-state
 static StateResult handle_bogus_comment_state(GumboParser* parser,
     GumboTokenizerState* tokenizer, int c, GumboToken* output) {
-  while (c != '>' && c != -1) {
-    if (c == '\0') {
-      c = 0xFFFD;
-    }
-    append_char_to_temporary_buffer(parser, c);
-    utf8iterator_next(&tokenizer->_input);
-    c = utf8iterator_current(&tokenizer->_input);
+  switch (c) {
+    case '>':
+    case -1:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
+      return emit_comment(parser, output);
+    case '\0':
+      append_char_to_temporary_buffer(parser, kUtf8ReplacementChar);
+      return NEXT_CHAR;
+    default:
+      append_char_to_temporary_buffer(parser, c);
+      return NEXT_CHAR;
   }
-  gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
-  return emit_comment(parser, output);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete.html#markup-declaration-open-state
@@ -2088,7 +2444,10 @@ static StateResult handle_comment_state(GumboParser* parser,
       emit_comment(parser, output);
       return RETURN_ERROR;
     default:
-      append_char_to_temporary_buffer(parser, c);
+      if (!append_run(parser, BYTE_CLASS_COMMENT, false,
+              &tokenizer->_temporary_buffer)) {
+        append_char_to_temporary_buffer(parser, c);
+      }
       return NEXT_CHAR;
   }
 }
@@ -2809,6 +3168,42 @@ static GumboLexerStateFunction dispatch_table[] = {handle_data_state,
     handle_after_doctype_system_id_state, handle_bogus_doctype_state,
     handle_cdata_state};
 
+// While input is being fed in, the tokenizer holds off on any character it
+// might have to look past the end of the available input to handle.  This is
+// enough lookahead for the longest named character reference and every
+// keyword the tokenizer matches; the digits of a numeric character reference
+// and the letters and digits scanned for an invalid named one are unbounded, so
+// they are checked separately, up to the character that ends them.  That
+// character has to be clear of the 4 bytes the iterator holds back.
+static const int kFedInputLookahead = 64;
+
+static bool is_alnum(int c) {
+  return is_alpha(c) || (c >= '0' && c <= '9');
+}
+
+static bool needs_more_input(const Utf8Iterator* input) {
+  const char* c = utf8iterator_get_char_pointer(input);
+  const char* end = utf8iterator_get_end_pointer(input);
+  if (end - c < kFedInputLookahead) {
+    return true;
+  }
+  if (c[0] != '&') {
+    return false;
+  }
+  if (c[1] == '#') {
+    c += (c[2] == 'x' || c[2] == 'X') ? 3 : 2;
+    while (c < end && is_hex_digit(*c)) {
+      ++c;
+    }
+  } else {
+    ++c;
+    while (c < end && is_alnum(*c)) {
+      ++c;
+    }
+  }
+  return end - c < 4;
+}
+
 bool gumbo_lex(GumboParser* parser, GumboToken* output) {
   // Because of the spec requirements that...
   //
@@ -2844,8 +3239,13 @@ bool gumbo_lex(GumboParser* parser, GumboToken* output) {
   while (1) {
     assert(!tokenizer->_temporary_buffer_emit);
     assert(tokenizer->_buffered_emit_char == kGumboNoChar);
+    if (!utf8iterator_is_complete(&tokenizer->_input) &&
+        needs_more_input(&tokenizer->_input)) {
+      output->type = GUMBO_TOKEN_NEED_INPUT;
+      return true;
+    }
     int c = utf8iterator_current(&tokenizer->_input);
-    gumbo_debug(
+    gumbo_debug(parser,
         "Lexing character '%c' (%d) in state %d.\n", c, c, tokenizer->_state);
     StateResult result =
         dispatch_table[tokenizer->_state](parser, tokenizer, c, output);
@@ -2885,8 +3285,8 @@ void gumbo_token_destroy(GumboParser* parser, GumboToken* token) {
           gumbo_destroy_attribute(parser, attr);
         }
       }
-      gumbo_parser_deallocate(
-          parser, (void*) token->v.start_tag.attributes.data);
+      gumbo_vector_destroy_inline(parser, token->v.start_tag._inline_attributes,
+          &token->v.start_tag.attributes);
       return;
     case GUMBO_TOKEN_COMMENT:
       gumbo_parser_deallocate(parser, (void*) token->v.text);
@@ -2895,3 +3295,96 @@ void gumbo_token_destroy(GumboParser* parser, GumboToken* token) {
       return;
   }
 }
+
+void gumbo_token_move_attributes(GumboParser* parser, GumboToken* token,
+    void** inline_data, GumboVector* attributes) {
+  assert(token->type == GUMBO_TOKEN_START_TAG);
+  move_attribute_vector(token->v.start_tag._inline_attributes,
+      &token->v.start_tag.attributes, inline_data, attributes);
+}
+
+struct GumboInternalTokenizer {
+  GumboOptions _options;
+  GumboParser _parser;
+
+  // Where the tokenizer would record its errors.  They're only counted, or
+  // passed to the error handler, so the list stays empty.
+  GumboOutput _output;
+
+  // The token last returned, which is destroyed on the next call.
+  GumboToken _token;
+
+  // Whether the EOF token has been returned.
+  bool _is_done;
+};
+
+GumboTokenizer* gumbo_tokenizer_create(
+    const GumboOptions* options, const char* buffer, size_t buffer_length) {
+  GumboTokenizer* tokenizer =
+      options->allocator(options->userdata, sizeof(GumboTokenizer));
+  tokenizer->_options = *options;
+  if (!options->error_handler) {
+    tokenizer->_options.max_errors = 0;
+  }
+  GumboParser* parser = &tokenizer->_parser;
+  parser->_options = &tokenizer->_options;
+  parser->_output = &tokenizer->_output;
+  parser->_parser_state = NULL;
+  parser->_arena = NULL;
+  parser->_pool = NULL;
+  gumbo_init_errors(parser);
+  gumbo_tokenizer_state_init(parser, buffer, buffer_length);
+  gumbo_tokenizer_set_allow_character_runs(parser, true);
+  // An EOF token owns nothing, so there's nothing to destroy before the first
+  // one is read.
+  tokenizer->_token.type = GUMBO_TOKEN_EOF;
+  tokenizer->_is_done = false;
+  return tokenizer;
+}
+
+const GumboToken* gumbo_tokenizer_next(GumboTokenizer* tokenizer) {
+  GumboParser* parser = &tokenizer->_parser;
+  if (tokenizer->_is_done) {
+    return NULL;
+  }
+  gumbo_token_destroy(parser, &tokenizer->_token);
+  gumbo_lex(parser, &tokenizer->_token);
+  assert(tokenizer->_token.type != GUMBO_TOKEN_NEED_INPUT);
+  tokenizer->_is_done = tokenizer->_token.type == GUMBO_TOKEN_EOF;
+  return &tokenizer->_token;
+}
+
+void gumbo_tokenizer_set_mode(
+    GumboTokenizer* tokenizer, GumboTokenizerMode mode) {
+  GumboParser* parser = &tokenizer->_parser;
+  switch (mode) {
+    case GUMBO_TOKENIZER_MODE_DATA:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
+      return;
+    case GUMBO_TOKENIZER_MODE_RCDATA:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_RCDATA);
+      return;
+    case GUMBO_TOKENIZER_MODE_RAWTEXT:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_RAWTEXT);
+      return;
+    case GUMBO_TOKENIZER_MODE_SCRIPT_DATA:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT);
+      return;
+    case GUMBO_TOKENIZER_MODE_PLAINTEXT:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_PLAINTEXT);
+      return;
+  }
+}
+
+void gumbo_tokenizer_set_foreign_content(
+    GumboTokenizer* tokenizer, bool is_foreign) {
+  gumbo_tokenizer_set_is_current_node_foreign(&tokenizer->_parser, is_foreign);
+}
+
+void gumbo_tokenizer_destroy(GumboTokenizer* tokenizer) {
+  GumboParser* parser = &tokenizer->_parser;
+  gumbo_token_destroy(parser, &tokenizer->_token);
+  gumbo_tokenizer_state_destroy(parser);
+  gumbo_vector_destroy(parser, &tokenizer->_output.errors);
+  tokenizer->_options.deallocator(tokenizer->_options.userdata, tokenizer);
+}
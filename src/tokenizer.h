@@ -24,56 +24,44 @@
 #include <stddef.h>
 
 #include "gumbo.h"
-#include "token_type.h"
 #include "tokenizer_states.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct GumboInternalInputMove;
 struct GumboInternalParser;
 
-// Struct containing all information pertaining to doctype tokens.
-typedef struct GumboInternalTokenDocType {
-  const char* name;
-  const char* public_identifier;
-  const char* system_identifier;
-  bool force_quirks;
-  // There's no way to tell a 0-length public or system ID apart from the
-  // absence of a public or system ID, but they're handled different by the
-  // spec, so we need bool flags for them.
-  bool has_public_identifier;
-  bool has_system_identifier;
-} GumboTokenDocType;
-
-// Struct containing all information pertaining to start tag tokens.
-typedef struct GumboInternalTokenStartTag {
-  GumboTag tag;
-  GumboVector /* GumboAttribute */ attributes;
-  bool is_self_closing;
-} GumboTokenStartTag;
-
-// A data structure representing a single token in the input stream.  This
-// contains an enum for the type, the source position, a GumboStringPiece
-// pointing to the original text, and then a union for any parsed data.
-typedef struct GumboInternalToken {
-  GumboTokenType type;
-  GumboSourcePosition position;
-  GumboStringPiece original_text;
-  union {
-    GumboTokenDocType doc_type;
-    GumboTokenStartTag start_tag;
-    GumboTag end_tag;
-    const char* text;  // For comments.
-    int character;     // For character, whitespace, null, and EOF tokens.
-  } v;
-} GumboToken;
-
 // Initializes the tokenizer state within the GumboParser object, setting up a
 // parse of the specified text.
 void gumbo_tokenizer_state_init(
     struct GumboInternalParser* parser, const char* text, size_t text_length);
 
+// Re-initializes an existing tokenizer state for a parse of the specified text,
+// keeping its scratch buffers (and their capacity) around for reuse.
+void gumbo_tokenizer_state_reset(
+    struct GumboInternalParser* parser, const char* text, size_t text_length);
+
+// Moves the end of the input being tokenized to text_end, for input that is fed
+// in incrementally: such a parse starts out with an empty input that isn't
+// complete.  While the input isn't complete, gumbo_lex returns a
+// GUMBO_TOKEN_NEED_INPUT token instead of reading anywhere near its end, and
+// resumes exactly where it left off once it has been extended.
+void gumbo_tokenizer_extend_input(struct GumboInternalParser* parser,
+    const char* text_end, bool is_complete);
+
+// Points the tokenizer at fed input that has been moved to a bigger buffer, so
+// that it carries on from the same place in the copy, with any token that it's
+// in the middle of.
+void gumbo_tokenizer_move_input(struct GumboInternalParser* parser,
+    const struct GumboInternalInputMove* move);
+
+// Frees any token that the tokenizer is in the middle of, so that a parse can
+// be abandoned before the end of its input.  The tokenizer must be reset
+// before it's used again.
+void gumbo_tokenizer_discard_partial_token(struct GumboInternalParser* parser);
+
 // Destroys the tokenizer state within the GumboParser object, freeing any
 // dynamically-allocated structures within it.
 void gumbo_tokenizer_state_destroy(struct GumboInternalParser* parser);
@@ -91,6 +79,15 @@ void gumbo_tokenizer_set_state(
 void gumbo_tokenizer_set_is_current_node_foreign(
     struct GumboInternalParser* parser, bool is_foreign);
 
+// Flags whether the next token may be a GUMBO_TOKEN_CHARACTER_RUN.  A run
+// stands for a maximal stretch of text in the data, RCDATA, RAWTEXT, script
+// data, or PLAINTEXT states that contains no character references, NULs,
+// carriage returns, or decoding errors; its text is exactly its original_text.
+// The parser allows runs only in insertion modes that don't look at individual
+// characters.  Off by default.
+void gumbo_tokenizer_set_allow_character_runs(
+    struct GumboInternalParser* parser, bool allow);
+
 // Lexes a single token from the specified buffer, filling the output with the
 // parsed GumboToken data structure.  Returns true for a successful
 // tokenization, false if a parse error occurs.
@@ -116,6 +113,13 @@ bool gumbo_lex(struct GumboInternalParser* parser, GumboToken* output);
 // freed.
 void gumbo_token_destroy(struct GumboInternalParser* parser, GumboToken* token);
 
+// Moves the attributes of a start tag token into a vector with inline storage
+// for GUMBO_INLINE_ATTRIBUTES of them, such as an element's, leaving the token
+// with none.  Attributes that the token keeps in its own inline storage are
+// copied over.
+void gumbo_token_move_attributes(struct GumboInternalParser* parser,
+    GumboToken* token, void** inline_data, GumboVector* attributes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,10 +17,25 @@
 #include "utf8.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>  // For strncasecmp.
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GUMBO_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(GUMBO_HAVE_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define GUMBO_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "error.h"
 #include "gumbo.h"
 #include "parser.h"
@@ -102,11 +117,10 @@ uint32_t static inline decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
 static void add_error(Utf8Iterator* iter, GumboErrorType type) {
   GumboParser* parser = iter->_parser;
 
-  GumboError* error = gumbo_add_error(parser);
+  GumboError* error = gumbo_add_error(parser, type);
   if (!error) {
     return;
   }
-  error->type = type;
   error->position = iter->_pos;
   error->original_text = iter->_start;
 
@@ -118,6 +132,667 @@ static void add_error(Utf8Iterator* iter, GumboErrorType type) {
     code_point = (code_point << 8) | (unsigned char) iter->_start[i];
   }
   error->v.codepoint = code_point;
+  gumbo_finish_error(parser, error);
+}
+
+// Scanning kernels, for utf8iterator_skip_text and for validation below.
+//
+// In the tokenizer's text states, the only bytes that matter are '<', '&', NUL,
+// '\r', and the ones that read_char might turn into something else or flag as
+// an error: other control characters, DEL, and everything outside ASCII.  A run
+// of any other bytes can be consumed without going through the decoder, and
+// its effect on the source position only depends on its line feeds and tabs.
+//
+// Each text kernel returns the length of the longest prefix of [begin, end) that
+// consists of such plain bytes, stores the number of '\n' in that prefix in
+// *newlines, and stores a pointer just past the last of them (or begin, if
+// there are none) in *line_start.
+
+static bool is_plain_text_byte(unsigned char c) {
+  return (c >= 0x20 && c < 0x7F && c != '<' && c != '&') || c == '\t' ||
+         c == '\n' || c == '\f';
+}
+
+static size_t scan_text_scalar(const char* begin, const char* end,
+    int* newlines, const char** line_start) {
+  const char* c = begin;
+  for (; c < end && is_plain_text_byte((unsigned char) *c); ++c) {
+    if (*c == '\n') {
+      ++*newlines;
+      *line_start = c + 1;
+    }
+  }
+  return c - begin;
+}
+
+// The ASCII kernels, used by validation, return the length of the longest
+// prefix of [begin, end) that is all ASCII.
+static size_t scan_ascii_scalar(const char* begin, const char* end) {
+  const char* c = begin;
+  while (c < end && (unsigned char) *c < 0x80) {
+    ++c;
+  }
+  return c - begin;
+}
+
+// The line kernels, used by GumboLineIndex, return the length of the longest
+// prefix of [begin, end) that contains no '\n' or '\r'.
+static size_t scan_line_scalar(const char* begin, const char* end) {
+  const char* c = begin;
+  while (c < end && *c != '\n' && *c != '\r') {
+    ++c;
+  }
+  return c - begin;
+}
+
+// Returns the length of the well-formed multi-byte sequence at c, or 0 if it's
+// malformed or runs past end.  This accepts exactly what the DFA does; see the
+// table in RFC 3629, section 4.
+static int valid_sequence_length(
+    const unsigned char* c, const unsigned char* end) {
+  int length;
+  unsigned char second_min = 0x80;
+  unsigned char second_max = 0xBF;
+  if (*c >= 0xC2 && *c <= 0xDF) {
+    length = 2;
+  } else if (*c >= 0xE0 && *c <= 0xEF) {
+    length = 3;
+    if (*c == 0xE0) {
+      second_min = 0xA0;  // Overlong.
+    } else if (*c == 0xED) {
+      second_max = 0x9F;  // Surrogates.
+    }
+  } else if (*c >= 0xF0 && *c <= 0xF4) {
+    length = 4;
+    if (*c == 0xF0) {
+      second_min = 0x90;  // Overlong.
+    } else if (*c == 0xF4) {
+      second_max = 0x8F;  // Past U+10FFFF.
+    }
+  } else {
+    return 0;
+  }
+  if (end - c < length || c[1] < second_min || c[1] > second_max) {
+    return 0;
+  }
+  for (int i = 2; i < length; ++i) {
+    if ((c[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+// The validation kernels return the length of the longest prefix of
+// [begin, end) that is well-formed UTF-8, which ends at a character boundary.
+// begin must be at one.
+static size_t validate_with(size_t (*scan_ascii)(const char*, const char*),
+    const char* begin, const char* end) {
+  const unsigned char* c = (const unsigned char*) begin;
+  while (c < (const unsigned char*) end) {
+    if (*c < 0x80) {
+      c += scan_ascii((const char*) c, end);
+    } else {
+      int length = valid_sequence_length(c, (const unsigned char*) end);
+      if (!length) {
+        break;
+      }
+      c += length;
+    }
+  }
+  return (const char*) c - begin;
+}
+
+static size_t validate_scalar(const char* begin, const char* end) {
+  return validate_with(scan_ascii_scalar, begin, end);
+}
+
+// The multi-byte kernels take well-formed UTF-8, such as a prefix that passed
+// validation, and return the length of its longest prefix that consists of
+// non-ASCII characters that read_char passes through unchanged, adding the
+// number of those characters to *characters.  So they stop at ASCII, and at
+// the lead byte of a character that HTML forbids: C1 controls and
+// noncharacters.  To keep the checks simple, they also stop at the rest of
+// U+FDC0 to U+FDFF and of the last 64 code points of each supplementary plane,
+// and at U+FFFD, which read_char uses for decoding errors.  begin doesn't have
+// to be at a character boundary, as long as the bytes before it are part of
+// such a character.
+static bool is_special_multibyte(const unsigned char* c) {
+  switch (c[0]) {
+    case 0xC2:
+      return c[1] < 0xA0;  // U+0080 to U+009F.
+    case 0xEF:
+      // U+FDC0 to U+FDFF, and U+FFFD to U+FFFF.
+      return c[1] == 0xB7 || (c[1] == 0xBF && c[2] >= 0xBD);
+    default:
+      // U+xFFC0 to U+xFFFF.
+      return c[0] >= 0xF0 && (c[1] & 0x0F) == 0x0F && c[2] == 0xBF;
+  }
+}
+
+static size_t scan_multibyte_scalar(
+    const char* begin, const char* end, size_t* characters) {
+  const unsigned char* c = (const unsigned char*) begin;
+  for (; c < (const unsigned char*) end && *c >= 0x80; ++c) {
+    if (*c >= 0xC0) {
+      if (is_special_multibyte(c)) {
+        break;
+      }
+      ++*characters;
+    }
+  }
+  return (const char*) c - begin;
+}
+
+#ifdef GUMBO_HAVE_SSE2
+static int count_trailing_zeros(uint32_t mask) {
+  assert(mask);
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int) index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+static int find_last_set(uint32_t mask) {
+  assert(mask);
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return (int) index;
+#else
+  return 31 - __builtin_clz(mask);
+#endif
+}
+
+static int count_set_bits(uint32_t mask) {
+#ifdef _MSC_VER
+  int count = 0;
+  for (; mask; mask &= mask - 1) {
+    ++count;
+  }
+  return count;
+#else
+  return __builtin_popcount(mask);
+#endif
+}
+
+// Accounts for the line feeds in the first 'length' bytes of a block whose
+// line feeds are marked in 'newline_mask'.
+static void count_block_newlines(const char* block, uint32_t newline_mask,
+    int length, int* newlines, const char** line_start) {
+  if (length < 32) {
+    newline_mask &= (1u << length) - 1;
+  }
+  if (newline_mask) {
+    *newlines += count_set_bits(newline_mask);
+    *line_start = block + find_last_set(newline_mask) + 1;
+  }
+}
+
+static size_t scan_text_sse2(const char* begin, const char* end,
+    int* newlines, const char** line_start) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i del = _mm_set1_epi8(0x7F);
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i ff = _mm_set1_epi8('\f');
+  const char* block = begin;
+  for (; end - block >= 16; block += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*) block);
+    __m128i is_lf = _mm_cmpeq_epi8(bytes, lf);
+    // The comparison is signed, so this also catches every non-ASCII byte.
+    __m128i special = _mm_or_si128(
+        _mm_cmplt_epi8(bytes, space), _mm_cmpeq_epi8(bytes, del));
+    special = _mm_andnot_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, tab), is_lf),
+            _mm_cmpeq_epi8(bytes, ff)),
+        special);
+    special = _mm_or_si128(special,
+        _mm_or_si128(_mm_cmpeq_epi8(bytes, lt), _mm_cmpeq_epi8(bytes, amp)));
+    uint32_t stop_mask = (uint32_t) _mm_movemask_epi8(special);
+    uint32_t newline_mask = (uint32_t) _mm_movemask_epi8(is_lf);
+    int length = stop_mask ? count_trailing_zeros(stop_mask) : 16;
+    count_block_newlines(block, newline_mask, length, newlines, line_start);
+    if (stop_mask) {
+      return block + length - begin;
+    }
+  }
+  return block - begin + scan_text_scalar(block, end, newlines, line_start);
+}
+
+static size_t scan_ascii_sse2(const char* begin, const char* end) {
+  const char* block = begin;
+  for (; end - block >= 16; block += 16) {
+    uint32_t mask = (uint32_t) _mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i*) block));
+    if (mask) {
+      return block + count_trailing_zeros(mask) - begin;
+    }
+  }
+  return block - begin + scan_ascii_scalar(block, end);
+}
+
+static size_t scan_line_sse2(const char* begin, const char* end) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const char* block = begin;
+  for (; end - block >= 16; block += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*) block);
+    uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(bytes, lf), _mm_cmpeq_epi8(bytes, cr)));
+    if (mask) {
+      return block + count_trailing_zeros(mask) - begin;
+    }
+  }
+  return block - begin + scan_line_scalar(block, end);
+}
+
+// SSE2 has no byte shuffle to validate multi-byte sequences with, so this
+// only speeds up the ASCII in between.
+static size_t validate_sse2(const char* begin, const char* end) {
+  return validate_with(scan_ascii_sse2, begin, end);
+}
+
+// The comparisons below are signed, so for instance 'greater than (char) 0xBF'
+// means 'ASCII or a lead byte'.
+static size_t scan_multibyte_sse2(
+    const char* begin, const char* end, size_t* characters) {
+  const __m128i c2 = _mm_set1_epi8((char) 0xC2);
+  const __m128i ef = _mm_set1_epi8((char) 0xEF);
+  const __m128i b7 = _mm_set1_epi8((char) 0xB7);
+  const __m128i bf = _mm_set1_epi8((char) 0xBF);
+  const __m128i high_nibble = _mm_set1_epi8((char) 0xF0);
+  const char* block = begin;
+  // Each byte is checked along with the two after it.
+  for (; end - block >= 18; block += 16) {
+    __m128i first = _mm_loadu_si128((const __m128i*) block);
+    __m128i second = _mm_loadu_si128((const __m128i*) (block + 1));
+    __m128i third = _mm_loadu_si128((const __m128i*) (block + 2));
+    // ASCII.
+    __m128i stop = _mm_cmpgt_epi8(first, _mm_set1_epi8(-1));
+    // U+0080 to U+009F.
+    stop = _mm_or_si128(stop, _mm_and_si128(_mm_cmpeq_epi8(first, c2),
+        _mm_cmplt_epi8(second, _mm_set1_epi8((char) 0xA0))));
+    // U+FDC0 to U+FDFF, and U+FFFD to U+FFFF.
+    __m128i ends_bmp = _mm_or_si128(_mm_cmpeq_epi8(second, b7),
+        _mm_and_si128(_mm_cmpeq_epi8(second, bf),
+            _mm_cmpgt_epi8(third, _mm_set1_epi8((char) 0xBC))));
+    stop = _mm_or_si128(
+        stop, _mm_and_si128(_mm_cmpeq_epi8(first, ef), ends_bmp));
+    // U+xFFC0 to U+xFFFF.
+    __m128i ends_plane = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_or_si128(second, high_nibble), _mm_set1_epi8(-1)),
+        _mm_cmpeq_epi8(third, bf));
+    stop = _mm_or_si128(
+        stop, _mm_and_si128(_mm_cmpgt_epi8(first, ef), ends_plane));
+    uint32_t stop_mask = (uint32_t) _mm_movemask_epi8(stop);
+    uint32_t lead_mask =
+        (uint32_t) _mm_movemask_epi8(_mm_cmpgt_epi8(first, bf));
+    int length = stop_mask ? count_trailing_zeros(stop_mask) : 16;
+    *characters += count_set_bits(lead_mask & ((1u << length) - 1));
+    if (stop_mask) {
+      return block + length - begin;
+    }
+  }
+  return block - begin + scan_multibyte_scalar(block, end, characters);
+}
+#endif  // GUMBO_HAVE_SSE2
+
+#ifdef GUMBO_HAVE_AVX2
+__attribute__((target("avx2"))) static size_t scan_text_avx2(
+    const char* begin, const char* end, int* newlines,
+    const char** line_start) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i ff = _mm256_set1_epi8('\f');
+  const char* block = begin;
+  for (; end - block >= 32; block += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*) block);
+    __m256i is_lf = _mm256_cmpeq_epi8(bytes, lf);
+    // space > bytes is signed, so this also catches every non-ASCII byte.
+    __m256i special = _mm256_or_si256(
+        _mm256_cmpgt_epi8(space, bytes), _mm256_cmpeq_epi8(bytes, del));
+    special = _mm256_andnot_si256(
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, tab), is_lf),
+            _mm256_cmpeq_epi8(bytes, ff)),
+        special);
+    special = _mm256_or_si256(special, _mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, lt), _mm256_cmpeq_epi8(bytes, amp)));
+    uint32_t stop_mask = (uint32_t) _mm256_movemask_epi8(special);
+    uint32_t newline_mask = (uint32_t) _mm256_movemask_epi8(is_lf);
+    int length = stop_mask ? count_trailing_zeros(stop_mask) : 32;
+    count_block_newlines(block, newline_mask, length, newlines, line_start);
+    if (stop_mask) {
+      return block + length - begin;
+    }
+  }
+  return block - begin + scan_text_sse2(block, end, newlines, line_start);
+}
+
+__attribute__((target("avx2"))) static size_t scan_ascii_avx2(
+    const char* begin, const char* end) {
+  const char* block = begin;
+  for (; end - block >= 32; block += 32) {
+    uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+        _mm256_loadu_si256((const __m256i*) block));
+    if (mask) {
+      return block + count_trailing_zeros(mask) - begin;
+    }
+  }
+  return block - begin + scan_ascii_sse2(block, end);
+}
+
+__attribute__((target("avx2"))) static size_t scan_line_avx2(
+    const char* begin, const char* end) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const char* block = begin;
+  for (; end - block >= 32; block += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*) block);
+    uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, lf), _mm256_cmpeq_epi8(bytes, cr)));
+    if (mask) {
+      return block + count_trailing_zeros(mask) - begin;
+    }
+  }
+  return block - begin + scan_line_sse2(block, end);
+}
+
+// Multi-byte validation with the lookup tables of "Validating UTF-8 In Less
+// Than One Instruction Per Byte" by John Keiser and Daniel Lemire.  Each of
+// the first two bytes of a pair contributes a table entry, looked up by its
+// high and low nibbles for the first and by its high nibble for the second,
+// of the errors the pair might be; the pair is one of them if all three
+// entries have it.
+enum {
+  kTooShort = 1 << 0,      // 11______ 0_______, 11______ 11______
+  kTooLong = 1 << 1,       // 0_______ 10______
+  kOverlong3 = 1 << 2,     // 11100000 100_____
+  kTooLarge = 1 << 3,      // 11110100 1001____, 11110100 101_____,
+                           // 11110101-11111111 1001____ or 101_____
+  kSurrogate = 1 << 4,     // 11101101 101_____
+  kOverlong2 = 1 << 5,     // 1100000_ 10______
+  kTooLarge1000 = 1 << 6,  // 11110101-11111111 1000____
+  kOverlong4 = 1 << 6,     // 11110000 1000____
+  kTwoContinuations = 1 << 7,  // 10______ 10______
+  kCarry = kTooShort | kTooLong | kTwoContinuations
+};
+
+static const uint8_t kFirstByteHigh[16] = {
+    // 0_______: ASCII.
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTooLong,
+    // 10______: a continuation byte.
+    kTwoContinuations, kTwoContinuations, kTwoContinuations,
+    kTwoContinuations,
+    // 1100____ and 1101____: the lead byte of a two-byte sequence.
+    kTooShort | kOverlong2, kTooShort,
+    // 1110____: three bytes.
+    kTooShort | kOverlong3 | kSurrogate,
+    // 1111____: four bytes.
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4};
+
+static const uint8_t kFirstByteLow[16] = {
+    // ____0000
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    // ____0001
+    kCarry | kOverlong2,
+    // ____001_
+    kCarry, kCarry,
+    // ____0100
+    kCarry | kTooLarge,
+    // ____0101 to ____1100
+    kCarry | kTooLarge | kTooLarge1000, kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000, kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000, kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000, kCarry | kTooLarge | kTooLarge1000,
+    // ____1101
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    // ____111_
+    kCarry | kTooLarge | kTooLarge1000, kCarry | kTooLarge | kTooLarge1000};
+
+static const uint8_t kSecondByteHigh[16] = {
+    // 0_______: ASCII.
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooShort, kTooShort,
+    // 1000____
+    kTooLong | kOverlong2 | kTwoContinuations | kOverlong3 | kTooLarge1000 |
+        kOverlong4,
+    // 1001____
+    kTooLong | kOverlong2 | kTwoContinuations | kOverlong3 | kTooLarge,
+    // 101_____
+    kTooLong | kOverlong2 | kTwoContinuations | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoContinuations | kSurrogate | kTooLarge,
+    // 11______: a lead byte.
+    kTooShort, kTooShort, kTooShort, kTooShort};
+
+__attribute__((target("avx2"))) static __m256i lookup_nibbles_avx2(
+    const uint8_t* table, __m256i nibbles) {
+  return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*) table)), nibbles);
+}
+
+// Returns nonzero bytes wherever the 32 bytes of 'input', which follow the 32
+// of 'previous', aren't well-formed UTF-8 so far.
+__attribute__((target("avx2"))) static __m256i find_utf8_errors_avx2(
+    __m256i input, __m256i previous) {
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  // The input shifted by one, two, and three bytes, with the end of
+  // 'previous' shifted in.
+  __m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+  __m256i previous1 = _mm256_alignr_epi8(input, carried, 15);
+  __m256i previous2 = _mm256_alignr_epi8(input, carried, 14);
+  __m256i previous3 = _mm256_alignr_epi8(input, carried, 13);
+
+  __m256i errors = _mm256_and_si256(
+      _mm256_and_si256(
+          lookup_nibbles_avx2(kFirstByteHigh,
+              _mm256_and_si256(_mm256_srli_epi16(previous1, 4), nibble)),
+          lookup_nibbles_avx2(
+              kFirstByteLow, _mm256_and_si256(previous1, nibble))),
+      lookup_nibbles_avx2(kSecondByteHigh,
+          _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+  // The pairs of continuation bytes are only right as the third or fourth
+  // bytes of a sequence, where the tables have no say.
+  __m256i is_third = _mm256_subs_epu8(previous2, _mm256_set1_epi8(0xE0 - 0x80));
+  __m256i is_fourth =
+      _mm256_subs_epu8(previous3, _mm256_set1_epi8(0xF0 - 0x80));
+  __m256i must_be_continuation = _mm256_and_si256(
+      _mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char) 0x80));
+  return _mm256_xor_si256(errors, must_be_continuation);
+}
+
+__attribute__((target("avx2"))) static size_t validate_avx2(
+    const char* begin, const char* end) {
+  __m256i previous = _mm256_setzero_si256();
+  const char* block = begin;
+  for (; end - block >= 32; block += 32) {
+    __m256i input = _mm256_loadu_si256((const __m256i*) block);
+    // All-ASCII input after all-ASCII input is fine.
+    if (_mm256_movemask_epi8(_mm256_or_si256(input, previous))) {
+      __m256i errors = find_utf8_errors_avx2(input, previous);
+      if (!_mm256_testz_si256(errors, errors)) {
+        break;
+      }
+    }
+    previous = input;
+  }
+  // Everything before the block is fine, except maybe for a character that it
+  // ends in the middle of, so the other kernel takes over from that
+  // character's lead byte, and finds the error in the block, if any.
+  const unsigned char* c = (const unsigned char*) block;
+  while ((const char*) c > begin && block - (const char*) c < 3 &&
+         (c[-1] & 0xC0) == 0x80) {
+    --c;
+  }
+  if ((const char*) c > begin && c[-1] >= 0xC0) {
+    --c;
+  }
+  return (const char*) c - begin + validate_sse2((const char*) c, end);
+}
+
+__attribute__((target("avx2"))) static size_t scan_multibyte_avx2(
+    const char* begin, const char* end, size_t* characters) {
+  const __m256i c2 = _mm256_set1_epi8((char) 0xC2);
+  const __m256i ef = _mm256_set1_epi8((char) 0xEF);
+  const __m256i b7 = _mm256_set1_epi8((char) 0xB7);
+  const __m256i bf = _mm256_set1_epi8((char) 0xBF);
+  const __m256i high_nibble = _mm256_set1_epi8((char) 0xF0);
+  const char* block = begin;
+  for (; end - block >= 34; block += 32) {
+    __m256i first = _mm256_loadu_si256((const __m256i*) block);
+    __m256i second = _mm256_loadu_si256((const __m256i*) (block + 1));
+    __m256i third = _mm256_loadu_si256((const __m256i*) (block + 2));
+    // See scan_multibyte_sse2.
+    __m256i stop = _mm256_cmpgt_epi8(first, _mm256_set1_epi8(-1));
+    stop = _mm256_or_si256(stop, _mm256_and_si256(_mm256_cmpeq_epi8(first, c2),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char) 0xA0), second)));
+    __m256i ends_bmp = _mm256_or_si256(_mm256_cmpeq_epi8(second, b7),
+        _mm256_and_si256(_mm256_cmpeq_epi8(second, bf),
+            _mm256_cmpgt_epi8(third, _mm256_set1_epi8((char) 0xBC))));
+    stop = _mm256_or_si256(
+        stop, _mm256_and_si256(_mm256_cmpeq_epi8(first, ef), ends_bmp));
+    __m256i ends_plane = _mm256_and_si256(
+        _mm256_cmpeq_epi8(
+            _mm256_or_si256(second, high_nibble), _mm256_set1_epi8(-1)),
+        _mm256_cmpeq_epi8(third, bf));
+    stop = _mm256_or_si256(
+        stop, _mm256_and_si256(_mm256_cmpgt_epi8(first, ef), ends_plane));
+    uint32_t stop_mask = (uint32_t) _mm256_movemask_epi8(stop);
+    uint32_t lead_mask =
+        (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(first, bf));
+    if (stop_mask) {
+      int length = count_trailing_zeros(stop_mask);
+      *characters += count_set_bits(lead_mask & ((1u << length) - 1));
+      return block + length - begin;
+    }
+    *characters += count_set_bits(lead_mask);
+  }
+  return block - begin + scan_multibyte_sse2(block, end, characters);
+}
+#endif  // GUMBO_HAVE_AVX2
+
+static const Utf8Kernels kScalarKernels = {"scalar", scan_text_scalar,
+    scan_ascii_scalar, scan_line_scalar, validate_scalar,
+    scan_multibyte_scalar};
+#ifdef GUMBO_HAVE_SSE2
+static const Utf8Kernels kSse2Kernels = {"sse2", scan_text_sse2,
+    scan_ascii_sse2, scan_line_sse2, validate_sse2, scan_multibyte_sse2};
+#endif
+#ifdef GUMBO_HAVE_AVX2
+static const Utf8Kernels kAvx2Kernels = {"avx2", scan_text_avx2,
+    scan_ascii_avx2, scan_line_avx2, validate_avx2, scan_multibyte_avx2};
+#endif
+
+static const Utf8Kernels* select_fastest_kernels(void) {
+#ifdef GUMBO_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return &kAvx2Kernels;
+  }
+#endif
+#ifdef GUMBO_HAVE_SSE2
+  return &kSse2Kernels;
+#else
+  return &kScalarKernels;
+#endif
+}
+
+// Every compiled-in set, fastest first.  AVX2 is the only one that needs
+// checking for at run time, so when the CPU lacks it the list starts one
+// entry later.
+static const Utf8Kernels* const kAvailableKernels[] = {
+#ifdef GUMBO_HAVE_AVX2
+    &kAvx2Kernels,
+#endif
+#ifdef GUMBO_HAVE_SSE2
+    &kSse2Kernels,
+#endif
+    &kScalarKernels, NULL};
+
+const Utf8Kernels* const* utf8_available_kernels(void) {
+#ifdef GUMBO_HAVE_AVX2
+  if (!__builtin_cpu_supports("avx2")) {
+    return kAvailableKernels + 1;
+  }
+#endif
+  return kAvailableKernels;
+}
+
+// Validation.  Input is checked for well-formed UTF-8 a block at a time, just
+// ahead of where it's read, so that read_char can decode everything in
+// [_valid_begin, _valid_end) without the DFA.  Anything that fails validation,
+// like a malformed or truncated sequence, is left to the DFA, which reports it
+// exactly as before; validation then resumes after it.
+static const size_t kValidationBlockSize = 4096;
+
+// Validates the block starting at 'start', a character boundary.
+static void validate_block(Utf8Iterator* iter, const char* start) {
+  const char* limit = iter->_end;
+  if ((size_t)(limit - start) > kValidationBlockSize) {
+    limit = start + kValidationBlockSize;
+  }
+  iter->_valid_begin = start;
+  iter->_valid_end = start + iter->_kernels->validate(start, limit);
+}
+
+// Sets the current character to a decoded code point, applying the HTML5
+// rules for carriage returns and reporting code points that HTML forbids.
+static void set_current_char(Utf8Iterator* iter, uint32_t code_point) {
+  // This is the special handling for carriage returns that is mandated by
+  // the HTML5 spec.  Since we're looking for particular 7-bit literal
+  // characters, we operate in terms of chars and only need a check for iter
+  // overrun, instead of having to read in a full next code point.
+  // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#preprocessing-the-input-stream
+  if (code_point == '\r') {
+    assert(iter->_width == 1);
+    const char* next = iter->_start + 1;
+    if (next < iter->_end && *next == '\n') {
+      // Advance the iter, as if the carriage return didn't exist.
+      ++iter->_start;
+      // Preserve the true offset, since other tools that look at it may be
+      // unaware of HTML5's rules for converting \r into \n.
+      ++iter->_pos.offset;
+    }
+    code_point = '\n';
+  }
+  // Printable ASCII is by far the most common case, and never invalid.
+  if ((code_point < 0x20 || code_point >= 0x7F) &&
+      utf8_is_invalid_code_point(code_point)) {
+    add_error(iter, GUMBO_ERR_UTF8_INVALID);
+    code_point = kUtf8ReplacementChar;
+  }
+  iter->_current = code_point;
+}
+
+// Reads a character from validated input, which needs none of the DFA's checks.
+static void read_valid_char(Utf8Iterator* iter) {
+  const unsigned char* c = (const unsigned char*) iter->_start;
+  uint32_t code_point;
+  if (c[0] < 0x80) {
+    iter->_width = 1;
+    code_point = c[0];
+  } else if (c[0] < 0xE0) {
+    iter->_width = 2;
+    code_point = ((c[0] & 0x1Fu) << 6) | (c[1] & 0x3Fu);
+  } else if (c[0] < 0xF0) {
+    iter->_width = 3;
+    code_point =
+        ((c[0] & 0x0Fu) << 12) | ((c[1] & 0x3Fu) << 6) | (c[2] & 0x3Fu);
+  } else {
+    iter->_width = 4;
+    code_point = ((c[0] & 0x07u) << 18) | ((c[1] & 0x3Fu) << 12) |
+                 ((c[2] & 0x3Fu) << 6) | (c[3] & 0x3Fu);
+  }
+  set_current_char(iter, code_point);
 }
 
 // Reads the next UTF-8 character in the iter.
@@ -125,6 +800,13 @@ static void add_error(Utf8Iterator* iter, GumboErrorType type) {
 // When this method returns, iter->_width and iter->_current will be set
 // appropriately, as well as any error flags.
 static void read_char(Utf8Iterator* iter) {
+  // A character this close to the end of incomplete input might be a
+  // truncated sequence or the \r of a CRLF pair; hold off on it.
+  if (!iter->_is_complete && iter->_end - iter->_start < 4) {
+    iter->_current = -1;
+    iter->_width = 0;
+    return;
+  }
   if (iter->_start >= iter->_end) {
     // No input left to consume; emit an EOF and set width = 0.
     iter->_current = -1;
@@ -132,34 +814,21 @@ static void read_char(Utf8Iterator* iter) {
     return;
   }
 
+  if (iter->_start < iter->_valid_begin || iter->_start >= iter->_valid_end) {
+    validate_block(iter, iter->_start);
+  }
+  if (iter->_start < iter->_valid_end) {
+    read_valid_char(iter);
+    return;
+  }
+
   uint32_t code_point = 0;
   uint32_t state = UTF8_ACCEPT;
   for (const char* c = iter->_start; c < iter->_end; ++c) {
     decode(&state, &code_point, (uint32_t)(unsigned char) (*c));
     if (state == UTF8_ACCEPT) {
       iter->_width = c - iter->_start + 1;
-      // This is the special handling for carriage returns that is mandated by
-      // the HTML5 spec.  Since we're looking for particular 7-bit literal
-      // characters, we operate in terms of chars and only need a check for iter
-      // overrun, instead of having to read in a full next code point.
-      // http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#preprocessing-the-input-stream
-      if (code_point == '\r') {
-        assert(iter->_width == 1);
-        const char* next = c + 1;
-        if (next < iter->_end && *next == '\n') {
-          // Advance the iter, as if the carriage return didn't exist.
-          ++iter->_start;
-          // Preserve the true offset, since other tools that look at it may be
-          // unaware of HTML5's rules for converting \r into \n.
-          ++iter->_pos.offset;
-        }
-        code_point = '\n';
-      }
-      if (utf8_is_invalid_code_point(code_point)) {
-        add_error(iter, GUMBO_ERR_UTF8_INVALID);
-        code_point = kUtf8ReplacementChar;
-      }
-      iter->_current = code_point;
+      set_current_char(iter, code_point);
       return;
     } else if (state == UTF8_REJECT) {
       // We don't want to consume the invalid continuation byte of a multi-byte
@@ -182,6 +851,9 @@ static void read_char(Utf8Iterator* iter) {
 
 static void update_position(Utf8Iterator* iter) {
   iter->_pos.offset += iter->_width;
+  if (iter->_offsets_only) {
+    return;
+  }
   if (iter->_current == '\n') {
     ++iter->_pos.line;
     iter->_pos.column = 1;
@@ -201,17 +873,71 @@ bool utf8_is_invalid_code_point(int c) {
          ((c & 0xFFFF) == 0xFFFE) || ((c & 0xFFFF) == 0xFFFF);
 }
 
+unsigned int utf8_column(
+    const char* line_start, const char* position, int tab_stop) {
+  unsigned int column = 1;
+  const char* c = line_start;
+  while (c < position) {
+    if (*c == '\t') {
+      column = ((column / tab_stop) + 1) * tab_stop;
+      ++c;
+      continue;
+    }
+    if (*c == '\r') {
+      // The iterator skips the '\r' of a CRLF pair; any other would have
+      // ended the line.
+      ++c;
+      continue;
+    }
+    ++column;
+    if ((unsigned char) *c < 0x80) {
+      ++c;
+      continue;
+    }
+    // Steps over one character, valid or not, with the same width that
+    // read_char gives it.
+    uint32_t code_point = 0;
+    uint32_t state = UTF8_ACCEPT;
+    const char* d = c;
+    for (; d < position; ++d) {
+      decode(&state, &code_point, (uint32_t)(unsigned char) (*d));
+      if (state == UTF8_ACCEPT) {
+        ++d;
+        break;
+      } else if (state == UTF8_REJECT) {
+        d += (d == c);
+        break;
+      }
+    }
+    c = d;
+  }
+  return column;
+}
+
 void utf8iterator_init(GumboParser* parser, const char* source,
     size_t source_length, Utf8Iterator* iter) {
   iter->_start = source;
   iter->_end = source + source_length;
-  iter->_pos.line = 1;
-  iter->_pos.column = 1;
+  iter->_offsets_only = parser->_options->offsets_only;
+  iter->_pos.line = iter->_offsets_only ? 0 : 1;
+  iter->_pos.column = iter->_offsets_only ? 0 : 1;
   iter->_pos.offset = 0;
   iter->_parser = parser;
+  iter->_kernels = select_fastest_kernels();
+  iter->_valid_begin = source;
+  iter->_valid_end = source;
+  iter->_is_complete = true;
   read_char(iter);
 }
 
+void utf8iterator_set_kernels(
+    Utf8Iterator* iter, const Utf8Kernels* kernels) {
+  iter->_kernels = kernels;
+  // Has what's ahead validated again, by the new set.
+  iter->_valid_begin = iter->_start;
+  iter->_valid_end = iter->_start;
+}
+
 void utf8iterator_next(Utf8Iterator* iter) {
   // We update positions based on the *last* character read, so that the first
   // character following a newline is at column 1 in the next line.
@@ -220,6 +946,122 @@ void utf8iterator_next(Utf8Iterator* iter) {
   read_char(iter);
 }
 
+// Moves the iterator to text_end, over a run of plain text that contains
+// 'newlines' line feeds, the last of which ends just before line_start, and
+// 'continuation_bytes' bytes after that which continue a multi-byte character.
+static void skip_plain_text(Utf8Iterator* iter, const char* text_end,
+    int newlines, const char* line_start, size_t continuation_bytes) {
+  iter->_pos.offset += text_end - iter->_start;
+  if (iter->_offsets_only) {
+    iter->_start = text_end;
+    read_char(iter);
+    return;
+  }
+  if (newlines) {
+    iter->_pos.line += newlines;
+    iter->_pos.column = 1;
+  }
+  size_t last_line_length = text_end - line_start;
+  if (!memchr(line_start, '\t', last_line_length)) {
+    iter->_pos.column += (unsigned int) (last_line_length - continuation_bytes);
+  } else {
+    int tab_stop = iter->_parser->_options->tab_stop;
+    for (const char* c = line_start; c < text_end; ++c) {
+      if (*c == '\t') {
+        iter->_pos.column = ((iter->_pos.column / tab_stop) + 1) * tab_stop;
+      } else if (((unsigned char) *c & 0xC0) != 0x80) {
+        ++iter->_pos.column;
+      }
+    }
+  }
+  iter->_start = text_end;
+  read_char(iter);
+}
+
+bool utf8iterator_skip_text(Utf8Iterator* iter) {
+  // This looks at the byte rather than the decoded character, so a lone '\r'
+  // (read as '\n') is left alone.  The '\n' of a CRLF pair is fine: _start
+  // already points at it.
+  const char* c = iter->_start;
+  int newlines = 0;
+  const char* line_start = c;
+  size_t continuation_bytes = 0;
+  // ASCII and non-ASCII text take turns.  Non-ASCII text is only skipped once
+  // it's validated.
+  while (c < iter->_end) {
+    if (is_plain_text_byte((unsigned char) *c)) {
+      int run_newlines = 0;
+      c += iter->_kernels->scan_text(c, iter->_end, &run_newlines, &line_start);
+      if (run_newlines) {
+        newlines += run_newlines;
+        continuation_bytes = 0;
+      }
+      continue;
+    }
+    if ((unsigned char) *c < 0x80) {
+      break;
+    }
+    if (c < iter->_valid_begin || c >= iter->_valid_end) {
+      validate_block(iter, c);
+    }
+    size_t characters = 0;
+    size_t length =
+        iter->_kernels->scan_multibyte(c, iter->_valid_end, &characters);
+    if (!length) {
+      break;
+    }
+    c += length;
+    continuation_bytes += length - characters;
+  }
+  if (c == iter->_start) {
+    return false;
+  }
+  skip_plain_text(iter, c, newlines, line_start, continuation_bytes);
+  return true;
+}
+
+size_t utf8iterator_skip_class(
+    Utf8Iterator* iter, const unsigned char* classes, unsigned char mask) {
+  int newlines = 0;
+  const char* line_start = iter->_start;
+  const char* c = iter->_start;
+  for (; c < iter->_end && (classes[(unsigned char) *c] & mask); ++c) {
+    assert(is_plain_text_byte((unsigned char) *c) || *c == '<' || *c == '&');
+    if (*c == '\n') {
+      ++newlines;
+      line_start = c + 1;
+    }
+  }
+  size_t length = c - iter->_start;
+  if (length > 0) {
+    skip_plain_text(iter, c, newlines, line_start, 0);
+  }
+  return length;
+}
+
+void utf8iterator_extend(Utf8Iterator* iter, const char* end, bool is_complete) {
+  assert(end >= iter->_end);
+  iter->_end = end;
+  iter->_is_complete = is_complete;
+  if (iter->_width == 0) {
+    // The current character was held back, or was the end of the input.
+    read_char(iter);
+  }
+}
+
+void utf8iterator_move(
+    Utf8Iterator* iter, const char* old_input, const char* new_input) {
+  iter->_start = new_input + (iter->_start - old_input);
+  iter->_mark = new_input + (iter->_mark - old_input);
+  iter->_end = new_input + (iter->_end - old_input);
+  iter->_valid_begin = new_input + (iter->_valid_begin - old_input);
+  iter->_valid_end = new_input + (iter->_valid_end - old_input);
+}
+
+bool utf8iterator_is_complete(const Utf8Iterator* iter) {
+  return iter->_is_complete;
+}
+
 int utf8iterator_current(const Utf8Iterator* iter) { return iter->_current; }
 
 void utf8iterator_get_position(
@@ -268,3 +1110,86 @@ void utf8iterator_fill_error_at_mark(Utf8Iterator* iter, GumboError* error) {
   error->position = iter->_mark_pos;
   error->original_text = iter->_mark;
 }
+
+struct GumboInternalLineIndex {
+  GumboOptions _options;
+  const char* _buffer;
+  unsigned int _buffer_length;
+
+  // The offsets at which the lines start, in increasing order.  The first line
+  // always starts at 0.
+  unsigned int* _line_starts;
+  unsigned int _num_lines;
+  unsigned int _capacity;
+};
+
+static void add_line_start(GumboLineIndex* index, unsigned int offset) {
+  if (index->_num_lines == index->_capacity) {
+    unsigned int capacity = index->_capacity * 2;
+    index->_line_starts = gumbo_options_reallocate(&index->_options,
+        index->_line_starts, sizeof(unsigned int) * index->_capacity,
+        sizeof(unsigned int) * capacity);
+    index->_capacity = capacity;
+  }
+  index->_line_starts[index->_num_lines++] = offset;
+}
+
+GumboLineIndex* gumbo_line_index_create(
+    const GumboOptions* options, const char* buffer, size_t buffer_length) {
+  // Offsets are unsigned ints, like GumboSourcePosition.offset.
+  assert(buffer_length <= UINT_MAX);
+  GumboLineIndex* index =
+      options->allocator(options->userdata, sizeof(GumboLineIndex));
+  index->_options = *options;
+  index->_buffer = buffer;
+  index->_buffer_length = (unsigned int) buffer_length;
+  // Guesses at lines of about 64 bytes, which is typical of markup.
+  index->_capacity = (unsigned int) (buffer_length / 64) + 1;
+  index->_line_starts = options->allocator(
+      options->userdata, sizeof(unsigned int) * index->_capacity);
+  index->_num_lines = 0;
+  add_line_start(index, 0);
+
+  const Utf8Kernels* kernels = select_fastest_kernels();
+  const char* end = buffer + buffer_length;
+  const char* c = buffer;
+  while ((c += kernels->scan_line(c, end)) < end) {
+    // As in set_current_char, a CRLF pair is a single line break.
+    if (*c == '\r' && c + 1 < end && c[1] == '\n') {
+      ++c;
+    }
+    ++c;
+    add_line_start(index, (unsigned int) (c - buffer));
+  }
+  return index;
+}
+
+void gumbo_line_index_resolve(
+    const GumboLineIndex* index, GumboSourcePosition* position) {
+  unsigned int offset = position->offset;
+  assert(offset <= index->_buffer_length);
+  // Finds the last line that starts at or before the offset:
+  // _line_starts[low] <= offset < _line_starts[high], where a high of
+  // _num_lines stands for the end of the buffer.
+  const unsigned int* line_starts = index->_line_starts;
+  unsigned int low = 0;
+  unsigned int high = index->_num_lines;
+  while (high - low > 1) {
+    unsigned int middle = low + (high - low) / 2;
+    if (line_starts[middle] <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  position->line = low + 1;
+  position->column = utf8_column(index->_buffer + line_starts[low],
+      index->_buffer + offset, index->_options.tab_stop);
+}
+
+void gumbo_line_index_destroy(GumboLineIndex* index) {
+  gumbo_options_deallocate_sized(&index->_options, index->_line_starts,
+      sizeof(unsigned int) * index->_capacity);
+  gumbo_options_deallocate_sized(
+      &index->_options, index, sizeof(GumboLineIndex));
+}
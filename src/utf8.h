@@ -47,6 +47,25 @@ struct GumboInternalParser;
 // Unicode replacement char.
 extern const int kUtf8ReplacementChar;
 
+// The scanning kernels for one instruction set; see utf8.c for what each of
+// them does.
+typedef struct GumboInternalUtf8Kernels {
+  // The instruction set: "scalar", "sse2", or "avx2".
+  const char* name;
+  size_t (*scan_text)(const char* begin, const char* end, int* newlines,
+      const char** line_start);
+  size_t (*scan_ascii)(const char* begin, const char* end);
+  size_t (*scan_line)(const char* begin, const char* end);
+  size_t (*validate)(const char* begin, const char* end);
+  size_t (*scan_multibyte)(
+      const char* begin, const char* end, size_t* characters);
+} Utf8Kernels;
+
+// Returns the kernel sets that are compiled in and that this CPU supports,
+// fastest (the one used by default) first and scalar last, followed by NULL.
+// For tests, which check that they all agree.
+const Utf8Kernels* const* utf8_available_kernels(void);
+
 typedef struct GumboInternalUtf8Iterator {
   // Points at the start of the code point most recently read into 'current'.
   const char* _start;
@@ -73,20 +92,85 @@ typedef struct GumboInternalUtf8Iterator {
   // Pointer back to the GumboParser instance, for configuration options and
   // error recording.
   struct GumboInternalParser* _parser;
+
+  // The scanning kernels, picked for this CPU at init.
+  const Utf8Kernels* _kernels;
+
+  // The input in [_valid_begin, _valid_end) is known to be well-formed UTF-8,
+  // and can be decoded without the DFA.
+  const char* _valid_begin;
+  const char* _valid_end;
+
+  // False while more input may still be appended at _end; see
+  // utf8iterator_extend.
+  bool _is_complete;
+
+  // Set from GumboOptions.offsets_only: only _pos.offset is kept up to date,
+  // and the line and column stay 0.
+  bool _offsets_only;
 } Utf8Iterator;
 
 // Returns true if this Unicode code point is in the list of characters
 // forbidden by the HTML5 spec, such as NUL bytes and undefined control chars.
 bool utf8_is_invalid_code_point(int c);
 
+// Returns the column of the character at 'position' on the line that starts
+// at line_start, counting the characters in between the way the iterator
+// does.  There should be no line breaks between the two, other than the '\r'
+// of a CRLF pair whose '\n' is at 'position'.
+unsigned int utf8_column(
+    const char* line_start, const char* position, int tab_stop);
+
 // Initializes a new Utf8Iterator from the given byte buffer.  The source does
 // not have to be NUL-terminated, but the length must be passed in explicitly.
 void utf8iterator_init(struct GumboInternalParser* parser, const char* source,
     size_t source_length, Utf8Iterator* iter);
 
+// Makes the iterator use 'kernels', one of the sets from
+// utf8_available_kernels, instead of the fastest one.  For tests.
+void utf8iterator_set_kernels(
+    Utf8Iterator* iter, const Utf8Kernels* kernels);
+
+// Moves the end of the input to 'end', which must not be before the current
+// end, for input that is being fed in incrementally.  Until the input is
+// marked complete, the iterator won't decode a character it can't be sure of
+// without seeing more input, i.e. one within 4 bytes of the end: it reads as
+// -1 with a width of 0, the same as the end of the input, and is read for real
+// once there is more input after it.  Note that an iterator starts out
+// complete, so an incrementally fed one should start out empty.
+void utf8iterator_extend(Utf8Iterator* iter, const char* end, bool is_complete);
+
+// Points the iterator at a copy of its input, which started at old_input and
+// has been copied to new_input, leaving it in the same place within it.
+void utf8iterator_move(
+    Utf8Iterator* iter, const char* old_input, const char* new_input);
+
+// Returns false if the input may still be extended.
+bool utf8iterator_is_complete(const Utf8Iterator* iter);
+
 // Advances the current position by one code point.
 void utf8iterator_next(Utf8Iterator* iter);
 
+// If the current character is plain text - anything printable but '<' and
+// '&', plus tabs, line feeds and form feeds, and well-formed non-ASCII
+// characters that HTML allows - advances past it and every such character
+// directly after it, exactly as repeated utf8iterator_next calls would but
+// without decoding them one by one.  Returns false, doing nothing, otherwise.
+// Everything that can change the tokenizer's behavior in the text states
+// (markup, character references, NULs, carriage returns, and anything that
+// might be a decoding error or a forbidden code point) stops the skip, as does
+// U+FFFD, which the tokenizer can't tell apart from a decoding error.
+bool utf8iterator_skip_text(Utf8Iterator* iter);
+
+// Advances past the longest run of bytes at the current position that have
+// any of the bits in 'mask' set in the 256-entry 'classes' table, exactly as
+// repeated utf8iterator_next calls would, and returns its length (0 if the
+// current byte isn't one of them).  The table may only admit bytes that the
+// iterator passes through unchanged: printable ASCII, tabs, line feeds, and
+// form feeds.
+size_t utf8iterator_skip_class(
+    Utf8Iterator* iter, const unsigned char* classes, unsigned char mask);
+
 // Returns the current code point as an integer.
 int utf8iterator_current(const Utf8Iterator* iter);
 
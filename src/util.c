@@ -17,14 +17,17 @@
 #include "util.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "gumbo.h"
 #include "parser.h"
+#include "pool.h"
 
 // TODO(jdtang): This should be elsewhere, but there's no .c file for
 // SourcePositions and yet the constant needs some linkage, so this is as good
@@ -32,27 +35,140 @@
 const GumboSourcePosition kGumboEmptySourcePosition = {0, 0, 0};
 
 void* gumbo_parser_allocate(GumboParser* parser, size_t num_bytes) {
+  if (parser->_arena) {
+    return gumbo_arena_malloc(parser->_options, parser->_arena, num_bytes);
+  }
   return parser->_options->allocator(parser->_options->userdata, num_bytes);
 }
 
 void gumbo_parser_deallocate(GumboParser* parser, void* ptr) {
+  if (parser->_arena) {
+    return;
+  }
   parser->_options->deallocator(parser->_options->userdata, ptr);
 }
 
+void* gumbo_scratch_allocate(GumboParser* parser, size_t num_bytes) {
+  return parser->_options->allocator(parser->_options->userdata, num_bytes);
+}
+
+void gumbo_scratch_deallocate(GumboParser* parser, void* ptr) {
+  parser->_options->deallocator(parser->_options->userdata, ptr);
+}
+
+// The default reallocator and sized deallocator only go with the default
+// allocator and deallocator, so that options which replace just those keep
+// working as before.
+static bool has_reallocator(const GumboOptions* options) {
+  return options->reallocator &&
+         (options->reallocator != kGumboDefaultOptions.reallocator ||
+             options->allocator == kGumboDefaultOptions.allocator);
+}
+
+static bool has_sized_deallocator(const GumboOptions* options) {
+  return options->sized_deallocator &&
+         (options->sized_deallocator != kGumboDefaultOptions.sized_deallocator ||
+             options->deallocator == kGumboDefaultOptions.deallocator);
+}
+
+void* gumbo_options_reallocate(const GumboOptions* options, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes) {
+  if (has_reallocator(options)) {
+    return options->reallocator(
+        options->userdata, ptr, old_num_bytes, new_num_bytes);
+  }
+  void* result = options->allocator(options->userdata, new_num_bytes);
+  memcpy(result, ptr,
+      old_num_bytes < new_num_bytes ? old_num_bytes : new_num_bytes);
+  gumbo_options_deallocate_sized(options, ptr, old_num_bytes);
+  return result;
+}
+
+void gumbo_options_deallocate_sized(
+    const GumboOptions* options, void* ptr, size_t num_bytes) {
+  if (has_sized_deallocator(options)) {
+    options->sized_deallocator(options->userdata, ptr, num_bytes);
+  } else {
+    options->deallocator(options->userdata, ptr);
+  }
+}
+
+void* gumbo_parser_reallocate(GumboParser* parser, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes) {
+  if (parser->_arena) {
+    void* result =
+        gumbo_arena_malloc(parser->_options, parser->_arena, new_num_bytes);
+    memcpy(result, ptr,
+        old_num_bytes < new_num_bytes ? old_num_bytes : new_num_bytes);
+    return result;
+  }
+  return gumbo_options_reallocate(
+      parser->_options, ptr, old_num_bytes, new_num_bytes);
+}
+
+void gumbo_parser_deallocate_sized(
+    GumboParser* parser, void* ptr, size_t num_bytes) {
+  if (parser->_arena) {
+    return;
+  }
+  gumbo_options_deallocate_sized(parser->_options, ptr, num_bytes);
+}
+
+void* gumbo_scratch_reallocate(GumboParser* parser, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes) {
+  return gumbo_options_reallocate(
+      parser->_options, ptr, old_num_bytes, new_num_bytes);
+}
+
+void gumbo_scratch_deallocate_sized(
+    GumboParser* parser, void* ptr, size_t num_bytes) {
+  gumbo_options_deallocate_sized(parser->_options, ptr, num_bytes);
+}
+
+void* gumbo_parser_allocate_object(GumboParser* parser, GumboPooledType type) {
+  if (parser->_pool) {
+    return gumbo_pool_malloc(parser->_options, parser->_pool, type);
+  }
+  return gumbo_parser_allocate(parser, gumbo_pool_object_size(type));
+}
+
+void gumbo_parser_deallocate_object(
+    GumboParser* parser, GumboPooledType type, void* ptr) {
+  if (parser->_pool) {
+    gumbo_pool_free(parser->_pool, type, ptr);
+    return;
+  }
+  gumbo_parser_deallocate_sized(parser, ptr, gumbo_pool_object_size(type));
+}
+
+void gumbo_move_input_pointer(const GumboInputMove* move, const char** pointer) {
+  // Pointers before 'from' wrap around to offsets past the end.
+  uintptr_t offset = (uintptr_t) *pointer - (uintptr_t) move->from;
+  if (offset <= move->length) {
+    *pointer = move->to + offset;
+  }
+}
+
 char* gumbo_copy_stringz(GumboParser* parser, const char* str) {
   char* buffer = gumbo_parser_allocate(parser, strlen(str) + 1);
   strcpy(buffer, str);
   return buffer;
 }
 
-// Debug function to trace operation of the parser.  Pass --copts=-DGUMBO_DEBUG
-// to use.
-void gumbo_debug(const char* format, ...) {
 #ifdef GUMBO_DEBUG
+void gumbo_debug(GumboParser* parser, const char* format, ...) {
   va_list args;
   va_start(args, format);
-  vprintf(format, args);
+  GumboTraceFunction trace = parser->_options->trace;
+  if (trace) {
+    // Longer messages are truncated, which is fine for tracing.
+    char message[512];
+    vsnprintf(message, sizeof(message), format, args);
+    trace(parser->_options->userdata, message);
+  } else {
+    vprintf(format, args);
+    fflush(stdout);
+  }
   va_end(args);
-  fflush(stdout);
-#endif
 }
+#endif
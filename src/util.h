@@ -25,6 +25,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "gumbo.h"
+#include "pool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,17 +44,75 @@ struct GumboInternalParser;
 char* gumbo_copy_stringz(struct GumboInternalParser* parser, const char* str);
 
 // Allocate a chunk of memory, using the allocator specified in the Parser's
-// config options.
+// config options, or the parser's arena if it has one.
 void* gumbo_parser_allocate(
     struct GumboInternalParser* parser, size_t num_bytes);
 
 // Deallocate a chunk of memory, using the deallocator specified in the Parser's
-// config options.
+// config options.  A no-op when the parser has an arena.
 void gumbo_parser_deallocate(struct GumboInternalParser* parser, void* ptr);
 
-// Debug wrapper for printf, to make it easier to turn off debugging info when
-// required.
-void gumbo_debug(const char* format, ...);
+// Allocate & deallocate scratch memory that never ends up in the parse output,
+// such as the tokenizer and tree-construction state and string buffers.  These
+// always go to the allocator in the config options, bypassing any arena, so
+// that buffers which grow and shrink during the parse don't strand memory in
+// it.
+void* gumbo_scratch_allocate(
+    struct GumboInternalParser* parser, size_t num_bytes);
+void gumbo_scratch_deallocate(struct GumboInternalParser* parser, void* ptr);
+
+// Resize & free blocks whose size is known, using the reallocator and sized
+// deallocator in the config options where they go with the allocator (see
+// GumboOptions.reallocator).  Otherwise, blocks are resized by allocating a new
+// one, copying, and freeing the old one.  The parser variants carve the new
+// block out of the parser's arena if it has one.
+void* gumbo_parser_reallocate(struct GumboInternalParser* parser, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes);
+void gumbo_parser_deallocate_sized(
+    struct GumboInternalParser* parser, void* ptr, size_t num_bytes);
+void* gumbo_scratch_reallocate(struct GumboInternalParser* parser, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes);
+void gumbo_scratch_deallocate_sized(
+    struct GumboInternalParser* parser, void* ptr, size_t num_bytes);
+
+// The same for memory that isn't tied to a parser, such as pool slabs.
+void* gumbo_options_reallocate(const GumboOptions* options, void* ptr,
+    size_t old_num_bytes, size_t new_num_bytes);
+void gumbo_options_deallocate_sized(
+    const GumboOptions* options, void* ptr, size_t num_bytes);
+
+// Allocate & deallocate one of the structs that the parse tree has the most of:
+// from the parser's pool if it has one, and otherwise as with
+// gumbo_parser_allocate.
+void* gumbo_parser_allocate_object(
+    struct GumboInternalParser* parser, GumboPooledType type);
+void gumbo_parser_deallocate_object(
+    struct GumboInternalParser* parser, GumboPooledType type, void* ptr);
+
+// Fed input that has been copied from 'from' to a bigger buffer at 'to',
+// while everything that points into its first 'length' bytes, or just past
+// them, is moved over.  Both buffers must be bigger than 'length', so that
+// neither range takes in the start of the other buffer.
+typedef struct GumboInternalInputMove {
+  const char* from;
+  size_t length;
+  const char* to;
+} GumboInputMove;
+
+// Moves *pointer over to the copy of the input if it points into the part
+// that was copied or just past it, and leaves it alone otherwise.
+void gumbo_move_input_pointer(const GumboInputMove* move, const char** pointer);
+
+// Traces the operation of the parser, printf-style, to GumboOptions.trace or
+// else stdout.  This only exists in builds with GUMBO_DEBUG defined; otherwise
+// calls compile to nothing, arguments and all, so they cost nothing in the hot
+// loops and their arguments mustn't have side effects.
+#ifdef GUMBO_DEBUG
+void gumbo_debug(
+    struct GumboInternalParser* parser, const char* format, ...);
+#else
+#define gumbo_debug(...) ((void) 0)
+#endif
 
 #ifdef __cplusplus
 }
@@ -39,41 +39,103 @@ void gumbo_vector_init(struct GumboInternalParser* parser,
   }
 }
 
+void gumbo_vector_init_inline(void** inline_data,
+    unsigned int inline_capacity, GumboVector* vector) {
+  vector->data = inline_data;
+  vector->length = 0;
+  vector->capacity = inline_capacity;
+}
+
 void gumbo_vector_destroy(
     struct GumboInternalParser* parser, GumboVector* vector) {
   if (vector->capacity > 0) {
-    gumbo_parser_deallocate(parser, vector->data);
+    gumbo_parser_deallocate_sized(
+        parser, vector->data, sizeof(void*) * vector->capacity);
   }
 }
 
-static void enlarge_vector_if_full(
-    struct GumboInternalParser* parser, GumboVector* vector) {
+void gumbo_vector_destroy_inline(struct GumboInternalParser* parser,
+    void** inline_data, GumboVector* vector) {
+  if (vector->data != inline_data) {
+    gumbo_vector_destroy(parser, vector);
+  }
+}
+
+// Allocates and reallocates vector storage from the parser's output, or, for
+// scratch vectors, with the allocator even while the parser has an arena.
+static void* allocate_data(
+    struct GumboInternalParser* parser, bool scratch, size_t num_bytes) {
+  return scratch ? gumbo_scratch_allocate(parser, num_bytes)
+                 : gumbo_parser_allocate(parser, num_bytes);
+}
+
+static void* reallocate_data(struct GumboInternalParser* parser, bool scratch,
+    void* data, size_t old_num_bytes, size_t num_bytes) {
+  return scratch
+             ? gumbo_scratch_reallocate(parser, data, old_num_bytes, num_bytes)
+             : gumbo_parser_reallocate(parser, data, old_num_bytes, num_bytes);
+}
+
+// Makes room for one more element, leaving any inline storage behind.
+static void enlarge_vector_if_full(struct GumboInternalParser* parser,
+    bool scratch, void** inline_data, GumboVector* vector) {
   if (vector->length >= vector->capacity) {
     if (vector->capacity) {
       size_t old_num_bytes = sizeof(void*) * vector->capacity;
       vector->capacity *= 2;
       size_t num_bytes = sizeof(void*) * vector->capacity;
-      void** temp = gumbo_parser_allocate(parser, num_bytes);
-      memcpy(temp, vector->data, old_num_bytes);
-      gumbo_parser_deallocate(parser, vector->data);
-      vector->data = temp;
+      if (vector->data != inline_data) {
+        vector->data = reallocate_data(
+            parser, scratch, vector->data, old_num_bytes, num_bytes);
+      } else {
+        void** temp = allocate_data(parser, scratch, num_bytes);
+        memcpy(temp, vector->data, old_num_bytes);
+        vector->data = temp;
+      }
     } else {
       // 0-capacity vector; no previous array to deallocate.
       vector->capacity = 2;
       vector->data =
-          gumbo_parser_allocate(parser, sizeof(void*) * vector->capacity);
+          allocate_data(parser, scratch, sizeof(void*) * vector->capacity);
     }
   }
 }
 
-void gumbo_vector_add(
-    struct GumboInternalParser* parser, void* element, GumboVector* vector) {
-  enlarge_vector_if_full(parser, vector);
+static void add_element(struct GumboInternalParser* parser, bool scratch,
+    void* element, void** inline_data, GumboVector* vector) {
+  enlarge_vector_if_full(parser, scratch, inline_data, vector);
   assert(vector->data);
   assert(vector->length < vector->capacity);
   vector->data[vector->length++] = element;
 }
 
+static void insert_element(struct GumboInternalParser* parser, bool scratch,
+    void* element, unsigned int index, void** inline_data,
+    GumboVector* vector) {
+  assert(index >= 0);
+  assert(index <= vector->length);
+  enlarge_vector_if_full(parser, scratch, inline_data, vector);
+  ++vector->length;
+  memmove(&vector->data[index + 1], &vector->data[index],
+      sizeof(void*) * (vector->length - index - 1));
+  vector->data[index] = element;
+}
+
+void gumbo_vector_add(
+    struct GumboInternalParser* parser, void* element, GumboVector* vector) {
+  add_element(parser, false, element, NULL, vector);
+}
+
+void gumbo_vector_add_scratch(
+    struct GumboInternalParser* parser, void* element, GumboVector* vector) {
+  add_element(parser, true, element, NULL, vector);
+}
+
+void gumbo_vector_add_inline(struct GumboInternalParser* parser,
+    void* element, void** inline_data, GumboVector* vector) {
+  add_element(parser, false, element, inline_data, vector);
+}
+
 void* gumbo_vector_pop(
     struct GumboInternalParser* parser, GumboVector* vector) {
   if (vector->length == 0) {
@@ -93,13 +155,18 @@ int gumbo_vector_index_of(GumboVector* vector, const void* element) {
 
 void gumbo_vector_insert_at(struct GumboInternalParser* parser, void* element,
     unsigned int index, GumboVector* vector) {
-  assert(index >= 0);
-  assert(index <= vector->length);
-  enlarge_vector_if_full(parser, vector);
-  ++vector->length;
-  memmove(&vector->data[index + 1], &vector->data[index],
-      sizeof(void*) * (vector->length - index - 1));
-  vector->data[index] = element;
+  insert_element(parser, false, element, index, NULL, vector);
+}
+
+void gumbo_vector_insert_at_scratch(struct GumboInternalParser* parser,
+    void* element, unsigned int index, GumboVector* vector) {
+  insert_element(parser, true, element, index, NULL, vector);
+}
+
+void gumbo_vector_insert_at_inline(struct GumboInternalParser* parser,
+    void* element, unsigned int index, void** inline_data,
+    GumboVector* vector) {
+  insert_element(parser, false, element, index, inline_data, vector);
 }
 
 void gumbo_vector_remove(
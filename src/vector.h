@@ -50,6 +50,37 @@ void* gumbo_vector_pop(struct GumboInternalParser* parser, GumboVector* vector);
 void gumbo_vector_insert_at(struct GumboInternalParser* parser, void* element,
     unsigned int index, GumboVector* vector);
 
+// Variants of the above for scratch vectors, like the parser's stacks, that
+// outlive any one output: they always use the allocator from the options,
+// never the parser's arena.
+void gumbo_vector_add_scratch(
+    struct GumboInternalParser* parser, void* element, GumboVector* vector);
+
+void gumbo_vector_insert_at_scratch(struct GumboInternalParser* parser,
+    void* element, unsigned int index, GumboVector* vector);
+
+// Vectors with inline storage keep their first few elements in an array of
+// the caller's, such as GumboElement._inline_children, and only move to an
+// allocated array once they outgrow it.  They must be grown and destroyed
+// with these variants, passing the same inline_data; the rest of the
+// functions above and below work on them as is.  inline_data may be NULL for
+// a vector that has none.
+
+// Initializes a vector to use the inline_capacity elements of inline_data.
+void gumbo_vector_init_inline(void** inline_data,
+    unsigned int inline_capacity, GumboVector* vector);
+
+// Frees the memory used by a vector with inline storage, if it has moved out.
+void gumbo_vector_destroy_inline(struct GumboInternalParser* parser,
+    void** inline_data, GumboVector* vector);
+
+void gumbo_vector_add_inline(struct GumboInternalParser* parser,
+    void* element, void** inline_data, GumboVector* vector);
+
+void gumbo_vector_insert_at_inline(struct GumboInternalParser* parser,
+    void* element, unsigned int index, void** inline_data,
+    GumboVector* vector);
+
 // Removes an element from the vector, or does nothing if the element is not in
 // the vector.
 void gumbo_vector_remove(
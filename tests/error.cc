@@ -0,0 +1,99 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Tests for the public error API.  This only includes gumbo.h, the way a
+// program built against an installed library would.
+
+#include "gumbo.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+struct ReportedError {
+  GumboErrorType type;
+  unsigned int offset;
+  char original_char;
+  std::vector<GumboTag> tag_stack;
+  std::string duplicate_attr_name;
+};
+
+void RecordError(void* userdata, const GumboError* error) {
+  ReportedError reported;
+  reported.type = gumbo_error_type(error);
+  reported.offset = gumbo_error_position(error).offset;
+  reported.original_char = *gumbo_error_original_text(error);
+  const GumboVector* tag_stack = gumbo_error_tag_stack(error);
+  if (tag_stack) {
+    for (unsigned int i = 0; i < tag_stack->length; ++i) {
+      reported.tag_stack.push_back(
+          static_cast<GumboTag>(reinterpret_cast<intptr_t>(
+              tag_stack->data[i])));
+    }
+  }
+  const char* name = gumbo_error_duplicate_attr_name(error);
+  if (name) {
+    reported.duplicate_attr_name = name;
+  }
+  static_cast<std::vector<ReportedError>*>(userdata)->push_back(reported);
+}
+
+TEST(GumboErrorTest, ErrorHandlerWithPublicHeaderOnly) {
+  const char* input = "<p a=1 a=2><table><td>x</br></table>";
+  std::vector<ReportedError> errors;
+  GumboOptions options = kGumboDefaultOptions;
+  options.userdata = &errors;
+  options.error_handler = RecordError;
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, input, strlen(input));
+
+  unsigned int num_errors = 0;
+  for (int i = 0; i < GUMBO_NUM_ERROR_TYPES; ++i) {
+    num_errors += output->error_counts[i];
+  }
+  EXPECT_EQ(errors.size(), num_errors);
+  EXPECT_EQ(1, output->error_counts[GUMBO_ERR_DUPLICATE_ATTR]);
+
+  bool saw_duplicate_attr = false;
+  bool saw_br = false;
+  for (size_t i = 0; i < errors.size(); ++i) {
+    const ReportedError& error = errors[i];
+    EXPECT_EQ(input[error.offset], error.original_char);
+    if (error.type == GUMBO_ERR_DUPLICATE_ATTR) {
+      saw_duplicate_attr = true;
+      EXPECT_EQ("a", error.duplicate_attr_name);
+      EXPECT_TRUE(error.tag_stack.empty());
+    } else {
+      EXPECT_EQ("", error.duplicate_attr_name);
+    }
+    if (error.type == GUMBO_ERR_PARSER &&
+        strncmp(input + error.offset, "</br>", 5) == 0) {
+      saw_br = true;
+      ASSERT_FALSE(error.tag_stack.empty());
+      EXPECT_EQ(GUMBO_TAG_HTML, error.tag_stack.front());
+      EXPECT_EQ(GUMBO_TAG_TD, error.tag_stack.back());
+    }
+  }
+  EXPECT_TRUE(saw_duplicate_attr);
+  EXPECT_TRUE(saw_br);
+  gumbo_destroy_output(&options, output);
+}
+
+}  // namespace
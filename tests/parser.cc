@@ -16,9 +16,14 @@
 
 #include "gumbo.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
+#include "error.h"
 #include "test_utils.h"
 
 namespace {
@@ -177,6 +182,85 @@ TEST_F(GumboParserTest, SelfClosingTagError) {
   EXPECT_EQ(8, output_->errors.length);
 }
 
+TEST_F(GumboParserTest, ErrorCounts) {
+  const char* input = "<div/><p a=1 a=2>&#x0;&bogus;\xFF</br>";
+  Parse(input);
+  unsigned int expected[GUMBO_NUM_ERROR_TYPES] = {0};
+  for (unsigned int i = 0; i < output_->errors.length; ++i) {
+    ++expected[static_cast<GumboError*>(output_->errors.data[i])->type];
+  }
+  EXPECT_GT(expected[GUMBO_ERR_PARSER], 0);
+  EXPECT_GT(expected[GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG], 0);
+  EXPECT_EQ(1, expected[GUMBO_ERR_DUPLICATE_ATTR]);
+  EXPECT_EQ(1, expected[GUMBO_ERR_UTF8_INVALID]);
+  for (int i = 0; i < GUMBO_NUM_ERROR_TYPES; ++i) {
+    EXPECT_EQ(expected[i], output_->error_counts[i]) << "type " << i;
+  }
+
+  // Without errors, the counts stay the same.
+  options_.max_errors = 0;
+  Parse(input);
+  EXPECT_EQ(0, output_->errors.length);
+  for (int i = 0; i < GUMBO_NUM_ERROR_TYPES; ++i) {
+    EXPECT_EQ(expected[i], output_->error_counts[i]) << "type " << i;
+  }
+}
+
+// Summarizes an error as its type, offset, and tag stack, if it has one.
+std::string DescribeError(const GumboError* error) {
+  std::string description = std::to_string(error->type) + "@" +
+                            std::to_string(error->position.offset);
+  if (error->type == GUMBO_ERR_PARSER ||
+      error->type == GUMBO_ERR_UNACKNOWLEDGED_SELF_CLOSING_TAG) {
+    const GumboVector* tag_stack = &error->v.parser.tag_stack;
+    for (unsigned int i = 0; i < tag_stack->length; ++i) {
+      description += " ";
+      description += gumbo_normalized_tagname(
+          static_cast<GumboTag>(reinterpret_cast<intptr_t>(tag_stack->data[i])));
+    }
+  } else if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
+    description += " ";
+    description += error->v.duplicate_attr.name;
+  }
+  return description;
+}
+
+// The errors passed to RecordError.  The userdata belongs to the leak checker.
+std::vector<std::string> reported_errors;
+
+void RecordError(void* userdata, const GumboError* error) {
+  reported_errors.push_back(DescribeError(error));
+}
+
+TEST_F(GumboParserTest, ErrorHandler) {
+  const char* input =
+      "<div/><p a=1 a=2><table><td>&#x0;&bogus;\xFF</br></table>";
+  Parse(input);
+  std::vector<std::string> expected;
+  for (unsigned int i = 0; i < output_->errors.length; ++i) {
+    expected.push_back(
+        DescribeError(static_cast<GumboError*>(output_->errors.data[i])));
+  }
+  ASSERT_GT(expected.size(), 5);
+
+  reported_errors.clear();
+  options_.error_handler = RecordError;
+  Parse(input);
+  EXPECT_EQ(0, output_->errors.length);
+  EXPECT_EQ(expected, reported_errors);
+
+  reported_errors.clear();
+  options_.max_errors = 3;
+  Parse(input);
+  EXPECT_EQ(std::vector<std::string>(expected.begin(), expected.begin() + 3),
+      reported_errors);
+  unsigned int num_errors = 0;
+  for (int i = 0; i < GUMBO_NUM_ERROR_TYPES; ++i) {
+    num_errors += output_->error_counts[i];
+  }
+  EXPECT_EQ(expected.size(), num_errors);
+}
+
 TEST_F(GumboParserTest, UnexpectedEndBreak) {
   Parse("</br><div></div>");
 
@@ -281,6 +365,34 @@ TEST_F(GumboParserTest, ExplicitHtmlStructure) {
   EXPECT_STREQ("Test", text->v.text.text);
 }
 
+TEST_F(GumboParserTest, OffsetsOnly) {
+  options_.offsets_only = true;
+  const char* input =
+      "<!doctype html>\n<html>"
+      "<head><title>Foo</title></head>\n"
+      "<body><div class=bar>Test</div></body></html>";
+  Parse(input);
+  GumboNode* html = GetChild(root_, 0);
+  GumboNode* body = GetChild(html, 2);
+  ASSERT_EQ(GUMBO_TAG_BODY, body->v.element.tag);
+  GumboSourcePosition start = body->v.element.start_pos;
+  GumboSourcePosition end = html->v.element.end_pos;
+  EXPECT_EQ(0, start.line);
+  EXPECT_EQ(0, start.column);
+  EXPECT_EQ(54, start.offset);
+  EXPECT_EQ(92, end.offset);
+
+  GumboLineIndex* index =
+      gumbo_line_index_create(&options_, input, strlen(input));
+  gumbo_line_index_resolve(index, &start);
+  gumbo_line_index_resolve(index, &end);
+  gumbo_line_index_destroy(index);
+  EXPECT_EQ(3, start.line);
+  EXPECT_EQ(1, start.column);
+  EXPECT_EQ(3, end.line);
+  EXPECT_EQ(39, end.column);
+}
+
 TEST_F(GumboParserTest, Whitespace) {
   Parse("<ul>\n  <li>Text\n</ul>");
 
@@ -600,6 +712,240 @@ TEST_F(GumboParserTest, InvalidEndTag) {
   ASSERT_EQ(0, GetChildCount(img));
 }
 
+TEST_F(GumboParserTest, ManyFosterParentedSiblings) {
+  // Text and formatting elements foster-parented in front of a table, some of
+  // them moved around by the adoption agency algorithm.  Parsing a string
+  // checks each node's index_within_parent.
+  std::string text = "<div><table><tr>";
+  for (int i = 0; i < 200; ++i) {
+    text += "x<b>y<p>z</b>";
+  }
+  Parse(text);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(1, GetChildCount(body));
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, div->type);
+  int num_children = GetChildCount(div);
+  ASSERT_GT(num_children, 200);
+  GumboNode* table = GetChild(div, num_children - 1);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, table->type);
+  EXPECT_EQ(GUMBO_TAG_TABLE, GetTag(table));
+}
+
+TEST_F(GumboParserTest, EndTagOutOfScopeInDeepNesting) {
+  // The <button> puts the <p> out of button scope, so </p> inserts an empty
+  // <p> where it is, inside the <button>, rather than closing the outer one.
+  std::string text = "<p>";
+  for (int i = 0; i < 1000; ++i) {
+    text += "<span>";
+  }
+  text += "<button><span></p>";
+  Parse(text);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(1, GetChildCount(body));
+  GumboNode* node = GetChild(body, 0);
+  EXPECT_EQ(GUMBO_TAG_P, GetTag(node));
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(1, GetChildCount(node));
+    node = GetChild(node, 0);
+    ASSERT_EQ(GUMBO_TAG_SPAN, GetTag(node));
+  }
+  ASSERT_EQ(1, GetChildCount(node));
+  GumboNode* button = GetChild(node, 0);
+  EXPECT_EQ(GUMBO_TAG_BUTTON, GetTag(button));
+  ASSERT_EQ(1, GetChildCount(button));
+  GumboNode* span = GetChild(button, 0);
+  EXPECT_EQ(GUMBO_TAG_SPAN, GetTag(span));
+  ASSERT_EQ(1, GetChildCount(span));
+  GumboNode* p = GetChild(span, 0);
+  EXPECT_EQ(GUMBO_TAG_P, GetTag(p));
+  EXPECT_EQ(0, GetChildCount(p));
+}
+
+TEST_F(GumboParserTest, MaxReconstructedFormattingElements) {
+  // Only the <i> and <u> are reopened for the "x"; the <b> is dropped, so it
+  // isn't reopened for the "y" either.
+  options_.max_reconstructed_formatting_elements = 2;
+  Parse("<div><b><i><u></div>x</u></i>y");
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(3, GetChildCount(body));
+  EXPECT_EQ(GUMBO_TAG_DIV, GetTag(GetChild(body, 0)));
+
+  GumboNode* i = GetChild(body, 1);
+  EXPECT_EQ(GUMBO_TAG_I, GetTag(i));
+  EXPECT_EQ(GUMBO_INSERTION_RECONSTRUCTED_FORMATTING_ELEMENT,
+      i->parse_flags & GUMBO_INSERTION_RECONSTRUCTED_FORMATTING_ELEMENT);
+  ASSERT_EQ(1, GetChildCount(i));
+  GumboNode* u = GetChild(i, 0);
+  EXPECT_EQ(GUMBO_TAG_U, GetTag(u));
+  ASSERT_EQ(1, GetChildCount(u));
+  EXPECT_EQ(GUMBO_NODE_TEXT, GetChild(u, 0)->type);
+
+  GumboNode* text = GetChild(body, 2);
+  ASSERT_EQ(GUMBO_NODE_TEXT, text->type);
+  EXPECT_STREQ("y", text->v.text.text);
+}
+
+TEST_F(GumboParserTest, WalkerVisitsEachNodeTwice) {
+  Parse("<p>a<b>b</b><br>c</p><i></i>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+
+  std::string visits;
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, body);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    visits += event == GUMBO_WALK_ENTER ? "+" : "-";
+    visits += node->type == GUMBO_NODE_TEXT
+                  ? node->v.text.text
+                  : gumbo_normalized_tagname(node->v.element.tag);
+  }
+  EXPECT_EQ("+body+p+a-a+b+b-b-b+br-br+c-c-p+i-i-body", visits);
+  EXPECT_EQ(NULL, gumbo_walker_next(&walker, &event));
+}
+
+TEST_F(GumboParserTest, SiblingLinks) {
+  // The "a" and <b> are foster-parented before the table, and the misnested
+  // </b> moves the <p> out of the <b>.
+  Parse(std::string("<div><table>a<b>b<p>c</b>d</table>e</div>"));
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(5, GetChildCount(div));
+  EXPECT_EQ(GetChild(div, 0), div->first_child);
+  EXPECT_EQ(GetChild(div, 4), div->last_child);
+  EXPECT_EQ(NULL, GetChild(div, 0)->prev_sibling);
+  for (int i = 1; i < 5; ++i) {
+    EXPECT_EQ(GetChild(div, i - 1), GetChild(div, i)->prev_sibling);
+    EXPECT_EQ(GetChild(div, i), GetChild(div, i - 1)->next_sibling);
+  }
+  EXPECT_EQ(NULL, GetChild(div, 4)->next_sibling);
+  EXPECT_EQ(GUMBO_TAG_TABLE, GetTag(GetChild(div, 3)));
+  EXPECT_EQ(NULL, GetChild(div, 3)->first_child);
+}
+
+TEST_F(GumboParserTest, CompactOutput) {
+  Parse(std::string("<!doctype html><!--c--><p a=1 b=2 c=3 d=4>x<b>y</b>z"
+                    "<i>w</i></p><div id=d id=e>&amp;</div><p>"));
+  output_ = gumbo_output_compact(&options_, output_);
+  root_ = output_->document;
+
+  EXPECT_TRUE(root_->v.document.has_doctype);
+  EXPECT_STREQ("html", root_->v.document.name);
+  ASSERT_EQ(2, GetChildCount(root_));
+  EXPECT_EQ(GUMBO_NODE_COMMENT, GetChild(root_, 0)->type);
+  EXPECT_STREQ("c", GetChild(root_, 0)->v.text.text);
+  EXPECT_EQ(output_->root, GetChild(root_, 1));
+  ASSERT_EQ(1, output_->errors.length);
+  const GumboError* error =
+      static_cast<const GumboError*>(output_->errors.data[0]);
+  EXPECT_EQ(GUMBO_ERR_DUPLICATE_ATTR, error->type);
+  EXPECT_STREQ("id", error->v.duplicate_attr.name);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(3, GetChildCount(body));
+  GumboNode* p = GetChild(body, 0);
+  ASSERT_EQ(4, GetAttributeCount(p));
+  EXPECT_STREQ("d", GetAttribute(p, 3)->name);
+  EXPECT_STREQ("4", GetAttribute(p, 3)->value);
+  ASSERT_EQ(4, GetChildCount(p));
+  EXPECT_STREQ("y", GetChild(GetChild(p, 1), 0)->v.text.text);
+  GumboNode* div = GetChild(body, 1);
+  EXPECT_STREQ("d", GetAttribute(div, 0)->value);
+  EXPECT_STREQ("&", GetChild(div, 0)->v.text.text);
+
+  // The nodes are laid out in document order.
+  GumboWalker walker;
+  GumboWalkEvent event;
+  const GumboNode* last_node = NULL;
+  gumbo_walker_init(&walker, root_);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (event == GUMBO_WALK_ENTER) {
+      EXPECT_LT(last_node, node);
+      last_node = node;
+    }
+  }
+}
+
+TEST_F(GumboParserTest, CompactArenaOutput) {
+  options_.arena_chunk_size = 256;
+  Parse("<p class=a>x<!--y--><b>z</b></p>");
+  output_ = gumbo_output_compact(&options_, output_);
+  root_ = output_->document;
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* p = GetChild(body, 0);
+  EXPECT_STREQ("a", GetAttribute(p, 0)->value);
+  ASSERT_EQ(3, GetChildCount(p));
+  EXPECT_STREQ("x", GetChild(p, 0)->v.text.text);
+  EXPECT_STREQ("y", GetChild(p, 1)->v.text.text);
+  EXPECT_STREQ("z", GetChild(GetChild(p, 2), 0)->v.text.text);
+}
+
+TEST_F(GumboParserTest, WalkerSkipsChildren) {
+  Parse("<p>a<b>b</b></p><i>c</i>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+
+  std::string visits;
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, body);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (node->type != GUMBO_NODE_ELEMENT) {
+      continue;
+    }
+    visits += event == GUMBO_WALK_ENTER ? "+" : "-";
+    visits += gumbo_normalized_tagname(node->v.element.tag);
+    if (event == GUMBO_WALK_ENTER && node->v.element.tag == GUMBO_TAG_P) {
+      gumbo_walker_skip_children(&walker);
+    }
+  }
+  EXPECT_EQ("+body+p-p+i-i-body", visits);
+}
+
+TEST_F(GumboParserTest, DeepNestingWithoutRecursion) {
+  // Walking and destroying the tree take constant stack space.  Errors are only
+  // counted, since each of those recorded at the end of the input would copy
+  // the stack of open elements.
+  options_.max_errors = 0;
+  const int kDepth = 200000;
+  std::string text;
+  for (int i = 0; i < kDepth; ++i) {
+    text += "<div>";
+  }
+  text += "x";
+  Parse(text.c_str());
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  int depth = 0;
+  int max_depth = 0;
+  GumboWalker walker;
+  GumboWalkEvent event;
+  gumbo_walker_init(&walker, body);
+  for (GumboNode* node; (node = gumbo_walker_next(&walker, &event));) {
+    if (event == GUMBO_WALK_ENTER) {
+      max_depth = std::max(max_depth, ++depth);
+    } else {
+      --depth;
+    }
+  }
+  EXPECT_EQ(0, depth);
+  // The body, the <div>s, and the text.
+  EXPECT_EQ(kDepth + 2, max_depth);
+}
+
 TEST_F(GumboParserTest, Tables) {
   Parse(
       "<html><table>\n"
@@ -1384,6 +1730,56 @@ TEST_F(GumboParserTest, NoahsArkClause) {
   ASSERT_EQ(1, GetChildCount(red2));
 }
 
+// Returns how many <b> elements are nested directly within each other under
+// the node.
+static int CountNestedBoldElements(GumboNode* node) {
+  int depth = 0;
+  while (GetChildCount(node) > 0) {
+    node = GetChild(node, 0);
+    if (node->type != GUMBO_NODE_ELEMENT || GetTag(node) != GUMBO_TAG_B) {
+      break;
+    }
+    ++depth;
+  }
+  return depth;
+}
+
+TEST_F(GumboParserTest, NoahsArkClauseIgnoresAttributeOrder) {
+  // The same attributes in a different order are identical, so only three of
+  // the four are reconstructed.
+  Parse("<p><b x=1 y=2><b y=2 x=1><b x=1 y=2><b y=2 x=1><p>X");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+  EXPECT_EQ(3, CountNestedBoldElements(GetChild(body, 1)));
+}
+
+TEST_F(GumboParserTest, NoahsArkClauseSeparatesNamesFromValues) {
+  // Attributes with the same characters split differently between name and
+  // value aren't identical, so no three of these are and all are reconstructed.
+  Parse("<p><b ab=c><b a=bc><b ab=c><b a=bc><p>X");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+  EXPECT_EQ(4, CountNestedBoldElements(GetChild(body, 1)));
+}
+
+TEST_F(GumboParserTest, NoahsArkClauseAfterEntriesLeaveTheList) {
+  // The closed <b>s no longer count, but the open ones still do, including
+  // the ones before the scope marker of the <td> for the clause's shortcut.
+  Parse(
+      "<!DOCTYPE html><p><b></b><b></b><b></b><b><b><b><b><p>X"
+      "<table><td><p><b><b><b><b><p>Y");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(3, GetChildCount(body));
+  EXPECT_EQ(3, CountNestedBoldElements(GetChild(body, 1)));
+  GumboNode* td = GetChild(GetChild(GetChild(GetChild(body, 2), 0), 0), 0);
+  ASSERT_EQ(GUMBO_TAG_TD, GetTag(td));
+  ASSERT_EQ(2, GetChildCount(td));
+  EXPECT_EQ(3, CountNestedBoldElements(GetChild(td, 1)));
+}
+
 TEST_F(GumboParserTest, AdoptionAgency1) {
   // http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#misnested-tags:-b-i-/b-/i
   Parse("<p>1<b>2<i>3</b>4</i>5</p>");
@@ -1975,4 +2371,593 @@ TEST_F(GumboParserTest, FragmentWithTwoNodes) {
   EXPECT_EQ(0, GetChildCount(br));
 }
 
+TEST_F(GumboParserTest, ArenaAllocation) {
+  // A tiny chunk size exercises both chunk chaining and the dedicated chunks
+  // used for oversized blocks.
+  options_.arena_chunk_size = 256;
+  std::string text(1000, 'x');
+  Parse("<div id=a class=b><p>One<p>Two</div><isindex prompt=foo><span>" +
+        text + "</span><!-- comment -->");
+  ASSERT_TRUE(output_->arena != NULL);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(4, GetChildCount(body));
+
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, div->type);
+  EXPECT_EQ(GUMBO_TAG_DIV, GetTag(div));
+  ASSERT_EQ(2, GetAttributeCount(div));
+  EXPECT_STREQ("class", GetAttribute(div, 1)->name);
+  EXPECT_STREQ("b", GetAttribute(div, 1)->value);
+  ASSERT_EQ(2, GetChildCount(div));
+
+  GumboNode* form = GetChild(body, 1);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, form->type);
+  EXPECT_EQ(GUMBO_TAG_FORM, GetTag(form));
+  GumboNode* label = GetChild(form, 1);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, label->type);
+  EXPECT_EQ(GUMBO_TAG_LABEL, GetTag(label));
+  GumboNode* prompt = GetChild(label, 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, prompt->type);
+  EXPECT_STREQ("foo", prompt->v.text.text);
+
+  GumboNode* span = GetChild(body, 2);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, span->type);
+  EXPECT_EQ(GUMBO_TAG_SPAN, GetTag(span));
+  GumboNode* span_text = GetChild(span, 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, span_text->type);
+  EXPECT_EQ(text, span_text->v.text.text);
+
+  GumboNode* comment = GetChild(body, 3);
+  ASSERT_EQ(GUMBO_NODE_COMMENT, comment->type);
+  EXPECT_STREQ(" comment ", comment->v.text.text);
+  EXPECT_GT(output_->errors.length, 0);
+}
+
+TEST_F(GumboParserTest, PoolAllocation) {
+  // The adoption agency and <isindex> free nodes and attributes during the
+  // parse, which the pool reuses.
+  const char* input =
+      "<div id=a class=b><p>One<b>Two<p>Three</b></div><isindex prompt=foo>"
+      "<table><tr><td>1<td>2</table><!-- comment --><br/>";
+  Parse(input);
+  size_t default_allocations = malloc_stats_.objects_allocated;
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  int num_children = GetChildCount(body);
+  unsigned int num_errors = output_->errors.length;
+  EXPECT_TRUE(output_->pool == NULL);
+  gumbo_destroy_output(&options_, output_);
+  output_ = NULL;
+
+  // A tiny slab size exercises slab chaining, and slabs holding just one
+  // object.
+  options_.pool_slab_size = 128;
+  size_t start_allocations = malloc_stats_.objects_allocated;
+  Parse(input);
+  ASSERT_TRUE(output_->pool != NULL);
+  EXPECT_LT(malloc_stats_.objects_allocated - start_allocations,
+      default_allocations);
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(num_children, GetChildCount(body));
+  EXPECT_EQ(num_errors, output_->errors.length);
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, div->type);
+  ASSERT_EQ(2, GetAttributeCount(div));
+  EXPECT_STREQ("class", GetAttribute(div, 1)->name);
+  EXPECT_STREQ("b", GetAttribute(div, 1)->value);
+
+  // Arenas take precedence.
+  options_.arena_chunk_size = 256;
+  Parse(input);
+  EXPECT_TRUE(output_->arena != NULL);
+  EXPECT_TRUE(output_->pool == NULL);
+}
+
+TEST_F(GumboParserTest, InlineChildrenAndAttributes) {
+  Parse(
+      "<div id=a class=b title=c><p>One<p>Two</div>"
+      "<span a=1 b=2 c=3 d=4>x<i>y</i>z</span>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+
+  GumboNode* div = GetChild(body, 0);
+  EXPECT_EQ(div->v.element._inline_attributes, div->v.element.attributes.data);
+  EXPECT_EQ(div->v.element._inline_children, div->v.element.children.data);
+  ASSERT_EQ(3, GetAttributeCount(div));
+  EXPECT_STREQ("title", GetAttribute(div, 2)->name);
+  ASSERT_EQ(2, GetChildCount(div));
+  EXPECT_EQ(GUMBO_TAG_P, GetTag(GetChild(div, 1)));
+
+  GumboNode* span = GetChild(body, 1);
+  EXPECT_NE(
+      span->v.element._inline_attributes, span->v.element.attributes.data);
+  EXPECT_NE(span->v.element._inline_children, span->v.element.children.data);
+  ASSERT_EQ(4, GetAttributeCount(span));
+  EXPECT_STREQ("d", GetAttribute(span, 3)->name);
+  ASSERT_EQ(3, GetChildCount(span));
+  EXPECT_EQ(GUMBO_TAG_I, GetTag(GetChild(span, 1)));
+}
+
+// An allocator that checks the sizes it's told against those it handed out.
+struct SizedAllocations {
+  std::map<void*, size_t> blocks;
+  int num_reallocations;
+  int num_sized_frees;
+  int num_size_mismatches;
+};
+
+static void* SizedMalloc(void* userdata, size_t size) {
+  SizedAllocations* allocations = static_cast<SizedAllocations*>(userdata);
+  void* ptr = malloc(size);
+  allocations->blocks[ptr] = size;
+  return ptr;
+}
+
+static void* SizedRealloc(
+    void* userdata, void* ptr, size_t old_size, size_t new_size) {
+  SizedAllocations* allocations = static_cast<SizedAllocations*>(userdata);
+  ++allocations->num_reallocations;
+  if (allocations->blocks[ptr] != old_size) {
+    ++allocations->num_size_mismatches;
+  }
+  allocations->blocks.erase(ptr);
+  void* result = realloc(ptr, new_size);
+  allocations->blocks[result] = new_size;
+  return result;
+}
+
+static void SizedFree(void* userdata, void* ptr, size_t size) {
+  SizedAllocations* allocations = static_cast<SizedAllocations*>(userdata);
+  ++allocations->num_sized_frees;
+  if (allocations->blocks[ptr] != size) {
+    ++allocations->num_size_mismatches;
+  }
+  allocations->blocks.erase(ptr);
+  free(ptr);
+}
+
+static void UnsizedFree(void* userdata, void* ptr) {
+  if (ptr) {
+    static_cast<SizedAllocations*>(userdata)->blocks.erase(ptr);
+    free(ptr);
+  }
+}
+
+TEST_F(GumboParserTest, ReallocatorAndSizedDeallocator) {
+  std::string text(100, 'x');
+  std::string input = "<div id=a class=b title=c lang=d dir=e>" + text +
+                      "<p>One<p>Two<p>Three<p>Four</div><isindex prompt=z>";
+  for (int pooled = 0; pooled < 2; ++pooled) {
+    SizedAllocations allocations;
+    allocations.num_reallocations = 0;
+    allocations.num_sized_frees = 0;
+    allocations.num_size_mismatches = 0;
+    GumboOptions options = kGumboDefaultOptions;
+    options.allocator = SizedMalloc;
+    options.deallocator = UnsizedFree;
+    options.reallocator = SizedRealloc;
+    options.sized_deallocator = SizedFree;
+    options.userdata = &allocations;
+    options.pool_slab_size = pooled ? 256 : 0;
+    GumboOutput* output =
+        gumbo_parse_with_options(&options, input.data(), input.length());
+    EXPECT_EQ(2, GetChildCount(output->root));
+    gumbo_destroy_output(&options, output);
+    // Many more lines than the line index guesses at, so that it grows.
+    int num_reallocations = allocations.num_reallocations;
+    int num_sized_frees = allocations.num_sized_frees;
+    std::string lines(200, '\n');
+    GumboLineIndex* index =
+        gumbo_line_index_create(&options, lines.data(), lines.length());
+    gumbo_line_index_destroy(index);
+    EXPECT_GT(allocations.num_reallocations, num_reallocations);
+    EXPECT_EQ(num_sized_frees + 2, allocations.num_sized_frees);
+    EXPECT_GT(allocations.num_reallocations, 0);
+    EXPECT_GT(allocations.num_sized_frees, 0);
+    EXPECT_EQ(0, allocations.num_size_mismatches);
+    EXPECT_TRUE(allocations.blocks.empty());
+  }
+}
+
+TEST_F(GumboParserTest, ParserContextReuse) {
+  const char* documents[] = {
+      "<title>One</title><p class=x>Some <b>bold<i>text</b> here",
+      "<table><tr><td>1<td>2</table><!-- done -->",
+      "<svg><desc><p>Foreign</p></desc></svg><template><div></template>",
+      "",
+  };
+  GumboParserContext* context = gumbo_parser_context_create(&options_);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      Parse(documents[i]);
+      GumboOutput* reused = gumbo_parser_context_parse(
+          context, documents[i], strlen(documents[i]));
+      EXPECT_EQ(output_->errors.length, reused->errors.length);
+      ASSERT_EQ(GetChildCount(root_), GetChildCount(reused->document));
+      GumboNode* body;
+      GetAndAssertBody(root_, &body);
+      GumboNode* reused_body;
+      GetAndAssertBody(reused->document, &reused_body);
+      ASSERT_EQ(GetChildCount(body), GetChildCount(reused_body));
+      for (int j = 0; j < GetChildCount(body); ++j) {
+        EXPECT_EQ(GetChild(body, j)->type, GetChild(reused_body, j)->type);
+      }
+      gumbo_destroy_output(&options_, reused);
+    }
+    gumbo_parser_context_reset(context);
+  }
+  gumbo_parser_context_destroy(context);
+}
+
+TEST_F(GumboParserTest, ParserContextWithArena) {
+  options_.arena_chunk_size = 256;
+  GumboParserContext* context = gumbo_parser_context_create(&options_);
+  GumboOutput* first = gumbo_parser_context_parse(context, "<div><p>a", 9);
+  GumboOutput* second = gumbo_parser_context_parse(context, "<ul><li>b", 9);
+  ASSERT_TRUE(first->arena != NULL);
+  ASSERT_TRUE(second->arena != NULL);
+  EXPECT_NE(first->arena, second->arena);
+  // Outputs are independent of each other and of the context.
+  gumbo_destroy_output(&options_, first);
+  gumbo_parser_context_destroy(context);
+
+  GumboNode* body;
+  GetAndAssertBody(second->document, &body);
+  ASSERT_EQ(1, GetChildCount(body));
+  EXPECT_EQ(GUMBO_TAG_UL, GetTag(GetChild(body, 0)));
+  gumbo_destroy_output(&options_, second);
+}
+
+TEST_F(GumboParserTest, BorrowedText) {
+  options_.borrow_text = true;
+  const char* input = "<p>Plain text</p><p>A &amp; B</p><p>Line\r\nbreak</p>";
+  Parse(input);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(3, GetChildCount(body));
+
+  GumboNode* plain = GetChild(GetChild(body, 0), 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, plain->type);
+  EXPECT_EQ(plain->v.text.original_text.data, plain->v.text.text);
+  EXPECT_EQ(input + 3, plain->v.text.text);
+  EXPECT_EQ(10, plain->v.text.length);
+  EXPECT_EQ("Plain text",
+      std::string(plain->v.text.text, plain->v.text.length));
+
+  GumboNode* entity = GetChild(GetChild(body, 1), 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, entity->type);
+  EXPECT_NE(entity->v.text.original_text.data, entity->v.text.text);
+  EXPECT_STREQ("A & B", entity->v.text.text);
+  EXPECT_EQ(5, entity->v.text.length);
+
+  GumboNode* newline = GetChild(GetChild(body, 2), 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, newline->type);
+  EXPECT_NE(newline->v.text.original_text.data, newline->v.text.text);
+  EXPECT_STREQ("Line\nbreak", newline->v.text.text);
+  EXPECT_EQ(10, newline->v.text.length);
+}
+
+
+// Checks that two parses of the same text, which may live in different
+// buffers, produced the same tree, down to source positions and original text.
+void ExpectSameTree(const GumboNode* expected, const char* expected_input,
+    const GumboNode* actual, const char* actual_input) {
+  ASSERT_EQ(expected->type, actual->type);
+  EXPECT_EQ(expected->parse_flags, actual->parse_flags);
+  if (expected->type == GUMBO_NODE_DOCUMENT) {
+    const GumboVector* children = &expected->v.document.children;
+    ASSERT_EQ(children->length, actual->v.document.children.length);
+    for (unsigned int i = 0; i < children->length; ++i) {
+      ExpectSameTree(static_cast<GumboNode*>(children->data[i]), expected_input,
+          static_cast<GumboNode*>(actual->v.document.children.data[i]),
+          actual_input);
+    }
+  } else if (expected->type == GUMBO_NODE_ELEMENT ||
+             expected->type == GUMBO_NODE_TEMPLATE) {
+    const GumboElement* element = &expected->v.element;
+    EXPECT_EQ(element->tag, actual->v.element.tag);
+    EXPECT_EQ(element->start_pos.offset, actual->v.element.start_pos.offset);
+    EXPECT_EQ(element->end_pos.offset, actual->v.element.end_pos.offset);
+    EXPECT_EQ(element->original_tag.length,
+        actual->v.element.original_tag.length);
+    ASSERT_EQ(element->attributes.length, actual->v.element.attributes.length);
+    for (unsigned int i = 0; i < element->attributes.length; ++i) {
+      const GumboAttribute* attr =
+          static_cast<GumboAttribute*>(element->attributes.data[i]);
+      const GumboAttribute* actual_attr =
+          static_cast<GumboAttribute*>(actual->v.element.attributes.data[i]);
+      EXPECT_STREQ(attr->name, actual_attr->name);
+      EXPECT_STREQ(attr->value, actual_attr->value);
+      EXPECT_EQ(attr->original_value.data - expected_input,
+          actual_attr->original_value.data - actual_input);
+    }
+    ASSERT_EQ(element->children.length, actual->v.element.children.length);
+    for (unsigned int i = 0; i < element->children.length; ++i) {
+      ExpectSameTree(static_cast<GumboNode*>(element->children.data[i]),
+          expected_input,
+          static_cast<GumboNode*>(actual->v.element.children.data[i]),
+          actual_input);
+    }
+  } else {
+    const GumboText* text = &expected->v.text;
+    EXPECT_STREQ(text->text, actual->v.text.text);
+    EXPECT_EQ(text->start_pos.line, actual->v.text.start_pos.line);
+    EXPECT_EQ(text->start_pos.column, actual->v.text.start_pos.column);
+    EXPECT_EQ(text->start_pos.offset, actual->v.text.start_pos.offset);
+    EXPECT_EQ(text->original_text.data - expected_input,
+        actual->v.text.original_text.data - actual_input);
+    EXPECT_EQ(text->original_text.length, actual->v.text.original_text.length);
+  }
+}
+
+TEST_F(GumboParserTest, FedInput) {
+  // Every chunk size puts chunk boundaries in different awkward places: inside
+  // UTF-8 sequences, CRLF pairs, character references and tags.
+  const char* kInput =
+      "<!DOCTYPE html>\r\n<title>T&eacute;st\r\n</title>"
+      "<p class=\"a&amp;b\" id=x>caf\xC3\xA9 &#0000000000000000000065; "
+      "&notit; &#x1F600; \xE2\x82\xAC\r\n</p><script>if (a<b) x = '</scr';"
+      "</script><!-- comment --><table><tr><td>cell\x80</table>\r"
+      "<pre>\r\ntext\r</pre><svg><desc>\xF0\x9F\x98\x80</desc></svg>"
+      "<?xml-stylesheet href=\"/styles/a-rather-long-name.css\" "
+      "type=\"text/css\" media=\"screen\"?><!bogus declaration that runs on "
+      "for well over sixty-four bytes of input>&abcdefghijklmnopqrstuvwxyz"
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghij\x01 &abcdefghijklmnopq"
+      "rstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghij; &amp";
+  Parse(kInput);
+  GumboParserContext* context = gumbo_parser_context_create(&options_);
+  for (size_t chunk_size = 1; chunk_size < 40; ++chunk_size) {
+    size_t length = strlen(kInput);
+    for (size_t i = 0; i < length; i += chunk_size) {
+      gumbo_parser_context_feed(
+          context, kInput + i, std::min(chunk_size, length - i));
+    }
+    GumboOutput* fed = gumbo_parser_context_finish(context);
+    ASSERT_EQ(length, fed->input_length);
+    EXPECT_EQ(0, memcmp(kInput, fed->input, length));
+    EXPECT_EQ(output_->errors.length, fed->errors.length);
+    ExpectSameTree(root_, kInput, fed->document, fed->input);
+    gumbo_destroy_output(&options_, fed);
+  }
+  gumbo_parser_context_destroy(context);
+}
+
+TEST_F(GumboParserTest, FedInputOutgrowsItsBuffer) {
+  std::string input = "<ul>";
+  for (int i = 0; i < 2000; ++i) {
+    input += "<li class=item>Item &amp; more\n";
+  }
+  Parse(input);
+  options_.arena_chunk_size = 1024;
+  GumboParserContext* context = gumbo_parser_context_create(&options_);
+  uint64_t allocations = malloc_stats_.objects_allocated;
+  for (size_t i = 0; i < input.length(); i += 1000) {
+    gumbo_parser_context_feed(context, input.data() + i,
+        std::min<size_t>(1000, input.length() - i));
+  }
+  GumboOutput* fed = gumbo_parser_context_finish(context);
+  allocations = malloc_stats_.objects_allocated - allocations;
+  ExpectSameTree(root_, input.data(), fed->document, fed->input);
+  gumbo_destroy_output(&options_, fed);
+
+  // With the length reserved up front, the buffer never has to move.
+  gumbo_parser_context_reserve(context, input.length());
+  uint64_t reserved_allocations = malloc_stats_.objects_allocated;
+  for (size_t i = 0; i < input.length(); i += 1000) {
+    gumbo_parser_context_feed(context, input.data() + i,
+        std::min<size_t>(1000, input.length() - i));
+  }
+  fed = gumbo_parser_context_finish(context);
+  reserved_allocations = malloc_stats_.objects_allocated - reserved_allocations;
+  EXPECT_LT(reserved_allocations, allocations);
+  ExpectSameTree(root_, input.data(), fed->document, fed->input);
+  gumbo_destroy_output(&options_, fed);
+  gumbo_parser_context_destroy(context);
+}
+
+TEST_F(GumboParserTest, AbandonFedInput) {
+  GumboParserContext* context = gumbo_parser_context_create(&options_);
+  // Stop in the middle of a tag with attributes, and of a doctype.
+  gumbo_parser_context_feed(context, "<div><p class=a id=b title=\"c", 30);
+  GumboOutput* output =
+      gumbo_parser_context_parse(context, "<p>Parsed</p>", 13);
+  gumbo_destroy_output(&options_, output);
+  gumbo_parser_context_feed(context, "<!DOCTYPE html PUBLIC \"-//W3C", 29);
+  gumbo_parser_context_reset(context);
+
+  GumboOutput* empty = gumbo_parser_context_finish(context);
+  EXPECT_EQ(0, empty->input_length);
+  GumboNode* body;
+  GetAndAssertBody(empty->document, &body);
+  EXPECT_EQ(0, GetChildCount(body));
+  gumbo_destroy_output(&options_, empty);
+
+  gumbo_parser_context_feed(context, "<svg><title x=", 14);
+  gumbo_parser_context_destroy(context);
+}
+
+// Records the events of a reported parse as a string: "+tag>parent" for
+// inserted elements (with "^next" when not appended), quoted text, "!" for
+// comments, "-tag" for popped elements, "~old/new" for reparented children, and
+// "x" for removals, with a "?" after popped elements that weren't inserted.
+// Also tracks the most memory in use at any one point, and collects the
+// original text of inserted nodes and popped elements.
+struct EventLog {
+  std::string events;
+  const MallocStats* stats;
+  uint64_t max_objects_in_use;
+  std::string original_text;
+  std::set<const GumboNode*> elements;
+};
+
+static std::string EventNodeName(const GumboNode* node) {
+  if (node->type == GUMBO_NODE_DOCUMENT) {
+    return "#document";
+  }
+  return gumbo_normalized_tagname(node->v.element.tag);
+}
+
+static void NoteMemoryInUse(EventLog* log) {
+  log->max_objects_in_use =
+      std::max(log->max_objects_in_use,
+          log->stats->objects_allocated - log->stats->objects_freed);
+}
+
+static void LogInsertion(
+    void* userdata, const GumboNode* node, const GumboNode* next_sibling) {
+  EventLog* log = static_cast<EventLog*>(userdata);
+  NoteMemoryInUse(log);
+  switch (node->type) {
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE:
+      log->events += "+" + EventNodeName(node) + ">" +
+                     EventNodeName(node->parent);
+      log->elements.insert(node);
+      log->original_text.append(node->v.element.original_tag.data,
+          node->v.element.original_tag.length);
+      if (next_sibling) {
+        log->events += "^" + EventNodeName(next_sibling);
+      }
+      break;
+    case GUMBO_NODE_COMMENT:
+      log->events += "!";
+      break;
+    default:
+      log->events += "'" +
+                     std::string(node->v.text.text, node->v.text.length) + "'";
+      break;
+  }
+  if (node->type != GUMBO_NODE_ELEMENT && node->type != GUMBO_NODE_TEMPLATE) {
+    log->original_text.append(
+        node->v.text.original_text.data, node->v.text.original_text.length);
+  }
+  log->events += " ";
+}
+
+static void LogRemoval(void* userdata, const GumboNode* node) {
+  EventLog* log = static_cast<EventLog*>(userdata);
+  log->events += "x" + EventNodeName(node) + " ";
+}
+
+static void LogReparenting(void* userdata, const GumboNode* old_parent,
+    const GumboNode* new_parent) {
+  EventLog* log = static_cast<EventLog*>(userdata);
+  log->events +=
+      "~" + EventNodeName(old_parent) + "/" + EventNodeName(new_parent) + " ";
+}
+
+static void LogPop(void* userdata, const GumboNode* element) {
+  EventLog* log = static_cast<EventLog*>(userdata);
+  NoteMemoryInUse(log);
+  log->events += "-" + EventNodeName(element);
+  if (!log->elements.count(element)) {
+    log->events += "?";
+  }
+  log->events += " ";
+  log->original_text.append(element->v.element.original_tag.data,
+      element->v.element.original_tag.length);
+}
+
+static std::string ParseEvents(const GumboOptions& base_options,
+    const std::string& input, EventLog* log) {
+  GumboEventHandler handler = {
+      LogInsertion, LogRemoval, LogReparenting, LogPop, log};
+  GumboOptions options = base_options;
+  options.event_handler = &handler;
+  log->events.clear();
+  log->max_objects_in_use = 0;
+  log->original_text.clear();
+  log->elements.clear();
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, input.data(), input.length());
+  EXPECT_TRUE(output->root == NULL);
+  EXPECT_EQ(0, output->document->v.document.children.length);
+  gumbo_destroy_output(&options, output);
+  return log->events;
+}
+
+// Like ParseEvents, but feeds the input to a context in chunks of chunk_size
+// bytes, without reserving room for it.
+static std::string ParseFedEvents(const GumboOptions& base_options,
+    const std::string& input, size_t chunk_size, EventLog* log) {
+  GumboEventHandler handler = {
+      LogInsertion, LogRemoval, LogReparenting, LogPop, log};
+  GumboOptions options = base_options;
+  options.event_handler = &handler;
+  log->events.clear();
+  log->original_text.clear();
+  log->elements.clear();
+  GumboParserContext* context = gumbo_parser_context_create(&options);
+  for (size_t i = 0; i < input.length(); i += chunk_size) {
+    gumbo_parser_context_feed(context, input.data() + i,
+        std::min(chunk_size, input.length() - i));
+  }
+  GumboOutput* output = gumbo_parser_context_finish(context);
+  EXPECT_TRUE(output->root == NULL);
+  gumbo_destroy_output(&options, output);
+  gumbo_parser_context_destroy(context);
+  return log->events;
+}
+
+TEST_F(GumboParserTest, Events) {
+  EventLog log = {"", &malloc_stats_, 0};
+  // The adoption agency algorithm moves the <p> out of the <b>, and then the
+  // text in it into a new <b>.
+  EXPECT_EQ(
+      "+html>#document +head>html +title>head 'T' -title ' ' -head "
+      "+body>html +b>body '1' +p>b +p>body +b>p ~p/b -b '2' -b '3' -p '\n' ! "
+      "-body -html ",
+      ParseEvents(options_,
+          "<!DOCTYPE html><title>T</title> <b>1<p>2</b>3</p>\n<!---->", &log));
+
+  // Foster parenting inserts before the table.
+  EXPECT_EQ(
+      "+html>#document +head>html -head +body>html +table>body "
+      "+p>body^table 'x' -p -table -body -html ",
+      ParseEvents(options_, "<table><p>x</table>", &log));
+
+  EXPECT_EQ(
+      "+html>#document +head>html -head +body>html +div>body -div -body "
+      "xbody +frameset>html -frameset -html ",
+      ParseEvents(options_, "<div><frameset></frameset>", &log));
+}
+
+TEST_F(GumboParserTest, EventsUseMemoryProportionalToDepth) {
+  const std::string item = "<div class=item><p>Item &amp; <b>more</b></div>\n";
+  std::string paragraphs;
+  for (int i = 0; i < 2000; ++i) {
+    paragraphs += item;
+  }
+  EventLog log = {"", &malloc_stats_, 0};
+  // A prefix of whole items, so that both documents end with the same open
+  // elements (and the same errors for them).
+  ParseEvents(options_,
+      "<!DOCTYPE html>" + paragraphs.substr(0, 10 * item.length()), &log);
+  uint64_t max_objects_in_use = log.max_objects_in_use;
+  ParseEvents(options_, "<!DOCTYPE html>" + paragraphs, &log);
+  EXPECT_EQ(max_objects_in_use, log.max_objects_in_use);
+}
+
+TEST_F(GumboParserTest, FedEventsAcrossBufferMoves) {
+  // Each item leaves an <i> in the list of active formatting elements, and
+  // the input outgrows the fed buffer several times, in the middle of tags,
+  // text and character references, while elements are open.
+  std::string input = "<!DOCTYPE html><div id=outer><p>";
+  for (int i = 0; i < 500; ++i) {
+    input += "<div class=item>Item &amp; <b>more<i>x</b>y&notit;</div>\n";
+  }
+  EventLog log = {"", &malloc_stats_, 0};
+  std::string events = ParseEvents(options_, input, &log);
+  std::string original_text = log.original_text;
+  EXPECT_EQ(std::string::npos, events.find('?'));
+  for (size_t chunk_size : {7, 1000}) {
+    EXPECT_EQ(events, ParseFedEvents(options_, input, chunk_size, &log));
+    EXPECT_EQ(original_text, log.original_text);
+  }
+}
+
 }  // namespace
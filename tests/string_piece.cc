@@ -76,6 +76,8 @@ TEST_F(GumboStringPieceTest, CaseNotEqual_Str2Shorter) {
 TEST_F(GumboStringPieceTest, Copy) {
   GumboParser parser;
   parser._options = &kGumboDefaultOptions;
+  parser._arena = NULL;
+  parser._pool = NULL;
   INIT_GUMBO_STRING(str1, "bar");
   GumboStringPiece str2;
   gumbo_string_copy(&parser, &str2, &str1);
@@ -122,14 +122,26 @@ void SanityCheckPointers(
     EXPECT_LE(element->end_pos.offset, input_length);
 
     const GumboVector* children = &element->children;
+    const GumboNode* prev_child = NULL;
     for (int i = 0; i < children->length; ++i) {
       const GumboNode* child = static_cast<const GumboNode*>(children->data[i]);
       // Checks on parent/child links.
       ASSERT_TRUE(child != NULL);
       EXPECT_EQ(node, child->parent);
       EXPECT_EQ(i, child->index_within_parent);
+      // Checks on sibling links.
+      EXPECT_EQ(prev_child, child->prev_sibling);
+      EXPECT_EQ(prev_child ? prev_child->next_sibling : node->first_child,
+          child);
+      prev_child = child;
       SanityCheckPointers(input, input_length, child, depth + 1);
     }
+    EXPECT_EQ(prev_child, node->last_child);
+    if (prev_child) {
+      EXPECT_EQ(NULL, prev_child->next_sibling);
+    } else {
+      EXPECT_EQ(NULL, node->first_child);
+    }
   } else {
     const GumboText* text = &node->v.text;
     EXPECT_GE(text->original_text.data, input);
@@ -183,6 +195,8 @@ GumboTest::GumboTest()
   InitLeakDetection(&options_, &malloc_stats_);
   options_.max_errors = 100;
   parser_._options = &options_;
+  parser_._arena = NULL;
+  parser_._pool = NULL;
   parser_._output = static_cast<GumboOutput*>(
       gumbo_parser_allocate(&parser_, sizeof(GumboOutput)));
   gumbo_init_errors(&parser_);
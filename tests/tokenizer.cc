@@ -17,7 +17,9 @@
 #include "tokenizer.h"
 
 #include <stdio.h>
+#include <string>
 
+#include "error.h"
 #include "gtest/gtest.h"
 #include "test_utils.h"
 
@@ -114,6 +116,38 @@ TEST_F(GumboTokenizerTest, LexCharRef_NotCharRef) {
   EXPECT_EQ('x', token_.v.character);
 }
 
+TEST_F(GumboTokenizerTest, LexCharacterRun) {
+  SetInput("ab c&amp;d\r\ne<p>");
+  gumbo_tokenizer_set_allow_character_runs(&parser_, true);
+
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  EXPECT_EQ(GUMBO_TOKEN_CHARACTER_RUN, token_.type);
+  EXPECT_EQ(0, token_.position.offset);
+  EXPECT_EQ(4, token_.original_text.length);
+  EXPECT_EQ(0, strncmp("ab c", token_.original_text.data, 4));
+
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  EXPECT_EQ(GUMBO_TOKEN_CHARACTER, token_.type);
+  EXPECT_EQ('&', token_.v.character);
+
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  EXPECT_EQ(GUMBO_TOKEN_CHARACTER_RUN, token_.type);
+  EXPECT_EQ(9, token_.position.offset);
+  EXPECT_EQ(1, token_.original_text.length);
+  EXPECT_EQ('d', *token_.original_text.data);
+
+  // The run stops short of a CRLF pair, and the next one starts on its '\n'.
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  EXPECT_EQ(GUMBO_TOKEN_CHARACTER_RUN, token_.type);
+  EXPECT_EQ(11, token_.position.offset);
+  EXPECT_EQ(2, token_.original_text.length);
+  EXPECT_EQ(0, strncmp("\ne", token_.original_text.data, 2));
+
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  EXPECT_EQ(GUMBO_TOKEN_START_TAG, token_.type);
+  EXPECT_EQ(GUMBO_TAG_P, token_.v.start_tag.tag);
+}
+
 TEST_F(GumboTokenizerTest, LeadingWhitespace) {
   SetInput(
       "<div>\n"
@@ -541,6 +575,51 @@ TEST_F(GumboTokenizerTest, OpenTagWithAttributes) {
   EXPECT_EQ("link", ToString(id->original_value));
 }
 
+TEST_F(GumboTokenizerTest, ManyDuplicateAttributes) {
+  // Enough attributes that duplicates are looked up in a hash table, on two
+  // tags so that the second reuses it.
+  std::string input;
+  for (int tag = 0; tag < 2; ++tag) {
+    input += "<div";
+    for (int i = 0; i < 100; ++i) {
+      input += " a" + std::to_string(i) + "=" + std::to_string(i);
+      if (i % 10 == 9) {
+        input += " a" + std::to_string(i / 2) + "=dup";
+      }
+    }
+    input += ">";
+  }
+  SetInput(input.c_str());
+  errors_are_expected_ = true;
+
+  for (int tag = 0; tag < 2; ++tag) {
+    EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+    ASSERT_EQ(GUMBO_TOKEN_START_TAG, token_.type);
+    GumboVector* attributes = &token_.v.start_tag.attributes;
+    ASSERT_EQ(100, attributes->length);
+    for (int i = 0; i < 100; ++i) {
+      GumboAttribute* attr = static_cast<GumboAttribute*>(attributes->data[i]);
+      EXPECT_EQ("a" + std::to_string(i), attr->name);
+      EXPECT_EQ(std::to_string(i), attr->value);
+    }
+    if (tag == 0) {
+      gumbo_token_destroy(&parser_, &token_);
+    }
+  }
+
+  ASSERT_EQ(20, parser_._output->errors.length);
+  for (int i = 0; i < 20; ++i) {
+    GumboError* error =
+        static_cast<GumboError*>(parser_._output->errors.data[i]);
+    ASSERT_EQ(GUMBO_ERR_DUPLICATE_ATTR, error->type);
+    int j = i % 10;
+    EXPECT_EQ(
+        "a" + std::to_string((10 * j + 9) / 2), error->v.duplicate_attr.name);
+    EXPECT_EQ((10 * j + 9) / 2, error->v.duplicate_attr.original_index);
+    EXPECT_EQ(10 * j + 10, error->v.duplicate_attr.new_index);
+  }
+}
+
 TEST_F(GumboTokenizerTest, BogusComment1) {
   SetInput("<?xml is bogus-comment>Text");
   EXPECT_TRUE(gumbo_lex(&parser_, &token_));
@@ -591,6 +670,37 @@ TEST_F(GumboTokenizerTest, MultilineAttribute) {
       long_attr->value);
 }
 
+TEST_F(GumboTokenizerTest, RunsInTagsAndComments) {
+  SetInput(
+      "<DIV Data-X=\"a\tb\n"
+      "c&lt;d\" CLASS=Foo\xC3\xA9" "Bar><!-- a - b -->");
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  ASSERT_EQ(GUMBO_TOKEN_START_TAG, token_.type);
+
+  GumboTokenStartTag* start_tag = &token_.v.start_tag;
+  EXPECT_EQ(GUMBO_TAG_DIV, start_tag->tag);
+  ASSERT_EQ(2, start_tag->attributes.length);
+
+  GumboAttribute* data_attr =
+      static_cast<GumboAttribute*>(start_tag->attributes.data[0]);
+  EXPECT_STREQ("data-x", data_attr->name);
+  EXPECT_EQ("Data-X", ToString(data_attr->original_name));
+  EXPECT_STREQ("a\tb\nc<d", data_attr->value);
+  EXPECT_EQ(2, data_attr->value_end.line);
+  EXPECT_EQ(8, data_attr->value_end.column);
+
+  GumboAttribute* class_attr =
+      static_cast<GumboAttribute*>(start_tag->attributes.data[1]);
+  EXPECT_STREQ("class", class_attr->name);
+  EXPECT_STREQ("Foo\xC3\xA9" "Bar", class_attr->value);
+  EXPECT_EQ(22, class_attr->value_end.column);
+
+  gumbo_token_destroy(&parser_, &token_);
+  EXPECT_TRUE(gumbo_lex(&parser_, &token_));
+  ASSERT_EQ(GUMBO_TOKEN_COMMENT, token_.type);
+  EXPECT_STREQ(" a - b ", token_.v.text);
+}
+
 TEST_F(GumboTokenizerTest, DoubleAmpersand) {
   SetInput("<span jsif=\"foo && bar\">");
   EXPECT_TRUE(gumbo_lex(&parser_, &token_));
@@ -670,4 +780,109 @@ TEST_F(GumboTokenizerTest, BogusEndTag) {
   EXPECT_EQ("</div</th>", ToString(token_.original_text));
   errors_are_expected_ = true;
 }
+
+// Tokenizes input with the public tokenizer API, writing out tags as [tag] or
+// [/tag] and text and comments as they appear in the source.  Switches to the
+// given mode after start tags with the given tag.
+static std::string TokenizeWithMode(const GumboOptions* options,
+    const char* input, GumboTag mode_tag, GumboTokenizerMode mode) {
+  GumboTokenizer* tokenizer =
+      gumbo_tokenizer_create(options, input, strlen(input));
+  std::string result;
+  const GumboToken* token;
+  while ((token = gumbo_tokenizer_next(tokenizer))) {
+    switch (token->type) {
+      case GUMBO_TOKEN_START_TAG:
+        result += std::string("[") +
+                  gumbo_normalized_tagname(token->v.start_tag.tag) + "]";
+        if (token->v.start_tag.tag == mode_tag) {
+          gumbo_tokenizer_set_mode(tokenizer, mode);
+        }
+        break;
+      case GUMBO_TOKEN_END_TAG:
+        result += std::string("[/") +
+                  gumbo_normalized_tagname(token->v.end_tag) + "]";
+        break;
+      default:
+        result += ToString(token->original_text);
+        break;
+    }
+  }
+  EXPECT_TRUE(gumbo_tokenizer_next(tokenizer) == NULL);
+  gumbo_tokenizer_destroy(tokenizer);
+  return result;
+}
+
+TEST_F(GumboTokenizerTest, PublicTokenizer) {
+  const char* input = "<p class=x>Hi &amp; bye</p><!--c-->";
+  GumboTokenizer* tokenizer =
+      gumbo_tokenizer_create(&options_, input, strlen(input));
+
+  const GumboToken* token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_START_TAG, token->type);
+  EXPECT_EQ(GUMBO_TAG_P, token->v.start_tag.tag);
+  ASSERT_EQ(1, token->v.start_tag.attributes.length);
+  GumboAttribute* attr =
+      static_cast<GumboAttribute*>(token->v.start_tag.attributes.data[0]);
+  EXPECT_STREQ("class", attr->name);
+  EXPECT_STREQ("x", attr->value);
+  EXPECT_EQ("<p class=x>", ToString(token->original_text));
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_CHARACTER_RUN, token->type);
+  EXPECT_EQ("Hi ", ToString(token->original_text));
+  EXPECT_EQ(11, token->position.offset);
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_CHARACTER, token->type);
+  EXPECT_EQ('&', token->v.character);
+  EXPECT_EQ("&amp;", ToString(token->original_text));
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_CHARACTER_RUN, token->type);
+  EXPECT_EQ(" bye", ToString(token->original_text));
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_END_TAG, token->type);
+  EXPECT_EQ(GUMBO_TAG_P, token->v.end_tag);
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_COMMENT, token->type);
+  EXPECT_STREQ("c", token->v.text);
+
+  token = gumbo_tokenizer_next(tokenizer);
+  ASSERT_EQ(GUMBO_TOKEN_EOF, token->type);
+  EXPECT_EQ(strlen(input), token->position.offset);
+  EXPECT_TRUE(gumbo_tokenizer_next(tokenizer) == NULL);
+  gumbo_tokenizer_destroy(tokenizer);
+}
+
+TEST_F(GumboTokenizerTest, PublicTokenizerDestroyedEarly) {
+  const char* input = "<!DOCTYPE html><a href=x>";
+  GumboTokenizer* tokenizer =
+      gumbo_tokenizer_create(&options_, input, strlen(input));
+  ASSERT_EQ(GUMBO_TOKEN_DOCTYPE, gumbo_tokenizer_next(tokenizer)->type);
+  ASSERT_EQ(GUMBO_TOKEN_START_TAG, gumbo_tokenizer_next(tokenizer)->type);
+  gumbo_tokenizer_destroy(tokenizer);
+}
+
+TEST_F(GumboTokenizerTest, PublicTokenizerModes) {
+  const char* input = "<title><b></title><b>";
+  EXPECT_EQ("[title][b][/title][b]",
+      TokenizeWithMode(&options_, input, GUMBO_TAG_LAST,
+          GUMBO_TOKENIZER_MODE_DATA));
+  EXPECT_EQ("[title]<b>[/title][b]",
+      TokenizeWithMode(&options_, input, GUMBO_TAG_TITLE,
+          GUMBO_TOKENIZER_MODE_RCDATA));
+
+  input = "<script>if (a<b) x='</p>';</script><p>&amp;";
+  EXPECT_EQ("[script]if (a<b) x='</p>';[/script][p]&amp;",
+      TokenizeWithMode(&options_, input, GUMBO_TAG_SCRIPT,
+          GUMBO_TOKENIZER_MODE_SCRIPT_DATA));
+
+  input = "<plaintext></plaintext>";
+  EXPECT_EQ("[plaintext]</plaintext>",
+      TokenizeWithMode(&options_, input, GUMBO_TAG_PLAINTEXT,
+          GUMBO_TOKENIZER_MODE_PLAINTEXT));
+}
 }  // namespace
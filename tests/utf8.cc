@@ -18,6 +18,9 @@
 
 #include <string.h>
 
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "error.h"
 #include "gumbo.h"
@@ -366,6 +369,40 @@ TEST_F(Utf8Test, TruncatedInput) {
   EXPECT_EQ(-1, utf8iterator_current(&input_));
 }
 
+TEST_F(Utf8Test, InvalidSequenceAfterLongValidText) {
+  // Enough valid multi-byte text to span several validation blocks, with a
+  // three-byte character on every block boundary, followed by a stray
+  // continuation byte and a truncated sequence.
+  std::string text;
+  for (int i = 0; i < 3000; ++i) {
+    text += "\xE2\x82\xAC";
+  }
+  text += "x\x80y\xE2\x82";
+  ResetText(text.c_str());
+  Advance(3000);
+  EXPECT_EQ(0, GetNumErrors());
+  EXPECT_EQ('x', utf8iterator_current(&input_));
+
+  Advance(1);
+  EXPECT_EQ(0xFFFD, utf8iterator_current(&input_));
+  Advance(1);
+  EXPECT_EQ('y', utf8iterator_current(&input_));
+  Advance(1);
+  EXPECT_EQ(0xFFFD, utf8iterator_current(&input_));
+  Advance(1);
+  EXPECT_EQ(-1, utf8iterator_current(&input_));
+
+  errors_are_expected_ = true;
+  ASSERT_EQ(2, GetNumErrors());
+  GumboError* error = GetFirstError();
+  EXPECT_EQ(GUMBO_ERR_UTF8_INVALID, error->type);
+  EXPECT_EQ(9001, error->position.offset);
+  EXPECT_EQ(3002, error->position.column);
+  error = static_cast<GumboError*>(parser_._output->errors.data[1]);
+  EXPECT_EQ(GUMBO_ERR_UTF8_TRUNCATED, error->type);
+  EXPECT_EQ(9003, error->position.offset);
+}
+
 TEST_F(Utf8Test, Html5SpecExample) {
   // This example has since been removed from the spec, and the spec has been
   // changed to reference the Unicode Standard 6.2, 5.22 "Best practices for
@@ -478,6 +515,312 @@ TEST_F(Utf8Test, ConfigurableTabstop) {
   EXPECT_EQ(3, pos.offset);
 }
 
+TEST_F(Utf8Test, SkipText) {
+  options_.tab_stop = 4;
+  ResetText("plain\ttext\nover two lines, long enough for a few blocks\f\t"
+            "of the scanning kernels\n\n and then an <a> tag");
+
+  EXPECT_TRUE(utf8iterator_skip_text(&input_));
+  EXPECT_EQ('<', utf8iterator_current(&input_));
+  EXPECT_EQ(strchr(text_, '<'), utf8iterator_get_char_pointer(&input_));
+
+  // Compare with the position reached one code point at a time.
+  GumboSourcePosition skipped;
+  utf8iterator_get_position(&input_, &skipped);
+  ResetText(text_);
+  Advance(strchr(text_, '<') - text_);
+  GumboSourcePosition pos;
+  utf8iterator_get_position(&input_, &pos);
+  EXPECT_EQ(pos.line, skipped.line);
+  EXPECT_EQ(pos.column, skipped.column);
+  EXPECT_EQ(pos.offset, skipped.offset);
+  EXPECT_EQ(4, pos.line);
+  EXPECT_EQ(14, pos.column);
+
+  EXPECT_FALSE(utf8iterator_skip_text(&input_));
+  EXPECT_EQ('<', utf8iterator_current(&input_));
+}
+
+TEST_F(Utf8Test, OffsetsOnly) {
+  options_.offsets_only = true;
+  ResetText("a\n\tb\r\nplain text\nover lines<x>");
+  GumboSourcePosition pos;
+  utf8iterator_get_position(&input_, &pos);
+  EXPECT_EQ(0, pos.line);
+  EXPECT_EQ(0, pos.column);
+  EXPECT_EQ(0, pos.offset);
+
+  Advance(5);
+  EXPECT_TRUE(utf8iterator_skip_text(&input_));
+  EXPECT_EQ('<', utf8iterator_current(&input_));
+  utf8iterator_get_position(&input_, &pos);
+  EXPECT_EQ(0, pos.line);
+  EXPECT_EQ(0, pos.column);
+  EXPECT_EQ(strchr(text_, '<') - text_, pos.offset);
+}
+
+TEST_F(Utf8Test, LineIndexMatchesIterator) {
+  // Invalid UTF-8 is counted the same way, errors and all.
+  errors_are_expected_ = true;
+  options_.tab_stop = 4;
+  std::string text =
+      "first\tline, long enough to span a few blocks of the kernels\r\n"
+      "\xC3\xA5\t\xE2\x98\xBA\tand\rMac\n\n\x85\xC0\x75\xF1\xA7\xA7-\r\r\n"
+      "\tlast\xE2\x98";
+  ResetText(text.c_str());
+  GumboLineIndex* index =
+      gumbo_line_index_create(&options_, text.data(), text.length());
+  while (true) {
+    GumboSourcePosition expected;
+    utf8iterator_get_position(&input_, &expected);
+    GumboSourcePosition resolved = expected;
+    resolved.line = 0;
+    resolved.column = 0;
+    gumbo_line_index_resolve(index, &resolved);
+    EXPECT_EQ(expected.line, resolved.line) << "offset " << expected.offset;
+    EXPECT_EQ(expected.column, resolved.column) << "offset " << expected.offset;
+    if (utf8iterator_current(&input_) == -1) {
+      break;
+    }
+    utf8iterator_next(&input_);
+  }
+  gumbo_line_index_destroy(index);
+}
+
+TEST_F(Utf8Test, SkipTextStopsAtSpecialCharacters) {
+  // Reading the control characters after the skip records errors.
+  errors_are_expected_ = true;
+  const char* const kStops[] = {"&", "\r", "\x01", "\x7F", "\xC2\x85",
+      "\xEF\xB7\x90", "\xEF\xBF\xBD", "\xF0\x9F\xBF\xBE", "\xC3" "a", "<"};
+  for (size_t i = 0; i < sizeof(kStops) / sizeof(kStops[0]); ++i) {
+    // Put the stop at every offset across a couple of 32-byte blocks.
+    for (int offset = 1; offset < 70; ++offset) {
+      std::string text(offset, 'x');
+      text += kStops[i];
+      text += "yyyy";
+      ResetText(text.c_str());
+      EXPECT_TRUE(utf8iterator_skip_text(&input_));
+      EXPECT_EQ(text.c_str() + offset, utf8iterator_get_char_pointer(&input_));
+      GumboSourcePosition pos;
+      utf8iterator_get_position(&input_, &pos);
+      EXPECT_EQ(offset, pos.offset);
+      EXPECT_EQ(offset + 1, pos.column);
+    }
+  }
+  ResetText("\rx");
+  EXPECT_FALSE(utf8iterator_skip_text(&input_));
+  ResetText("");
+  EXPECT_FALSE(utf8iterator_skip_text(&input_));
+}
+
+// Runs every kernel of every compiled-in set over the same inputs, with a byte
+// that ends some of the scans placed at each offset across several 16- and
+// 32-byte lanes, from each alignment, and checks that they match the scalar
+// kernels.
+TEST_F(Utf8Test, KernelSetsAgree) {
+  const Utf8Kernels* const* kernels = utf8_available_kernels();
+  const Utf8Kernels* scalar = kernels[0];
+  for (int i = 1; kernels[i]; ++i) {
+    scalar = kernels[i];
+  }
+  EXPECT_STREQ("scalar", scalar->name);
+
+  const char kStops[] = {'<', '&', '\0', '\r', '\n', '\x01', '\x7F', '\x80',
+      '\xC3', '\xFF'};
+  const char* const kFillers[] = {"x", "plain\ttext\fover\nlines "};
+  for (int k = 0; kernels[k]; ++k) {
+    const Utf8Kernels* kernel = kernels[k];
+    for (size_t f = 0; f < sizeof(kFillers) / sizeof(kFillers[0]); ++f) {
+      for (size_t s = 0; s < sizeof(kStops); ++s) {
+        for (int align = 0; align < 32; ++align) {
+          std::string text(align, 'x');
+          while (text.length() < align + 100u) {
+            text += kFillers[f];
+          }
+          for (int offset = 0; offset < 100; ++offset) {
+            std::string input = text;
+            input[align + offset] = kStops[s];
+            const char* begin = input.data() + align;
+            // With and without the stop.
+            const char* const kEnds[] = {
+                input.data() + input.length(), begin + offset};
+            for (int e = 0; e < 2; ++e) {
+              const char* end = kEnds[e];
+              int expected_newlines = 0;
+              const char* expected_line_start = begin;
+              size_t expected = scalar->scan_text(
+                  begin, end, &expected_newlines, &expected_line_start);
+              int newlines = 0;
+              const char* line_start = begin;
+              EXPECT_EQ(expected,
+                  kernel->scan_text(begin, end, &newlines, &line_start))
+                  << kernel->name << " stop " << s << " at " << offset;
+              EXPECT_EQ(expected_newlines, newlines) << kernel->name;
+              EXPECT_EQ(expected_line_start, line_start) << kernel->name;
+              EXPECT_EQ(scalar->scan_ascii(begin, end),
+                  kernel->scan_ascii(begin, end))
+                  << kernel->name << " stop " << s << " at " << offset;
+              EXPECT_EQ(scalar->scan_line(begin, end),
+                  kernel->scan_line(begin, end))
+                  << kernel->name << " stop " << s << " at " << offset;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Like KernelSetsAgree, for the kernels that deal with multi-byte characters:
+// puts characters that stop the multi-byte scans, and ones that fail
+// validation, after each character of text made of multi-byte characters
+// that straddle the lanes in every way.
+TEST_F(Utf8Test, MultibyteKernelSetsAgree) {
+  const Utf8Kernels* const* kernels = utf8_available_kernels();
+  const Utf8Kernels* scalar = kernels[0];
+  for (int i = 1; kernels[i]; ++i) {
+    scalar = kernels[i];
+  }
+
+  const char* const kCharacters[] = {"\xC3\xA9", "\xE4\xB8\xAD",
+      "\xF0\x9F\x98\x80", "\xEF\xBC\x8C", "\xC2\xA0", "\xE2\x80\x94", "a"};
+  const int kNumCharacters = sizeof(kCharacters) / sizeof(kCharacters[0]);
+  const char* const kStops[] = {"<", "\xC2\x85", "\xEF\xB7\x90",
+      "\xEF\xBF\xBD", "\xEF\xBF\xBE", "\xF0\x9F\xBF\xBF", "\xF4\x8F\xBF\xBE",
+      // Malformed.
+      "\x80", "\xC0\xAF", "\xC3" "a", "\xE0\x80\xAF", "\xED\xA0\x80",
+      "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF0\x9F\x98" "a", "\xFF"};
+  for (int k = 0; kernels[k]; ++k) {
+    const Utf8Kernels* kernel = kernels[k];
+    for (int align = 0; align < 32; ++align) {
+      std::string text(align, 'x');
+      std::vector<size_t> boundaries;
+      for (int i = align; text.length() < align + 100u; ++i) {
+        boundaries.push_back(text.length());
+        text += kCharacters[i % kNumCharacters];
+      }
+      for (size_t b = 0; b < boundaries.size(); ++b) {
+        for (size_t s = 0; s < sizeof(kStops) / sizeof(kStops[0]); ++s) {
+          std::string input = text;
+          input.insert(boundaries[b], kStops[s]);
+          const char* begin = input.data() + align;
+          const char* end = input.data() + input.length();
+          size_t valid_length = scalar->validate(begin, end);
+          EXPECT_EQ(valid_length, kernel->validate(begin, end))
+              << kernel->name << " stop " << s << " at " << boundaries[b];
+          // The multi-byte kernels may start in the middle of a character.
+          for (size_t offset = 0; offset < 3 && offset < valid_length;
+               ++offset) {
+            size_t expected_characters = 0;
+            size_t expected = scalar->scan_multibyte(
+                begin + offset, begin + valid_length, &expected_characters);
+            size_t characters = 0;
+            EXPECT_EQ(expected, kernel->scan_multibyte(begin + offset,
+                                    begin + valid_length, &characters))
+                << kernel->name << " stop " << s << " at " << boundaries[b];
+            EXPECT_EQ(expected_characters, characters) << kernel->name;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Compares the validation kernels on randomly corrupted text.
+TEST_F(Utf8Test, ValidationKernelSetsAgreeOnCorruptedText) {
+  const Utf8Kernels* const* kernels = utf8_available_kernels();
+  const char* const kCharacters[] = {"\xC3\xA9", "\xE4\xB8\xAD",
+      "\xF0\x9F\x98\x80", "\xED\x9F\xBF", "\xF4\x8F\xBF\xBF", "text "};
+  std::string text;
+  for (int i = 0; text.length() < 300; i = (i * 7 + 3) % 6) {
+    text += kCharacters[i];
+  }
+  unsigned int random = 1;
+  for (int i = 0; i < 5000; ++i) {
+    std::string input = text;
+    for (int j = 0; j < 2; ++j) {
+      random = random * 1103515245 + 12345;
+      input[(random >> 8) % input.length()] = (char) (random >> 20);
+    }
+    const char* begin = input.data();
+    const char* end = begin + input.length();
+    size_t expected = kernels[0]->validate(begin, end);
+    for (int k = 1; kernels[k]; ++k) {
+      EXPECT_EQ(expected, kernels[k]->validate(begin, end))
+          << kernels[k]->name << " disagrees with " << kernels[0]->name;
+    }
+  }
+}
+
+TEST_F(Utf8Test, SkipTextWithEachKernelSet) {
+  options_.tab_stop = 4;
+  const char* text =
+      "plain\ttext\nover two lines, long enough for a few blocks\f\t"
+      "of the scanning kernels\n\n and then an <a> tag";
+  const Utf8Kernels* const* kernels = utf8_available_kernels();
+  for (int k = 0; kernels[k]; ++k) {
+    ResetText(text);
+    utf8iterator_set_kernels(&input_, kernels[k]);
+    EXPECT_TRUE(utf8iterator_skip_text(&input_));
+    EXPECT_EQ(strchr(text_, '<'), utf8iterator_get_char_pointer(&input_));
+    GumboSourcePosition pos;
+    utf8iterator_get_position(&input_, &pos);
+    EXPECT_EQ(4, pos.line) << kernels[k]->name;
+    EXPECT_EQ(14, pos.column) << kernels[k]->name;
+  }
+}
+
+// Skips through text with multi-byte characters with each kernel set, and
+// checks that each skip ends where, and at the same position as, reading one
+// code point at a time would.
+TEST_F(Utf8Test, SkipTextOverMultibyteText) {
+  // Reading the forbidden characters records errors.
+  errors_are_expected_ = true;
+  options_.tab_stop = 4;
+  std::string text;
+  for (int i = 0; i < 40; ++i) {
+    text += "\xE4\xB8\xAD\xE6\x96\x87 \xF0\x9F\x98\x80\t\xC3\xA9t\xC3\xA9\n";
+    if (i % 8 == 7) {
+      text += "\xEF\xBF\xBE<\xC2\x85&\xEF\xB7\x90\xEF\xBF\xBD\r\n\xE2\x80";
+    }
+  }
+  ResetText(text.c_str());
+  std::vector<GumboSourcePosition> positions(text.length() + 1);
+  while (true) {
+    GumboSourcePosition pos;
+    utf8iterator_get_position(&input_, &pos);
+    positions[utf8iterator_get_char_pointer(&input_) - text_] = pos;
+    if (utf8iterator_current(&input_) == -1) {
+      break;
+    }
+    utf8iterator_next(&input_);
+  }
+
+  const Utf8Kernels* const* kernels = utf8_available_kernels();
+  for (int k = 0; kernels[k]; ++k) {
+    ResetText(text.c_str());
+    utf8iterator_set_kernels(&input_, kernels[k]);
+    int num_skips = 0;
+    while (utf8iterator_current(&input_) != -1) {
+      if (!utf8iterator_skip_text(&input_)) {
+        utf8iterator_next(&input_);
+        continue;
+      }
+      ++num_skips;
+      GumboSourcePosition pos;
+      utf8iterator_get_position(&input_, &pos);
+      const GumboSourcePosition& expected =
+          positions[utf8iterator_get_char_pointer(&input_) - text_];
+      EXPECT_EQ(expected.offset, pos.offset) << kernels[k]->name;
+      EXPECT_EQ(expected.line, pos.line) << kernels[k]->name;
+      EXPECT_EQ(expected.column, pos.column) << kernels[k]->name;
+    }
+    // Each of the five groups of lines is skipped up to its first forbidden
+    // character, and its line break up to the malformed one after it.
+    EXPECT_EQ(5 * 2, num_skips) << kernels[k]->name;
+  }
+}
+
 TEST_F(Utf8Test, CRLF) {
   ResetText("Windows\r\nlinefeeds");
   Advance(sizeof("Windows") - 1);
@@ -154,4 +154,27 @@ TEST_F(GumboVectorTest, RemoveAt) {
   EXPECT_EQ(3, three);
 }
 
+TEST_F(GumboVectorTest, InlineStorage) {
+  void* inline_data[2];
+  GumboVector vector;
+  gumbo_vector_init_inline(inline_data, 2, &vector);
+  size_t num_allocations = malloc_stats_.objects_allocated;
+  gumbo_vector_add_inline(&parser_, &one_, inline_data, &vector);
+  gumbo_vector_insert_at_inline(&parser_, &two_, 0, inline_data, &vector);
+  EXPECT_EQ(inline_data, vector.data);
+  EXPECT_EQ(2, vector.length);
+  EXPECT_EQ(num_allocations, malloc_stats_.objects_allocated);
+  EXPECT_EQ(&two_, vector.data[0]);
+  EXPECT_EQ(&one_, vector.data[1]);
+
+  gumbo_vector_add_inline(&parser_, &three_, inline_data, &vector);
+  EXPECT_NE(inline_data, vector.data);
+  EXPECT_EQ(3, vector.length);
+  EXPECT_EQ(4, vector.capacity);
+  EXPECT_EQ(&two_, vector.data[0]);
+  EXPECT_EQ(&one_, vector.data[1]);
+  EXPECT_EQ(&three_, vector.data[2]);
+  gumbo_vector_destroy_inline(&parser_, inline_data, &vector);
+}
+
 }  // namespace